@@ -36,6 +36,11 @@ typedef enum {
 #define CONNMAN_LOG_LEVEL_DEFAULT CONNMAN_LOG_LEVEL_ERROR
 #endif
 
+typedef enum {
+	CONNMAN_LOG_SINK_STDIO,
+	CONNMAN_LOG_SINK_JOURNAL
+} connman_log_sink_t;
+
 typedef enum {
 	CONNMAN_MANAGER_EVENT_TECHNOLOGY_ADD,
 	CONNMAN_MANAGER_EVENT_TECHNOLOGY_REMOVE,
@@ -63,11 +68,119 @@ typedef void (*connman_agent_event_cb_t)(const gchar *service,
 					 GVariant *property,
 					 gpointer user_data);
 
+typedef enum {
+	CONNMAN_AGENT_REQUEST_INPUT,
+	CONNMAN_AGENT_REQUEST_BROWSER,
+	CONNMAN_AGENT_REPORT_ERROR,
+	CONNMAN_AGENT_REPORT_PEER_ERROR,
+	CONNMAN_AGENT_CANCEL,
+	CONNMAN_AGENT_RELEASE
+} connman_agent_method_t;
+
+typedef void (*connman_agent_method_cb_t)(connman_agent_method_t method,
+					  const gchar *object,
+					  const int id,
+					  GVariant *parameters,
+					  gpointer user_data);
+
+typedef enum {
+	CONNMAN_SCAN_INTEREST_BACKGROUND,
+	CONNMAN_SCAN_INTEREST_ACTIVE
+} connman_scan_interest_t;
+
+typedef void (*connman_technology_scan_cb_t)(const gchar *technology,
+					     gboolean status,
+					     const char *error,
+					     GVariant *added,
+					     GVariant *removed,
+					     gpointer user_data);
+
+/*
+ * Times in microseconds since connman_service_connect(), -1 for points
+ * that were not reached.
+ */
+typedef struct {
+	const gchar *service;
+	gboolean success;
+	const gchar *error;
+	gint64 request_input;
+	gint64 agent_response;
+	gint64 association;
+	gint64 configuration;
+	gint64 ready;
+	gint64 online;
+	gint64 total;
+} connman_connect_timing_t;
+
+typedef void (*connman_connect_timing_cb_t)(const connman_connect_timing_t *timing,
+					    gpointer user_data);
+
+/*
+ * Auto-connect policy; the string arrays are NULL-terminated and copied.
+ * type_order lists preferred service types first, holdoff_ms is the
+ * minimum time between two connects or moves.
+ */
+typedef struct {
+	guint min_strength;
+	guint hysteresis;
+	gboolean favorites_first;
+	const gchar **type_order;
+	const gchar **blacklist;
+	guint holdoff_ms;
+} connman_policy_t;
+
+typedef void (*connman_wait_cb_t)(gboolean satisfied, gpointer user_data);
+
 typedef void (*connman_service_connect_cb_t)(const gchar *service,
 					     gboolean status,
 					     const char *error,
 					     gpointer user_data);
 
+/*
+ * Connect retries: max_attempts counts the first one, the delay starts at
+ * initial_delay_ms and doubles up to max_delay_ms, and up to
+ * jitter_percent of it is taken off at random.  Zero delays pick defaults.
+ */
+typedef struct {
+	guint max_attempts;
+	guint initial_delay_ms;
+	guint max_delay_ms;
+	guint jitter_percent;
+} connman_retry_policy_t;
+
+typedef struct {
+	gint64 receive_time;
+	gint64 dispatch_time;
+	guint64 sequence;
+} connman_event_info_t;
+
+typedef void (*connman_manager_event_full_cb_t)(const gchar *path,
+						connman_manager_event_t event,
+						GVariant *properties,
+						const connman_event_info_t *info,
+						gpointer user_data);
+
+typedef void (*connman_technology_property_event_full_cb_t)(const gchar *technology,
+							    GVariant *properties,
+							    const connman_event_info_t *info,
+							    gpointer user_data);
+
+typedef void (*connman_service_property_event_full_cb_t)(const gchar *service,
+							 GVariant *property,
+							 const connman_event_info_t *info,
+							 gpointer user_data);
+
+typedef enum {
+	CONNMAN_STALL_CALLBACK,
+	CONNMAN_STALL_DISPATCH
+} connman_stall_type_t;
+
+typedef void (*connman_stall_cb_t)(connman_stall_type_t type,
+				   const gchar *source,
+				   gpointer callback,
+				   guint64 duration_us,
+				   gpointer user_data);
+
 void connman_add_manager_event_callback(connman_manager_event_cb_t cb,
 					gpointer user_data);
 
@@ -77,58 +190,198 @@ void connman_add_technology_property_event_callback(connman_technology_property_
 void connman_add_service_property_event_callback(connman_service_property_event_cb_t cb,
 						 gpointer user_data);
 
+void connman_add_manager_event_callback_full(connman_manager_event_full_cb_t cb,
+					     gpointer user_data);
+
+void connman_add_technology_property_event_callback_full(connman_technology_property_event_full_cb_t cb,
+							 gpointer user_data);
+
+void connman_add_service_property_event_callback_full(connman_service_property_event_full_cb_t cb,
+						      gpointer user_data);
+
 void connman_add_agent_event_callback(connman_agent_event_cb_t cb,
 				      gpointer user_data);
 
+void connman_add_agent_method_callback(connman_agent_method_cb_t cb,
+				       gpointer user_data);
+
+void connman_set_agent_timeout(guint timeout_ms);
+
+gboolean connman_agent_credentials_enable(guint max_entries);
+
+gboolean connman_agent_credentials_set(const gchar *service, GVariant *values);
+
+void connman_agent_credentials_forget(const gchar *service);
+
 void connman_set_log_level(connman_log_level_t level);
 
+gboolean connman_set_log_sink(connman_log_sink_t sink);
+
+void connman_set_request_buffering(guint max_requests, guint deadline_ms);
+
+void connman_set_default_timeout(guint timeout_ms);
+
+void connman_set_bus_address(const gchar *address);
+
 gboolean connman_init(gboolean register_agent);
 
 gboolean connman_manager_get_state(gchar **state);
 
+gboolean connman_manager_get_state_with_timeout(gchar **state, gint timeout_ms);
+
 gboolean connman_manager_get_online(void);
 
 gboolean connman_manager_set_offline(gboolean state);
 
+gboolean connman_manager_set_offline_with_timeout(gboolean state, gint timeout_ms);
+
 gboolean connman_get_technologies(GVariant **reply);
 
+gboolean connman_get_technologies_with_timeout(GVariant **reply, gint timeout_ms);
+
 gboolean connman_get_services(GVariant **reply);
 
+gboolean connman_get_services_with_timeout(GVariant **reply, gint timeout_ms);
+
 gboolean connman_technology_enable(const gchar *technology);
 
+gboolean connman_technology_enable_with_timeout(const gchar *technology,
+						gint timeout_ms);
+
 gboolean connman_technology_disable(const gchar *technology);
 
+gboolean connman_technology_disable_with_timeout(const gchar *technology,
+						 gint timeout_ms);
+
 gboolean connman_technology_scan_services(const gchar *technology);
 
+gboolean connman_technology_scan_services_with_timeout(const gchar *technology,
+						       gint timeout_ms);
+
+gboolean connman_technology_scan_async(const gchar *technology,
+				       connman_technology_scan_cb_t cb,
+				       gpointer user_data);
+
+void connman_set_scan_min_interval(guint interval_ms);
+
+guint connman_scan_lease_acquire(const gchar *technology,
+				 connman_scan_interest_t interest);
+
+void connman_scan_lease_release(guint lease);
+
 gboolean connman_service_move(const gchar *service,
 			      const gchar *target_service,
 			      gboolean after);
 
+gboolean connman_service_move_with_timeout(const gchar *service,
+					   const gchar *target_service,
+					   gboolean after,
+					   gint timeout_ms);
+
 gboolean connman_service_remove(const gchar *service);
 
+gboolean connman_service_remove_with_timeout(const gchar *service,
+					     gint timeout_ms);
+
 gboolean connman_service_connect(const gchar *service,
 				 connman_service_connect_cb_t cb,
 				 gpointer user_data);
 
+gboolean connman_service_connect_with_timeout(const gchar *service,
+					      connman_service_connect_cb_t cb,
+					      gpointer user_data,
+					      gint timeout_ms);
+
+gboolean connman_service_connect_with_retry(const gchar *service,
+					    const connman_retry_policy_t *policy,
+					    connman_service_connect_cb_t cb,
+					    gpointer user_data);
+
+void connman_set_connect_timing_callback(connman_connect_timing_cb_t cb,
+					 gpointer user_data);
+
+GVariant *connman_connect_timings(void);
+
+gboolean connman_policy_enable(const connman_policy_t *policy);
+
+void connman_policy_disable(void);
+
 gboolean connman_service_disconnect(const gchar *service);
 
+gboolean connman_service_disconnect_with_timeout(const gchar *service,
+						 gint timeout_ms);
+
 typedef enum {
 	CONNMAN_PROPERTY_MANAGER,
 	CONNMAN_PROPERTY_TECHNOLOGY,
 	CONNMAN_PROPERTY_SERVICE
 } connman_property_type_t;
 
+gboolean connman_wait_for(connman_property_type_t type,
+			  const gchar *object,
+			  const gchar *property,
+			  GVariant *value,
+			  gint timeout_ms);
+
+guint connman_wait_for_async(connman_property_type_t type,
+			     const gchar *object,
+			     const gchar *property,
+			     GVariant *value,
+			     gint timeout_ms,
+			     connman_wait_cb_t cb,
+			     gpointer user_data);
+
+gboolean connman_wait_cancel(guint id);
+
 GVariant *connman_get_property(connman_property_type_t prop_type,
 			       const char *path,
 			       const char *name);
 
+GVariant *connman_get_property_with_timeout(connman_property_type_t prop_type,
+					    const char *path,
+					    const char *name,
+					    gint timeout_ms);
+
 gboolean connman_set_property(connman_property_type_t prop_type,
 			      const char *path,
 			      const char *name,
 			      GVariant *value);
 
+gboolean connman_set_property_with_timeout(connman_property_type_t prop_type,
+					   const char *path,
+					   const char *name,
+					   GVariant *value,
+					   gint timeout_ms);
+
 gboolean connman_agent_response(const int id, GVariant *parameters);
 
+void connman_metrics_enable(gboolean enable);
+
+GVariant *connman_metrics_snapshot(void);
+
+gchar *connman_metrics_openmetrics(void);
+
+gboolean connman_inject_signal(const gchar *object_path,
+			       const gchar *interface,
+			       const gchar *signal,
+			       GVariant *parameters);
+
+gboolean connman_capture_start(const gchar *filename);
+
+void connman_capture_stop(void);
+
+gint64 connman_capture_replay(const gchar *filename, gdouble speed);
+
+gboolean connman_trace_start(guint max_events);
+
+void connman_trace_stop(void);
+
+gchar *connman_trace_export_json(void);
+
+void connman_set_stall_callback(connman_stall_cb_t cb,
+				guint threshold_ms,
+				gpointer user_data);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
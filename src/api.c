@@ -34,10 +34,24 @@
 #include "call_work.h"
 #include "connman-call.h"
 #include "connman-agent.h"
+#include "connman-cache.h"
+#include "connman-queue.h"
+#include "connman-metrics.h"
+#include "connman-watchdog.h"
+#include "connman-trace.h"
+#include "connman-capture.h"
+#include "connman-credentials.h"
+#include "connman-scan.h"
+#include "connman-wait.h"
+#include "connman-timing.h"
+#include "connman-policy.h"
+#include "connman-retry.h"
+#include "probes.h"
 
 typedef struct connman_signal_callback_list_entry_t {
 	gpointer callback;
 	gpointer user_data;
+	gboolean full;	/* takes a connman_event_info_t */
 } callback_list_entry_t;
 
 typedef struct {
@@ -45,6 +59,27 @@ typedef struct {
 	GSList *list;
 } callback_list_t;
 
+/*
+ * Receive time of the D-Bus message behind the events being emitted,
+ * only used from the handler thread.
+ */
+static gint64 g_connman_event_receive_time;
+
+#define CONNMAN_RECEIVE_QUEUE_MAX	256
+
+struct connman_receive_entry {
+	GVariant *body;
+	gint64 time;
+};
+
+/*
+ * Receive times of ConnMan signals not yet dispatched.  Global rather
+ * than in the state, as the filter may still be running on the GDBus
+ * worker thread after being removed.
+ */
+static GMutex g_connman_receive_mutex;
+static GQueue g_connman_receive_queue = G_QUEUE_INIT;
+
 callback_list_t connman_manager_callbacks;
 callback_list_t connman_technology_callbacks;
 callback_list_t connman_service_callbacks;
@@ -53,14 +88,15 @@ callback_list_t connman_service_callbacks;
 static GThread *g_connman_thread;
 static struct connman_state *g_connman_state;
 
-// Global log level
-static connman_log_level_t g_connman_log_level = CONNMAN_LOG_LEVEL_DEFAULT;
+// Bus to use instead of the system bus, e.g. for a mock ConnMan
+static gchar *g_connman_bus_address;
 
-static const char *g_connman_log_level_names[CONNMAN_LOG_LEVEL_DEBUG + 1] = {
-	"ERROR",
-	"WARNING",
-	"INFO",
-	"DEBUG"
+static const char *g_connman_manager_event_names[CONNMAN_MANAGER_EVENT_PROPERTY_CHANGE + 1] = {
+	"technology_add",
+	"technology_remove",
+	"service_change",
+	"service_remove",
+	"property_change"
 };
 
 // Wrappers to hedge possible future abstractions
@@ -74,33 +110,18 @@ static struct connman_state *connman_get_state(void)
 	return g_connman_state;
 }
 
-EXPORT void connman_set_log_level(connman_log_level_t level)
-{
-	printf("%s: Setting log level to %d\n", __FUNCTION__, level);
-	g_connman_log_level = level;
-}
-
-void connman_log(connman_log_level_t level, const char *func, const char *format, ...)
+// One sequence across all the event kinds, so gaps and reordering show
+static guint64 connman_next_event_sequence(void)
 {
-	FILE *out = stdout;
-
-	if (level > g_connman_log_level)
-		return;
-
-	if (level == CONNMAN_LOG_LEVEL_ERROR)
-		out = stderr;
+	struct connman_state *ns = connman_get_state();
 
-	va_list args;
-	va_start(args, format);
-	fprintf(out, "%s: %s: ", g_connman_log_level_names[level], func);
-        gchar *format_line = g_strconcat(format, "\n", NULL);
-	vfprintf(out, format_line, args);
-	va_end(args);
-	fflush(out);
-	g_free(format_line);
+	return ns ? ++ns->event_sequence : 0;
 }
 
-static void callback_add(callback_list_t *callbacks, gpointer callback, gpointer user_data)
+static void callback_add(callback_list_t *callbacks,
+			 gpointer callback,
+			 gpointer user_data,
+			 gboolean full)
 {
 	callback_list_entry_t *entry = NULL;
 
@@ -111,6 +132,7 @@ static void callback_add(callback_list_t *callbacks, gpointer callback, gpointer
 	entry = g_malloc0(sizeof(*entry));
 	entry->callback = callback;
 	entry->user_data = user_data;
+	entry->full = full;
 	callbacks->list = g_slist_append(callbacks->list, entry);
 	g_mutex_unlock(&callbacks->mutex);
 }
@@ -142,17 +164,35 @@ static void run_manager_callbacks(callback_list_t *callbacks,
 				  connman_manager_event_t event,
 				  GVariant *properties)
 {
+	connman_event_info_t info;
 	GSList *list;
 
 	if (!path)
 		return;
 
 	g_mutex_lock(&callbacks->mutex);
+	info.receive_time = g_connman_event_receive_time;
+	info.sequence = connman_next_event_sequence();
 	for (list = callbacks->list; list; list = g_slist_next(list)) {
 		callback_list_entry_t *entry = list->data;
 		if (entry->callback) {
-			connman_manager_event_cb_t cb = (connman_manager_event_cb_t) entry->callback;
-			(*cb)(path, event, properties, entry->user_data);
+			gint64 start = connman_callback_start("manager",
+							      g_connman_manager_event_names[event],
+							      entry->callback);
+			if (entry->full) {
+				connman_manager_event_full_cb_t cb =
+					(connman_manager_event_full_cb_t) entry->callback;
+				info.dispatch_time = g_get_monotonic_time();
+				(*cb)(path, event, properties, &info, entry->user_data);
+			} else {
+				connman_manager_event_cb_t cb =
+					(connman_manager_event_cb_t) entry->callback;
+				(*cb)(path, event, properties, entry->user_data);
+			}
+			connman_callback_done("manager",
+					      g_connman_manager_event_names[event],
+					      entry->callback,
+					      start);
 		}
 	}
 	g_mutex_unlock(&callbacks->mutex);
@@ -163,13 +203,30 @@ static void run_property_callbacks(callback_list_t *callbacks,
 				   GVariant *properties,
 				   gboolean technology)
 {
+	connman_event_info_t info;
 	GSList *list;
 
 	g_mutex_lock(&callbacks->mutex);
+	info.receive_time = g_connman_event_receive_time;
+	info.sequence = connman_next_event_sequence();
 	for (list = callbacks->list; list; list = g_slist_next(list)) {
 		callback_list_entry_t *entry = list->data;
 		if (entry->callback) {
-			if (technology) {
+			gint64 start = connman_callback_start(technology ? "technology" : "service",
+							      "property_change",
+							      entry->callback);
+			if (entry->full) {
+				info.dispatch_time = g_get_monotonic_time();
+				if (technology) {
+					connman_technology_property_event_full_cb_t cb =
+						(connman_technology_property_event_full_cb_t) entry->callback;
+					(*cb)(object, properties, &info, entry->user_data);
+				} else {
+					connman_service_property_event_full_cb_t cb =
+						(connman_service_property_event_full_cb_t) entry->callback;
+					(*cb)(object, properties, &info, entry->user_data);
+				}
+			} else if (technology) {
 				connman_technology_property_event_cb_t cb =
 					(connman_technology_property_event_cb_t) entry->callback;
 				(*cb)(object, properties, entry->user_data);
@@ -178,18 +235,150 @@ static void run_property_callbacks(callback_list_t *callbacks,
 					(connman_service_property_event_cb_t) entry->callback;
 				(*cb)(object, properties, entry->user_data);
 			}
+			connman_callback_done(technology ? "technology" : "service",
+					      "property_change",
+					      entry->callback,
+					      start);
 		}
 	}
 	g_mutex_unlock(&callbacks->mutex);
 }
 
+// Emit one property callback per entry of an a{sv}
+static void run_changed_property_callbacks(callback_list_t *callbacks,
+					   const gchar *object,
+					   GVariant *properties,
+					   gboolean technology)
+{
+	GVariantIter iter;
+	const gchar *key;
+	GVariant *val;
+
+	g_variant_iter_init(&iter, properties);
+	while (g_variant_iter_next(&iter, "{&sv}", &key, &val)) {
+		GVariant *parameters = g_variant_ref_sink(g_variant_new("(sv)", key, val));
+
+		run_property_callbacks(callbacks, object, parameters, technology);
+		g_variant_unref(parameters);
+		g_variant_unref(val);
+	}
+}
+
+/*
+ * The properties of a cache change as reported to the callbacks, with the
+ * properties that went away given as a "mv" nothing value.
+ */
+static GVariant *cache_change_properties(const struct connman_cache_change *c)
+{
+	GVariantBuilder builder;
+	GVariantIter iter;
+	const gchar *key;
+	GVariant *val;
+	guint i;
+
+	if (!c->properties)
+		return NULL;
+	if (!c->removed)
+		return g_variant_ref(c->properties);
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+	g_variant_iter_init(&iter, c->properties);
+	while (g_variant_iter_next(&iter, "{&sv}", &key, &val)) {
+		g_variant_builder_add(&builder, "{sv}", key, val);
+		g_variant_unref(val);
+	}
+	for (i = 0; c->removed[i]; i++)
+		g_variant_builder_add(&builder, "{sv}", c->removed[i],
+				      g_variant_new_maybe(G_VARIANT_TYPE_VARIANT, NULL));
+
+	return g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
+// Emit the events describing a list of local state changes
+static void run_cache_changes(GSList *changes)
+{
+	GSList *list;
+
+	for (list = changes; list; list = g_slist_next(list)) {
+		struct connman_cache_change *c = list->data;
+		GVariant *properties = cache_change_properties(c);
+
+		switch (c->type) {
+		case CONNMAN_PROPERTY_MANAGER: {
+			GVariantIter iter;
+			const gchar *key;
+			GVariant *val;
+
+			g_variant_iter_init(&iter, properties);
+			while (g_variant_iter_next(&iter, "{&sv}", &key, &val)) {
+				run_manager_callbacks(&connman_manager_callbacks,
+						      key,
+						      CONNMAN_MANAGER_EVENT_PROPERTY_CHANGE,
+						      val);
+				g_variant_unref(val);
+			}
+			break;
+		}
+		case CONNMAN_PROPERTY_TECHNOLOGY:
+			connman_scan_technology_changed(c->object);
+			if (c->change == CONNMAN_CACHE_ADDED)
+				run_manager_callbacks(&connman_manager_callbacks,
+						      c->object,
+						      CONNMAN_MANAGER_EVENT_TECHNOLOGY_ADD,
+						      properties);
+			else if (c->change == CONNMAN_CACHE_REMOVED)
+				run_manager_callbacks(&connman_manager_callbacks,
+						      c->object,
+						      CONNMAN_MANAGER_EVENT_TECHNOLOGY_REMOVE,
+						      NULL);
+			else
+				run_changed_property_callbacks(&connman_technology_callbacks,
+							       c->object,
+							       properties,
+							       TRUE);
+			break;
+		case CONNMAN_PROPERTY_SERVICE:
+			if (c->change != CONNMAN_CACHE_CHANGED)
+				connman_scan_note_service(c->object,
+							  c->change == CONNMAN_CACHE_REMOVED);
+			if (c->change == CONNMAN_CACHE_REMOVED)
+				connman_policy_service_remove(c->object);
+			else
+				connman_policy_service_update(c->object, properties);
+			// Mirror ConnMan, which signals both ServicesChanged and
+			// PropertyChanged when an existing service changes
+			if (c->change == CONNMAN_CACHE_REMOVED) {
+				run_manager_callbacks(&connman_manager_callbacks,
+						      c->object,
+						      CONNMAN_MANAGER_EVENT_SERVICE_REMOVE,
+						      NULL);
+				break;
+			}
+			run_manager_callbacks(&connman_manager_callbacks,
+					      c->object,
+					      CONNMAN_MANAGER_EVENT_SERVICE_CHANGE,
+					      properties);
+			if (c->change == CONNMAN_CACHE_CHANGED)
+				run_changed_property_callbacks(&connman_service_callbacks,
+							       c->object,
+							       properties,
+							       FALSE);
+			break;
+		default:
+			break;
+		}
+		if (properties)
+			g_variant_unref(properties);
+	}
+}
+
 EXPORT void connman_add_manager_event_callback(connman_manager_event_cb_t cb,
 					       gpointer user_data)
 {
 	if (!cb)
 		return;
 
-	callback_add(&connman_manager_callbacks, cb, user_data);
+	callback_add(&connman_manager_callbacks, cb, user_data, FALSE);
 }
 
 EXPORT void connman_add_technology_property_event_callback(connman_technology_property_event_cb_t cb,
@@ -198,7 +387,7 @@ EXPORT void connman_add_technology_property_event_callback(connman_technology_pr
 	if (!cb)
 		return;
 
-	callback_add(&connman_technology_callbacks, cb, user_data);
+	callback_add(&connman_technology_callbacks, cb, user_data, FALSE);
 }
 
 EXPORT void connman_add_service_property_event_callback(connman_service_property_event_cb_t cb,
@@ -207,7 +396,126 @@ EXPORT void connman_add_service_property_event_callback(connman_service_property
 	if (!cb)
 		return;
 
-	callback_add(&connman_service_callbacks, cb, user_data);
+	callback_add(&connman_service_callbacks, cb, user_data, FALSE);
+}
+
+EXPORT void connman_add_manager_event_callback_full(connman_manager_event_full_cb_t cb,
+						    gpointer user_data)
+{
+	if (!cb)
+		return;
+
+	callback_add(&connman_manager_callbacks, cb, user_data, TRUE);
+}
+
+EXPORT void connman_add_technology_property_event_callback_full(connman_technology_property_event_full_cb_t cb,
+								gpointer user_data)
+{
+	if (!cb)
+		return;
+
+	callback_add(&connman_technology_callbacks, cb, user_data, TRUE);
+}
+
+EXPORT void connman_add_service_property_event_callback_full(connman_service_property_event_full_cb_t cb,
+							     gpointer user_data)
+{
+	if (!cb)
+		return;
+
+	callback_add(&connman_service_callbacks, cb, user_data, TRUE);
+}
+
+static void connman_receive_entry_free(gpointer data)
+{
+	struct connman_receive_entry *entry = data;
+
+	g_variant_unref(entry->body);
+	g_free(entry);
+}
+
+/*
+ * Note the arrival time of ConnMan signals.  Filters run on the GDBus
+ * worker thread as messages are read, before the signal is queued to
+ * the handler thread; the body is referenced so its address identifies
+ * the message until the signal callback claims it.
+ */
+static GDBusMessage *connman_message_filter(GDBusConnection *connection,
+					    GDBusMessage *message,
+					    gboolean incoming,
+					    gpointer user_data)
+{
+	struct connman_receive_entry *entry;
+	const gchar *interface;
+	GVariant *body;
+
+	if (!incoming ||
+	    g_dbus_message_get_message_type(message) != G_DBUS_MESSAGE_TYPE_SIGNAL)
+		return message;
+
+	interface = g_dbus_message_get_interface(message);
+	body = g_dbus_message_get_body(message);
+	if (!(body && interface && g_str_has_prefix(interface, "net.connman.")))
+		return message;
+
+	entry = g_malloc(sizeof(*entry));
+	entry->body = g_variant_ref(body);
+	entry->time = g_get_monotonic_time();
+
+	g_mutex_lock(&g_connman_receive_mutex);
+	g_queue_push_tail(&g_connman_receive_queue, entry);
+	// Signals nobody subscribed to are never claimed
+	if (g_queue_get_length(&g_connman_receive_queue) > CONNMAN_RECEIVE_QUEUE_MAX)
+		connman_receive_entry_free(g_queue_pop_head(&g_connman_receive_queue));
+	g_mutex_unlock(&g_connman_receive_mutex);
+
+	return message;
+}
+
+/*
+ * Claim the receive time of the signal with the given parameters,
+ * dropping older entries; falls back to now if it was not seen.
+ */
+static gint64 connman_claim_receive_time(GVariant *parameters)
+{
+	struct connman_receive_entry *entry, *found = NULL;
+	gboolean done;
+	gint64 time = 0;
+	GList *link;
+
+	g_mutex_lock(&g_connman_receive_mutex);
+	for (link = g_connman_receive_queue.head; link; link = link->next) {
+		entry = link->data;
+		if (entry->body == parameters) {
+			found = entry;
+			break;
+		}
+	}
+	if (found) {
+		do {
+			entry = g_queue_pop_head(&g_connman_receive_queue);
+			time = entry->time;
+			done = entry == found;
+			connman_receive_entry_free(entry);
+		} while (!done);
+	}
+	g_mutex_unlock(&g_connman_receive_mutex);
+
+	return time ? time : g_get_monotonic_time();
+}
+
+// Track a technology or service PropertyChanged in the local state
+static void update_cache_property(struct connman_state *ns,
+				  connman_property_type_t type,
+				  const gchar *object,
+				  GVariant *parameters)
+{
+	const gchar *name = NULL;
+	GVariant *value = NULL;
+
+	g_variant_get(parameters, "(&sv)", &name, &value);
+	connman_cache_set_property(ns->cache, type, object, name, value);
+	g_variant_unref(value);
 }
 
 static void connman_manager_signal_callback(GDBusConnection *connection,
@@ -218,17 +526,24 @@ static void connman_manager_signal_callback(GDBusConnection *connection,
 					    GVariant *parameters,
 					    gpointer user_data)
 {
+	struct connman_state *ns = user_data;
+	gint64 start = connman_metrics_start();
 	GVariant *var = NULL;
 	const gchar *path = NULL;
 	const gchar *key = NULL;
 	const gchar *basename;
 
+	CONNMAN_PROBE(signal, interface_name, signal_name, object_path);
+	connman_capture_record(CONNMAN_CAPTURE_SIGNAL, object_path,
+			       interface_name, signal_name, parameters);
+	g_connman_event_receive_time = connman_claim_receive_time(parameters);
+
 #if CONNMAN_GLIB_DEBUG
 	INFO("sender=%s", sender_name);
 	INFO("object_path=%s", object_path);
 	INFO("interface=%s", interface_name);
 	INFO("signal=%s", signal_name);
-	DEBUG("parameters = %s", g_variant_print(parameters, TRUE));
+	DEBUG_VARIANT("parameters = ", parameters);
 #endif
 
 	// Be paranoid to avoid any potential issues from unexpected signals,
@@ -246,6 +561,12 @@ static void connman_manager_signal_callback(GDBusConnection *connection,
 		basename = connman_strip_path(path);
 		g_assert(basename);	/* guaranteed by dbus */
 
+		connman_cache_update_object(ns->cache,
+					    CONNMAN_PROPERTY_TECHNOLOGY,
+					    basename,
+					    var);
+		connman_scan_technology_changed(basename);
+
 		run_manager_callbacks(&connman_manager_callbacks,
 				      basename,
 				      CONNMAN_MANAGER_EVENT_TECHNOLOGY_ADD,
@@ -257,6 +578,10 @@ static void connman_manager_signal_callback(GDBusConnection *connection,
 		basename = connman_strip_path(path);
 		g_assert(basename);	/* guaranteed by dbus */
 
+		connman_cache_remove_object(ns->cache,
+					    CONNMAN_PROPERTY_TECHNOLOGY,
+					    basename);
+
 		run_manager_callbacks(&connman_manager_callbacks,
 				      basename,
 				      CONNMAN_MANAGER_EVENT_TECHNOLOGY_REMOVE,
@@ -268,13 +593,35 @@ static void connman_manager_signal_callback(GDBusConnection *connection,
 		
 		g_variant_get(parameters, "(a(oa{sv})ao)", &array1, &array2);
 		while (g_variant_iter_loop(array1, "(&o@a{sv})", &path, &var)) {
+			basename = connman_strip_path(path);
+			g_assert(basename);	/* guaranteed by dbus */
+
+			if (connman_scan_in_flight()) {
+				GVariant *type = connman_cache_get_property(ns->cache,
+									    CONNMAN_PROPERTY_SERVICE,
+									    basename,
+									    "Type");
+				if (type)
+					g_variant_unref(type);
+				else
+					connman_scan_note_service(basename, FALSE);
+			}
+
+			connman_cache_update_object(ns->cache,
+						    CONNMAN_PROPERTY_SERVICE,
+						    basename,
+						    var);
+			if (connman_timing_active()) {
+				const gchar *state = NULL;
+
+				if (g_variant_lookup(var, "State", "&s", &state))
+					connman_timing_state(basename, state);
+			}
+
 			if (!g_variant_iter_init(&array3, var)) {
 				continue;
 			}
 
-			basename = connman_strip_path(path);
-			g_assert(basename);	/* guaranteed by dbus */
-
 			run_manager_callbacks(&connman_manager_callbacks,
 					      basename,
 					      CONNMAN_MANAGER_EVENT_SERVICE_CHANGE,
@@ -285,6 +632,11 @@ static void connman_manager_signal_callback(GDBusConnection *connection,
 			basename = connman_strip_path(path);
 			g_assert(basename);	/* guaranteed by dbus */
 
+			connman_cache_remove_object(ns->cache,
+						    CONNMAN_PROPERTY_SERVICE,
+						    basename);
+			connman_scan_note_service(basename, TRUE);
+
 			run_manager_callbacks(&connman_manager_callbacks,
 					      basename,
 					      CONNMAN_MANAGER_EVENT_SERVICE_REMOVE,
@@ -294,15 +646,26 @@ static void connman_manager_signal_callback(GDBusConnection *connection,
 		g_variant_iter_free(array2);
 		g_variant_iter_free(array1);
 
+		connman_policy_services_changed(parameters);
+
 	} else if (!g_strcmp0(signal_name, "PropertyChanged")) {
 		g_variant_get(parameters, "(&sv)", &key, &var);
 
+		connman_cache_set_property(ns->cache,
+					   CONNMAN_PROPERTY_MANAGER,
+					   NULL,
+					   key,
+					   var);
+
 		run_manager_callbacks(&connman_manager_callbacks,
 				      key,
 				      CONNMAN_MANAGER_EVENT_PROPERTY_CHANGE,
 				      var);
 		g_variant_unref(var);
 	}
+
+	connman_metrics_record(CONNMAN_METRICS_SIGNAL, interface_name, signal_name,
+			       start, NULL);
 }
 
 static void connman_technology_signal_callback(GDBusConnection *connection,
@@ -313,12 +676,20 @@ static void connman_technology_signal_callback(GDBusConnection *connection,
 					       GVariant *parameters,
 					       gpointer user_data)
 {
+	struct connman_state *ns = user_data;
+	gint64 start = connman_metrics_start();
+
+	CONNMAN_PROBE(signal, interface_name, signal_name, object_path);
+	connman_capture_record(CONNMAN_CAPTURE_SIGNAL, object_path,
+			       interface_name, signal_name, parameters);
+	g_connman_event_receive_time = connman_claim_receive_time(parameters);
+
 #if CONNMAN_GLIB_DEBUG
 	INFO("sender=%s", sender_name);
 	INFO("object_path=%s", object_path);
 	INFO("interface=%s", interface_name);
 	INFO("signal=%s", signal_name);
-	DEBUG("parameters = %s", g_variant_print(parameters, TRUE));
+	DEBUG_VARIANT("parameters = ", parameters);
 #endif
 
 	// Be paranoid to avoid any potential issues from unexpected signals,
@@ -336,11 +707,17 @@ static void connman_technology_signal_callback(GDBusConnection *connection,
 	g_assert(basename);
 
 	if (!g_strcmp0(signal_name, "PropertyChanged")) {
+		update_cache_property(ns, CONNMAN_PROPERTY_TECHNOLOGY, basename, parameters);
+		connman_scan_technology_changed(basename);
+
 		run_property_callbacks(&connman_technology_callbacks,
 				       basename,
 				       parameters,
 				       TRUE);
 	}
+
+	connman_metrics_record(CONNMAN_METRICS_SIGNAL, interface_name, signal_name,
+			       start, NULL);
 }
 
 static void connman_service_signal_callback(GDBusConnection *connection,
@@ -351,12 +728,20 @@ static void connman_service_signal_callback(GDBusConnection *connection,
 					    GVariant *parameters,
 					    gpointer user_data)
 {
+	struct connman_state *ns = user_data;
+	gint64 start = connman_metrics_start();
+
+	CONNMAN_PROBE(signal, interface_name, signal_name, object_path);
+	connman_capture_record(CONNMAN_CAPTURE_SIGNAL, object_path,
+			       interface_name, signal_name, parameters);
+	g_connman_event_receive_time = connman_claim_receive_time(parameters);
+
 #if CONNMAN_GLIB_DEBUG
 	INFO("sender=%s", sender_name);
 	INFO("object_path=%s", object_path);
 	INFO("interface=%s", interface_name);
 	INFO("signal=%s", signal_name);
-	DEBUG("parameters = %s", g_variant_print(parameters, TRUE));
+	DEBUG_VARIANT("parameters = ", parameters);
 #endif
 
 	// Be paranoid to avoid any potential issues from unexpected signals,
@@ -374,11 +759,203 @@ static void connman_service_signal_callback(GDBusConnection *connection,
 	g_assert(basename);
 
 	if (!g_strcmp0(signal_name, "PropertyChanged")) {
+		update_cache_property(ns, CONNMAN_PROPERTY_SERVICE, basename, parameters);
+		if (connman_timing_active()) {
+			const gchar *name = NULL;
+			GVariant *value = NULL;
+
+			g_variant_get(parameters, "(&sv)", &name, &value);
+			if (!g_strcmp0(name, "State") &&
+			    g_variant_is_of_type(value, G_VARIANT_TYPE_STRING))
+				connman_timing_state(basename, g_variant_get_string(value, NULL));
+			g_variant_unref(value);
+		}
+		if (connman_policy_active()) {
+			const gchar *name = NULL;
+			GVariant *value = NULL;
+
+			g_variant_get(parameters, "(&sv)", &name, &value);
+			connman_policy_service_property(basename, name, value);
+			g_variant_unref(value);
+		}
+
 		run_property_callbacks(&connman_service_callbacks,
 				       basename,
 				       parameters,
 				       FALSE);
 	}
+
+	connman_metrics_record(CONNMAN_METRICS_SIGNAL, interface_name, signal_name,
+			       start, NULL);
+}
+
+struct inject_data {
+	gchar *object_path;
+	gchar *interface;
+	gchar *signal;
+	GVariant *parameters;
+};
+
+static gboolean inject_signal_cb(gpointer user_data)
+{
+	struct inject_data *d = user_data;
+	struct connman_state *ns = connman_get_state();
+	GDBusSignalCallback callback;
+
+	if (!g_strcmp0(d->interface, CONNMAN_MANAGER_INTERFACE))
+		callback = connman_manager_signal_callback;
+	else if (!g_strcmp0(d->interface, CONNMAN_TECHNOLOGY_INTERFACE))
+		callback = connman_technology_signal_callback;
+	else
+		callback = connman_service_signal_callback;
+
+	if (ns)
+		callback(ns->conn, CONNMAN_SERVICE, d->object_path, d->interface,
+			 d->signal, d->parameters, ns);
+
+	g_variant_unref(d->parameters);
+	g_free(d->object_path);
+	g_free(d->interface);
+	g_free(d->signal);
+	g_free(d);
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Refresh the local state from ConnMan.  When emit is set, only the
+ * differences from the previously known state are reported through the
+ * event callbacks, so consumers do not need to reload everything after
+ * ConnMan restarts.
+ */
+static gboolean connman_resync(struct connman_state *ns, gboolean emit)
+{
+	static const struct {
+		connman_property_type_t type;
+		const char *access_type;
+	} kinds[] = {
+		{ CONNMAN_PROPERTY_MANAGER, CONNMAN_AT_MANAGER },
+		{ CONNMAN_PROPERTY_TECHNOLOGY, CONNMAN_AT_TECHNOLOGY },
+		{ CONNMAN_PROPERTY_SERVICE, CONNMAN_AT_SERVICE },
+	};
+	gint64 deadline = connman_deadline_new(DBUS_REPLY_TIMEOUT_SHORT);
+	gint64 start = connman_metrics_start();
+	GSList *changes = NULL;
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(kinds); i++) {
+		GError *error = NULL;
+		GVariant *reply;
+
+		reply = connman_get_properties(ns, kinds[i].access_type, NULL,
+					       deadline, &error);
+		if (!reply) {
+			ERROR("%s resync failed: %s",
+			      kinds[i].access_type,
+			      error ? error->message : "unspecified");
+			g_clear_error(&error);
+			g_slist_free_full(changes, connman_cache_change_free);
+			connman_trace_span("init", "resync", NULL, start, TRUE);
+			return FALSE;
+		}
+		changes = g_slist_concat(changes,
+					 connman_cache_replace(ns->cache,
+							       kinds[i].type,
+							       reply));
+		g_variant_unref(reply);
+	}
+
+	INFO("resynchronized with %u changes", g_slist_length(changes));
+
+	if (emit) {
+		g_connman_event_receive_time = g_get_monotonic_time();
+		run_cache_changes(changes);
+	}
+	g_slist_free_full(changes, connman_cache_change_free);
+	connman_trace_span("init", "resync", NULL, start, FALSE);
+
+	return TRUE;
+}
+
+/*
+ * Property writes are idempotent, so while ConnMan is off the bus they can
+ * be buffered (if enabled) and sent once it reappears.
+ */
+static gboolean set_property_or_queue(struct connman_state *ns,
+				      const char *access_type,
+				      const char *type_arg,
+				      const char *name,
+				      GVariant *value,
+				      gint64 deadline,
+				      GError **error)
+{
+	GError *set_error = NULL;
+
+	if (!g_atomic_int_get(&ns->connman_present) && connman_queue_enabled())
+		return connman_queue_set_property(access_type, type_arg,
+						  name, value, error);
+
+	g_variant_ref_sink(value);
+	if (connman_set_property_internal(ns, access_type, type_arg,
+					  name, value, deadline, &set_error)) {
+		g_variant_unref(value);
+		return TRUE;
+	}
+
+	// ConnMan may have gone away while the call was in flight
+	if (set_error &&
+	    g_error_matches(set_error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN) &&
+	    connman_queue_enabled()) {
+		g_clear_error(&set_error);
+		gboolean queued = connman_queue_set_property(access_type, type_arg,
+							     name, value, error);
+		g_variant_unref(value);
+		return queued;
+	}
+
+	g_variant_unref(value);
+	g_propagate_error(error, set_error);
+	return FALSE;
+}
+
+static void connman_name_appeared(GDBusConnection *connection,
+				  const gchar *name,
+				  const gchar *name_owner,
+				  gpointer user_data)
+{
+	struct connman_state *ns = user_data;
+
+	g_atomic_int_set(&ns->connman_present, TRUE);
+
+	// Nothing to do if the state was already synced at init
+	if (ns->connman_synced)
+		return;
+
+	INFO("%s appeared as %s", name, name_owner);
+
+	ns->connman_synced = connman_resync(ns, TRUE);
+	connman_reregister_agent(ns);
+	connman_queue_flush(ns);
+}
+
+static void connman_name_vanished(GDBusConnection *connection,
+				  const gchar *name,
+				  gpointer user_data)
+{
+	struct connman_state *ns = user_data;
+
+	if (!g_atomic_int_get(&ns->connman_present))
+		return;
+
+	WARNING("%s vanished", name);
+
+	g_atomic_int_set(&ns->connman_present, FALSE);
+	ns->connman_synced = FALSE;
+	ns->agent_registered = FALSE;
+
+	// Fail pending requests now rather than at the D-Bus timeout
+	connman_agent_cancel_requests(ns, "ConnMan went away");
+	call_work_cancel_all(ns);
 }
 
 static struct connman_state *connman_dbus_init(GMainLoop *loop)
@@ -395,7 +972,13 @@ static struct connman_state *connman_dbus_init(GMainLoop *loop)
 	INFO("connecting to dbus");
 
 	ns->loop = loop;
-	ns->conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+	if (g_connman_bus_address)
+		ns->conn = g_dbus_connection_new_for_address_sync(g_connman_bus_address,
+								  G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+								  G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+								  NULL, NULL, &error);
+	else
+		ns->conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
 	if (!ns->conn) {
 		if (error)
 			g_dbus_error_strip_remote_error(error);
@@ -456,8 +1039,33 @@ static struct connman_state *connman_dbus_init(GMainLoop *loop)
 	g_mutex_init(&ns->cw_mutex);
 	ns->next_cw_id = 1;
 
+	ns->cache = connman_cache_new();
+	if (!ns->cache) {
+		ERROR("out of memory allocating state cache");
+		goto err_no_cache;
+	}
+
+	ns->filter_id = g_dbus_connection_add_filter(ns->conn,
+						     connman_message_filter,
+						     NULL,
+						     NULL);
+
+	// Seed the local state, ConnMan may not be running yet
+	ns->connman_synced = connman_resync(ns, FALSE);
+	g_atomic_int_set(&ns->connman_present, ns->connman_synced);
+
+	ns->name_watch = g_bus_watch_name_on_connection(ns->conn,
+							CONNMAN_SERVICE,
+							G_BUS_NAME_WATCHER_FLAGS_NONE,
+							connman_name_appeared,
+							connman_name_vanished,
+							ns,
+							NULL);
+
 	return ns;
 
+err_no_cache:
+	g_dbus_connection_signal_unsubscribe(ns->conn, ns->service_sub);
 err_no_service_sub:
 	g_dbus_connection_signal_unsubscribe(ns->conn, ns->technology_sub);
 err_no_technology_sub:
@@ -472,6 +1080,12 @@ err_no_ns:
 
 static void connman_cleanup(struct connman_state *ns)
 {
+	g_bus_unwatch_name(ns->name_watch);
+	g_dbus_connection_remove_filter(ns->conn, ns->filter_id);
+	g_mutex_lock(&g_connman_receive_mutex);
+	g_queue_clear_full(&g_connman_receive_queue, connman_receive_entry_free);
+	g_mutex_unlock(&g_connman_receive_mutex);
+	connman_cache_free(ns->cache);
 	g_dbus_connection_signal_unsubscribe(ns->conn, ns->service_sub);
 	g_dbus_connection_signal_unsubscribe(ns->conn, ns->technology_sub);
 	g_dbus_connection_signal_unsubscribe(ns->conn, ns->manager_sub);
@@ -493,8 +1107,11 @@ static gpointer connman_handler_func(gpointer ptr)
 	struct init_data *id = ptr;
 	struct connman_state *ns;
 	GMainLoop *loop;
+	gint64 start;
 	int rc;
 
+	connman_trace_instant("init", "handler_start");
+
 	loop = g_main_loop_new(NULL, FALSE);
 	if (!loop) {
 		ERROR("Unable to create main loop");
@@ -502,7 +1119,9 @@ static gpointer connman_handler_func(gpointer ptr)
 	}
 
 	// dbus interface init
+	start = connman_metrics_start();
 	ns = connman_dbus_init(loop);
+	connman_trace_span("init", "dbus_init", NULL, start, ns == NULL);
 	if (!ns) {
 		ERROR("connman_dbus_init() failed");
 		goto err_no_ns;
@@ -510,6 +1129,7 @@ static gpointer connman_handler_func(gpointer ptr)
 
 	id->ns = ns;
 	if (id->register_agent) {
+		connman_trace_instant("init", "agent_register");
 		rc = connman_register_agent(id);
 		if (rc) {
 			ERROR("network_register_agent() failed");
@@ -523,7 +1143,11 @@ static gpointer connman_handler_func(gpointer ptr)
 	}
 
 	connman_set_state(ns);
+	connman_watchdog_attach(g_main_loop_get_context(loop));
+	connman_trace_instant("init", "loop_start");
 	g_main_loop_run(loop);
+	connman_watchdog_detach();
+	connman_retry_cancel_all();
 
 	g_main_loop_unref(ns->loop);
 
@@ -548,9 +1172,16 @@ err_no_loop:
 
 // API functions
 
+EXPORT void connman_set_bus_address(const gchar *address)
+{
+	g_free(g_connman_bus_address);
+	g_connman_bus_address = g_strdup(address);
+}
+
 EXPORT gboolean connman_init(gboolean register_agent)
 {
 	struct init_data init_data, *id = &init_data;
+	gint64 start = connman_metrics_start();
 	gint64 end_time;
 
 	memset(id, 0, sizeof(*id));
@@ -578,6 +1209,7 @@ EXPORT gboolean connman_init(gboolean register_agent)
 
 	if (!id->init_done) {
 		ERROR("init timeout");
+		connman_trace_span("init", "connman_init", NULL, start, TRUE);
 		return FALSE;
 	}
 
@@ -585,13 +1217,45 @@ EXPORT gboolean connman_init(gboolean register_agent)
 		ERROR("init thread failed");
 	else
 		INFO("connman operational");
+	connman_trace_span("init", "connman_init", NULL, start, !id->rc);
 
 	return id->rc;
 }
 
-EXPORT gboolean connman_manager_get_state(gchar **state)
+/*
+ * Feed a signal to the handlers as if it came from ConnMan, bypassing the
+ * bus, for load generation and replay.  It is queued to the handler thread.
+ */
+EXPORT gboolean connman_inject_signal(const gchar *object_path,
+				      const gchar *interface,
+				      const gchar *signal,
+				      GVariant *parameters)
 {
 	struct connman_state *ns = connman_get_state();
+	struct inject_data *d;
+
+	if (!(ns && object_path && signal && parameters))
+		return FALSE;
+
+	if (g_strcmp0(interface, CONNMAN_MANAGER_INTERFACE) &&
+	    g_strcmp0(interface, CONNMAN_TECHNOLOGY_INTERFACE) &&
+	    g_strcmp0(interface, CONNMAN_SERVICE_INTERFACE))
+		return FALSE;
+
+	d = g_malloc0(sizeof(*d));
+	d->object_path = g_strdup(object_path);
+	d->interface = g_strdup(interface);
+	d->signal = g_strdup(signal);
+	d->parameters = g_variant_ref_sink(parameters);
+	g_main_context_invoke(g_main_loop_get_context(ns->loop), inject_signal_cb, d);
+
+	return TRUE;
+}
+
+EXPORT gboolean connman_manager_get_state_with_timeout(gchar **state, gint timeout_ms)
+{
+	struct connman_state *ns = connman_get_state();
+	gint64 deadline = connman_deadline_new(timeout_ms);
 	GVariant *prop = NULL;
 	GError *error = NULL;
 
@@ -606,6 +1270,7 @@ EXPORT gboolean connman_manager_get_state(gchar **state)
 					     CONNMAN_AT_MANAGER,
 					     NULL,
 					     "State",
+					     deadline,
 					     &error);
 	if (error) {
 		ERROR("property %s error %s", "State", error->message);
@@ -624,6 +1289,11 @@ EXPORT gboolean connman_manager_get_state(gchar **state)
 	return TRUE;
 }
 
+EXPORT gboolean connman_manager_get_state(gchar **state)
+{
+	return connman_manager_get_state_with_timeout(state, -1);
+}
+
 EXPORT gboolean connman_manager_get_online(void)
 {
 	gboolean rc = FALSE;
@@ -636,24 +1306,31 @@ EXPORT gboolean connman_manager_get_online(void)
 	return rc;
 }
 
-EXPORT gboolean connman_manager_set_offline(gboolean state)
+EXPORT gboolean connman_manager_set_offline_with_timeout(gboolean state, gint timeout_ms)
 {
 	struct connman_state *ns = connman_get_state();
 	GError *error = NULL;
 
+	if (!ns) {
+		ERROR("No connman connection");
+		return FALSE;
+	}
+
 	GVariant *var = g_variant_new_boolean(state);
 	if (!var) {
 		ERROR("Could not create new value variant");
 		return TRUE;
 	}
-	if(!connman_set_property_internal(ns,
-					  CONNMAN_AT_MANAGER,
-					  NULL,
-					  "OfflineMode",
-					  var,
-					  &error)) {
+	if(!set_property_or_queue(ns,
+				  CONNMAN_AT_MANAGER,
+				  NULL,
+				  "OfflineMode",
+				  var,
+				  connman_deadline_new(timeout_ms),
+				  &error)) {
 		ERROR("Setting offline mode to %s failed - %s",
-		      state ? "true" : "false", error->message);
+		      state ? "true" : "false",
+		      error ? error->message : "unspecified");
 		g_error_free(error);
 		return FALSE;
 	}
@@ -661,7 +1338,12 @@ EXPORT gboolean connman_manager_set_offline(gboolean state)
 	return TRUE;
 }
 
-EXPORT gboolean connman_get_technologies(GVariant **reply)
+EXPORT gboolean connman_manager_set_offline(gboolean state)
+{
+	return connman_manager_set_offline_with_timeout(state, -1);
+}
+
+EXPORT gboolean connman_get_technologies_with_timeout(GVariant **reply, gint timeout_ms)
 {
 	struct connman_state *ns = connman_get_state();
 	GVariant *properties = NULL;
@@ -674,7 +1356,9 @@ EXPORT gboolean connman_get_technologies(GVariant **reply)
         if (!reply) 
 		return FALSE;           
 
-	properties = connman_get_properties(ns, CONNMAN_AT_TECHNOLOGY, NULL, &error);
+	properties = connman_get_properties(ns, CONNMAN_AT_TECHNOLOGY, NULL,
+					    connman_deadline_new(timeout_ms),
+					    &error);
 	if (error) {
 		ERROR("technology properties error %s", error->message);
 		g_error_free(error);
@@ -686,7 +1370,12 @@ EXPORT gboolean connman_get_technologies(GVariant **reply)
 	return TRUE;
 }
 
-EXPORT gboolean connman_get_services(GVariant **reply)
+EXPORT gboolean connman_get_technologies(GVariant **reply)
+{
+	return connman_get_technologies_with_timeout(reply, -1);
+}
+
+EXPORT gboolean connman_get_services_with_timeout(GVariant **reply, gint timeout_ms)
 {
 	struct connman_state *ns = connman_get_state();
 	GVariant *properties = NULL;
@@ -699,7 +1388,9 @@ EXPORT gboolean connman_get_services(GVariant **reply)
         if (!reply) 
 		return FALSE;           
 
-	properties = connman_get_properties(ns, CONNMAN_AT_SERVICE, NULL, &error);
+	properties = connman_get_properties(ns, CONNMAN_AT_SERVICE, NULL,
+					    connman_deadline_new(timeout_ms),
+					    &error);
 	if (error) {
 		ERROR("service properties error %s", error->message);
 		g_error_free(error);
@@ -711,16 +1402,43 @@ EXPORT gboolean connman_get_services(GVariant **reply)
 	return TRUE;
 }
 
-// helper
-static gboolean connman_technology_set_powered(const gchar *technology, gboolean powered)
+EXPORT gboolean connman_get_services(GVariant **reply)
+{
+	return connman_get_services_with_timeout(reply, -1);
+}
+
+// helper, the read and the write share one deadline
+static gboolean connman_technology_set_powered(const gchar *technology,
+					       gboolean powered,
+					       gint timeout_ms)
 {
 	struct connman_state *ns = connman_get_state();
+	gint64 deadline = connman_deadline_new(timeout_ms);
 	GError *error = NULL;
 
+	if (!ns) {
+		ERROR("No connman connection");
+		return FALSE;
+	}
+
+	// Without ConnMan the current state is unknown, queue the write
+	if (!g_atomic_int_get(&ns->connman_present) && connman_queue_enabled()) {
+		if (!set_property_or_queue(ns, CONNMAN_AT_TECHNOLOGY, technology,
+					   "Powered", g_variant_new_boolean(powered),
+					   deadline, &error)) {
+			ERROR("Failed to queue Powered state - %s",
+			      error ? error->message : "unspecified");
+			g_clear_error(&error);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
 	GVariant *var = connman_get_property_internal(ns,
 						      CONNMAN_AT_TECHNOLOGY,
 						      technology,
 						      "Powered",
+						      deadline,
 						      &error);
 	if (!var) {
 		ERROR("Failed to get current Powered state - %s",
@@ -744,14 +1462,15 @@ static gboolean connman_technology_set_powered(const gchar *technology, gboolean
 		ERROR("Could not create new value variant");
 		return TRUE;
 	}
-	if(!connman_set_property_internal(ns,
-					  CONNMAN_AT_TECHNOLOGY,
-					  technology,
-					  "Powered",
-					  var,
-					  &error)) {
+	if(!set_property_or_queue(ns,
+				  CONNMAN_AT_TECHNOLOGY,
+				  technology,
+				  "Powered",
+				  var,
+				  deadline,
+				  &error)) {
 		ERROR("Failed to set Powered state - %s",
-		      error->message);
+		      error ? error->message : "unspecified");
 		g_error_free(error);
 		return FALSE;
 	}
@@ -762,17 +1481,30 @@ static gboolean connman_technology_set_powered(const gchar *technology, gboolean
 	return TRUE;
 }
 
+EXPORT gboolean connman_technology_enable_with_timeout(const gchar *technology,
+						       gint timeout_ms)
+{
+	return connman_technology_set_powered(technology, TRUE, timeout_ms);
+}
+
 EXPORT gboolean connman_technology_enable(const gchar *technology)
 {
-	return connman_technology_set_powered(technology, TRUE);
+	return connman_technology_set_powered(technology, TRUE, -1);
+}
+
+EXPORT gboolean connman_technology_disable_with_timeout(const gchar *technology,
+							gint timeout_ms)
+{
+	return connman_technology_set_powered(technology, FALSE, timeout_ms);
 }
 
 EXPORT gboolean connman_technology_disable(const gchar *technology)
 {
-	return connman_technology_set_powered(technology, FALSE);
+	return connman_technology_set_powered(technology, FALSE, -1);
 }
 
-EXPORT gboolean connman_technology_scan_services(const gchar *technology)
+EXPORT gboolean connman_technology_scan_services_with_timeout(const gchar *technology,
+							      gint timeout_ms)
 {
 	struct connman_state *ns = connman_get_state();
 	GVariant *reply = NULL;
@@ -784,7 +1516,8 @@ EXPORT gboolean connman_technology_scan_services(const gchar *technology)
 	}
 
 	reply = connman_call(ns, CONNMAN_AT_TECHNOLOGY, technology,
-			     "Scan", NULL, &error);
+			     "Scan", NULL, connman_deadline_new(timeout_ms),
+			     &error);
 	if (!reply) {
 		ERROR("technology %s method %s error %s",
 		      technology, "Scan", error->message);
@@ -796,9 +1529,42 @@ EXPORT gboolean connman_technology_scan_services(const gchar *technology)
 	return TRUE;
 }
 
-EXPORT gboolean connman_service_move(const gchar *service,
-				     const gchar *target_service,
-				     gboolean after)
+EXPORT gboolean connman_technology_scan_services(const gchar *technology)
+{
+	return connman_technology_scan_services_with_timeout(technology, -1);
+}
+
+EXPORT gboolean connman_technology_scan_async(const gchar *technology,
+					      connman_technology_scan_cb_t cb,
+					      gpointer user_data)
+{
+	struct connman_state *ns = connman_get_state();
+
+	if (!technology || !cb) {
+		ERROR("No technology or callback given");
+		return FALSE;
+	}
+
+	return connman_scan_request(ns, technology, cb, user_data);
+}
+
+EXPORT guint connman_scan_lease_acquire(const gchar *technology,
+					connman_scan_interest_t interest)
+{
+	struct connman_state *ns = connman_get_state();
+
+	if (!technology) {
+		ERROR("No technology given");
+		return 0;
+	}
+
+	return connman_scan_lease_acquire_internal(ns, technology, interest);
+}
+
+EXPORT gboolean connman_service_move_with_timeout(const gchar *service,
+						  const gchar *target_service,
+						  gboolean after,
+						  gint timeout_ms)
 {
 	struct connman_state *ns = connman_get_state();
 	GVariant *reply = NULL;
@@ -811,7 +1577,8 @@ EXPORT gboolean connman_service_move(const gchar *service,
 
 	reply = connman_call(ns, CONNMAN_AT_SERVICE, service,
 			     after ? "MoveAfter" : "MoveBefore",
-			     g_variant_new("o", CONNMAN_SERVICE_PATH(target_service)),
+			     g_variant_new("(o)", CONNMAN_SERVICE_PATH(target_service)),
+			     connman_deadline_new(timeout_ms),
 			     &error);
 	if (!reply) {
 		ERROR("%s error %s",
@@ -825,7 +1592,15 @@ EXPORT gboolean connman_service_move(const gchar *service,
 	return TRUE;
 }
 
-EXPORT gboolean connman_service_remove(const gchar *service)
+EXPORT gboolean connman_service_move(const gchar *service,
+				     const gchar *target_service,
+				     gboolean after)
+{
+	return connman_service_move_with_timeout(service, target_service, after, -1);
+}
+
+EXPORT gboolean connman_service_remove_with_timeout(const gchar *service,
+						    gint timeout_ms)
 {
 	struct connman_state *ns = connman_get_state();
 	GVariant *reply = NULL;
@@ -837,7 +1612,8 @@ EXPORT gboolean connman_service_remove(const gchar *service)
 	}
 
 	reply = connman_call(ns, CONNMAN_AT_SERVICE, service,
-			     "Remove", NULL, &error);
+			     "Remove", NULL, connman_deadline_new(timeout_ms),
+			     &error);
 	if (!reply) {
 		ERROR("Remove error %s",
 		      error ? error->message : "unspecified");
@@ -849,6 +1625,11 @@ EXPORT gboolean connman_service_remove(const gchar *service)
 	return TRUE;
 }
 
+EXPORT gboolean connman_service_remove(const gchar *service)
+{
+	return connman_service_remove_with_timeout(service, -1);
+}
+
 static void connect_service_callback(void *user_data,
 				     GVariant *result,
 				     GError **error)
@@ -857,7 +1638,13 @@ static void connect_service_callback(void *user_data,
 	struct connman_state *ns = cw->ns;
 	GError *sub_error = NULL;
 	gboolean status = TRUE;
+	gboolean retrying = FALSE;
 	gchar *error_string = NULL;
+	GVariant *err = NULL;
+
+	call_work_lock(ns);
+	cw->cpw = NULL;
+	call_work_unlock(ns);
 
 	connman_decode_call_error(ns,
 				  cw->access_type, cw->type_arg, cw->connman_method,
@@ -866,12 +1653,16 @@ static void connect_service_callback(void *user_data,
 		status = FALSE;
 
 		/* Read the Error property (if available to be specific) */
-		GVariant *err = connman_get_property_internal(ns,
+		err = connman_get_property_internal(ns,
 							      CONNMAN_AT_SERVICE,
 							      cw->type_arg,
 							      "Error",
+							      CONNMAN_DEADLINE_DEFAULT,
 							      &sub_error);
 		g_clear_error(&sub_error);
+		// A cleared Error reads back empty, it is not this failure's
+		if (err && !*g_variant_get_string(err, NULL))
+			g_clear_pointer(&err, g_variant_unref);
 		if (err) {
 			/* clear property error */
 			connman_call(ns,
@@ -879,23 +1670,53 @@ static void connect_service_callback(void *user_data,
 				     cw->type_arg,
 				     "ClearProperty",
 				     NULL,
+				     CONNMAN_DEADLINE_DEFAULT,
 				     &sub_error);
 			g_clear_error(&sub_error);
 
 			error_string = g_strdup(g_variant_get_string(err, NULL));
 			ERROR("Connect error: %s", error_string);
-			g_variant_unref(err);
 		} else {
 			error_string = g_strdup((*error)->message);
 			ERROR("Connect error: %s", error_string);
 		}
 	}
 
+	if (!status)
+		connman_timing_connect_failed(cw->type_arg, error_string);
+
+	if (!status && cw->retry) {
+		switch (connman_retry_classify(cw->retry, *error,
+					       err ? error_string : NULL)) {
+		case CONNMAN_RETRY_DONE:
+			status = TRUE;
+			g_clear_pointer(&error_string, g_free);
+			break;
+		case CONNMAN_RETRY_AGAIN:
+			// The timer owns the retry state from here on
+			if (connman_retry_schedule(cw->retry)) {
+				cw->retry = NULL;
+				retrying = TRUE;
+			}
+			break;
+		case CONNMAN_RETRY_CANCELLED:
+			g_free(error_string);
+			error_string = g_strdup(CONNMAN_RETRY_CANCELLED_MESSAGE);
+			break;
+		default:
+			break;
+		}
+	}
+	if (err)
+		g_variant_unref(err);
+
 	if (result)
 		g_variant_unref(result);
 
         // Run callback
-	if (cw->request_cb) {
+	if (retrying) {
+		g_free(error_string);
+	} else if (cw->request_cb) {
 		connman_service_connect_cb_t cb = (connman_service_connect_cb_t) cw->request_cb;
 		gchar *service = g_strdup(cw->type_arg);
 		(*cb)(service, status, error_string, cw->request_user_data);
@@ -903,42 +1724,106 @@ static void connect_service_callback(void *user_data,
 			g_free(error_string);
 	}
 
-	DEBUG("Service %s %s", cw->type_arg, status ? "connected" : "error");
+	DEBUG("Service %s %s", cw->type_arg,
+	      retrying ? "retrying" : status ? "connected" : "error");
 
+	connman_retry_free(cw->retry);
 	call_work_destroy(cw);
 }
 
-EXPORT gboolean connman_service_connect(const gchar *service,
-					connman_service_connect_cb_t cb,
-					gpointer user_data)
+gboolean connman_service_connect_internal(struct connman_state *ns,
+					  const gchar *service,
+					  connman_service_connect_cb_t cb,
+					  gpointer user_data,
+					  struct connman_retry *retry,
+					  gint64 deadline,
+					  GError **error)
+{
+	struct connman_pending_work *cpw;
+	struct call_work *cw;
+
+	cw = call_work_create(ns, "service", service,
+			      "connect_service", "Connect", error);
+	if (!cw) {
+		ERROR("can't queue work %s", (*error)->message);
+		return FALSE;
+	}
+
+	// Set callback hook
+	cw->request_cb = cb;
+	cw->request_user_data = user_data;
+
+	connman_timing_connect_start(service);
+
+	// The lock keeps the reply from completing cw before cpw is stored
+	call_work_lock(ns);
+	cw->retry = retry;
+	cpw = connman_call_async(ns, "service", service,
+				 "Connect", NULL, deadline, error,
+				 connect_service_callback, cw);
+	cw->cpw = cpw;
+	call_work_unlock(ns);
+	if (!cpw) {
+		ERROR("connection error %s", (*error)->message);
+		connman_timing_connect_failed(service, (*error)->message);
+		call_work_destroy(cw);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+EXPORT gboolean connman_service_connect_with_timeout(const gchar *service,
+						     connman_service_connect_cb_t cb,
+						     gpointer user_data,
+						     gint timeout_ms)
 {
 	struct connman_state *ns = connman_get_state();
 	GError *error = NULL;
-	struct call_work *cw;
 
 	if (!service) {
 		ERROR("No service given");
 		return FALSE;
 	}
 
-	cw = call_work_create(ns, "service", service,
-			      "connect_service", "Connect", &error);
-	if (!cw) {
-		ERROR("can't queue work %s", error->message);
+	if (!connman_service_connect_internal(ns, service, cb, user_data, NULL,
+					      connman_deadline_new(timeout_ms), &error)) {
 		g_error_free(error);
 		return FALSE;
 	}
 
-	// Set callback hook
-	cw->request_cb = cb;
-	cw->request_user_data = user_data;
+	return TRUE;
+}
 
-	cw->cpw = connman_call_async(ns, "service", service,
-				     "Connect", NULL, &error,
-				     connect_service_callback, cw);
-	if (!cw->cpw) {
-		ERROR("connection error %s", error->message);
-		call_work_destroy(cw);
+EXPORT gboolean connman_service_connect(const gchar *service,
+					connman_service_connect_cb_t cb,
+					gpointer user_data)
+{
+	return connman_service_connect_with_timeout(service, cb, user_data, -1);
+}
+
+EXPORT gboolean connman_service_connect_with_retry(const gchar *service,
+						   const connman_retry_policy_t *policy,
+						   connman_service_connect_cb_t cb,
+						   gpointer user_data)
+{
+	struct connman_state *ns = connman_get_state();
+	struct connman_retry *retry;
+	GError *error = NULL;
+
+	if (!service || !policy) {
+		ERROR("No service or retry policy given");
+		return FALSE;
+	}
+
+	retry = connman_retry_new(ns, service, policy, cb, user_data);
+	if (!retry) {
+		ERROR("Connect retries to %s already in progress", service);
+		return FALSE;
+	}
+	if (!connman_service_connect_internal(ns, service, cb, user_data, retry,
+					      CONNMAN_DEADLINE_DEFAULT, &error)) {
+		connman_retry_free(retry);
 		g_error_free(error);
 		return FALSE;
 	}
@@ -946,7 +1831,20 @@ EXPORT gboolean connman_service_connect(const gchar *service,
 	return TRUE;
 }
 
-EXPORT gboolean connman_service_disconnect(const gchar *service)
+EXPORT gboolean connman_policy_enable(const connman_policy_t *policy)
+{
+	struct connman_state *ns = connman_get_state();
+
+	if (!ns || !policy) {
+		ERROR("Not initialized or no policy given");
+		return FALSE;
+	}
+
+	return connman_policy_enable_internal(ns, policy);
+}
+
+EXPORT gboolean connman_service_disconnect_with_timeout(const gchar *service,
+							gint timeout_ms)
 {
 	struct connman_state *ns = connman_get_state();
 	GVariant *reply = NULL;
@@ -957,8 +1855,12 @@ EXPORT gboolean connman_service_disconnect(const gchar *service)
 		return FALSE;
 	}
 
+	// Before the call, so that the aborted connect is not retried
+	connman_retry_cancel(service);
+
 	reply = connman_call(ns, CONNMAN_AT_SERVICE, service,
-			     "Disconnect", NULL, &error);
+			     "Disconnect", NULL, connman_deadline_new(timeout_ms),
+			     &error);
 	if (!reply) {
 		ERROR("Disconnect error %s",
 		      error ? error->message : "unspecified");
@@ -971,9 +1873,15 @@ EXPORT gboolean connman_service_disconnect(const gchar *service)
 	return TRUE;
 }
 
-EXPORT GVariant *connman_get_property(connman_property_type_t prop_type,
-				      const char *path,
-				      const char *name)
+EXPORT gboolean connman_service_disconnect(const gchar *service)
+{
+	return connman_service_disconnect_with_timeout(service, -1);
+}
+
+EXPORT GVariant *connman_get_property_with_timeout(connman_property_type_t prop_type,
+						   const char *path,
+						   const char *name,
+						   gint timeout_ms)
 {
 	struct connman_state *ns = connman_get_state();
 	const char *access_type;
@@ -1004,6 +1912,7 @@ EXPORT GVariant *connman_get_property(connman_property_type_t prop_type,
 						      access_type,
 						      type_arg,
 						      name,
+						      connman_deadline_new(timeout_ms),
 						      &error);
 	if (!val) {
 		ERROR("%s property error %s",
@@ -1013,10 +1922,18 @@ EXPORT GVariant *connman_get_property(connman_property_type_t prop_type,
 	return val;
 }
 
-EXPORT gboolean connman_set_property(connman_property_type_t prop_type,
-				     const char *path,
-				     const char *name,
-				     GVariant *value)
+EXPORT GVariant *connman_get_property(connman_property_type_t prop_type,
+				      const char *path,
+				      const char *name)
+{
+	return connman_get_property_with_timeout(prop_type, path, name, -1);
+}
+
+EXPORT gboolean connman_set_property_with_timeout(connman_property_type_t prop_type,
+						  const char *path,
+						  const char *name,
+						  GVariant *value,
+						  gint timeout_ms)
 {
 	struct connman_state *ns = connman_get_state();
 	const char *access_type;
@@ -1044,14 +1961,21 @@ EXPORT gboolean connman_set_property(connman_property_type_t prop_type,
 		break;
 	}
 
-	ret = connman_set_property_internal(ns,
-					    access_type,
-					    type_arg,
-					    name,
-					    value,
-					    &error);
+	if (!ns) {
+		ERROR("No connman connection");
+		return FALSE;
+	}
+
+	ret = set_property_or_queue(ns,
+				    access_type,
+				    type_arg,
+				    name,
+				    value,
+				    connman_deadline_new(timeout_ms),
+				    &error);
 	if (!ret) {
-		ERROR("Set property %s failed - %s", name, error->message);
+		ERROR("Set property %s failed - %s",
+		      name, error ? error->message : "unspecified");
 		g_error_free(error);
 		return FALSE;
 	}
@@ -1059,11 +1983,67 @@ EXPORT gboolean connman_set_property(connman_property_type_t prop_type,
 	return TRUE;
 }
 
+EXPORT gboolean connman_set_property(connman_property_type_t prop_type,
+				     const char *path,
+				     const char *name,
+				     GVariant *value)
+{
+	return connman_set_property_with_timeout(prop_type, path, name, value, -1);
+}
+
+EXPORT gboolean connman_wait_for(connman_property_type_t type,
+				 const gchar *object,
+				 const gchar *property,
+				 GVariant *value,
+				 gint timeout_ms)
+{
+	struct connman_state *ns = connman_get_state();
+
+	if (!property || !value) {
+		ERROR("No property or value given");
+		return FALSE;
+	}
+	if (!ns || !ns->cache) {
+		ERROR("Not initialized");
+		g_variant_unref(g_variant_ref_sink(value));
+		return FALSE;
+	}
+
+	return connman_wait_block(ns->cache, type, object, property, value,
+				  timeout_ms);
+}
+
+EXPORT guint connman_wait_for_async(connman_property_type_t type,
+				    const gchar *object,
+				    const gchar *property,
+				    GVariant *value,
+				    gint timeout_ms,
+				    connman_wait_cb_t cb,
+				    gpointer user_data)
+{
+	struct connman_state *ns = connman_get_state();
+
+	if (!property || !value || !cb) {
+		ERROR("No property, value or callback given");
+		return 0;
+	}
+	if (!ns || !ns->cache) {
+		ERROR("Not initialized");
+		g_variant_unref(g_variant_ref_sink(value));
+		return 0;
+	}
+
+	return connman_wait_add(ns->cache, type, object, property, value,
+				timeout_ms, cb, user_data);
+}
+
 EXPORT gboolean connman_agent_response(const int id, GVariant *parameters)
 {
 	struct connman_state *ns = connman_get_state();
 	struct call_work *cw;
 
+	CONNMAN_PROBE(agent__response, id);
+
 	call_work_lock(ns);
 	cw = call_work_lookup_by_id_unlocked(ns, id);
 	if (!cw || !cw->invocation) {
@@ -1072,18 +2052,41 @@ EXPORT gboolean connman_agent_response(const int id, GVariant *parameters)
 		return FALSE;
 	}
 
-	if (g_strcmp0(cw->agent_method, "RequestInput") != 0) {
+	if (!g_strcmp0(cw->agent_method, "RequestBrowser")) {
+		// RequestBrowser has no output arguments
+		if (parameters)
+			g_variant_unref(g_variant_ref_sink(parameters));
+		parameters = NULL;
+	} else if (g_strcmp0(cw->agent_method, "RequestInput") != 0) {
 		ERROR("Unhandled agent method %s", cw->agent_method);
 		g_dbus_method_invocation_return_dbus_error(cw->invocation,
 							   "org.freedesktop.DBus.Error.UnknownMethod",
 							   "Unknown method");
-		cw->invocation = NULL;
+		call_work_agent_done_unlocked(cw, NULL);
 		call_work_unlock(ns);
 		return FALSE;
 	}
 
+	if (!g_strcmp0(cw->agent_method, "RequestInput"))
+		connman_timing_agent(cw->type_arg, TRUE);
+
+	if (parameters) {
+		g_variant_ref_sink(parameters);
+		if (connman_credentials_enabled() &&
+		    g_variant_is_of_type(parameters, G_VARIANT_TYPE("(a{sv})"))) {
+			GVariant *values = g_variant_get_child_value(parameters, 0);
+
+			connman_credentials_store(cw->type_arg, values);
+			g_variant_unref(values);
+		}
+	}
+
 	g_dbus_method_invocation_return_value(cw->invocation, parameters);
-	cw->invocation = NULL;
+	if (parameters)
+		g_variant_unref(parameters);
+	call_work_agent_done_unlocked(cw, NULL);
+	if (!g_strcmp0(cw->method, CONNMAN_AGENT_CALL_WORK))
+		call_work_destroy_unlocked(cw);
 
 	call_work_unlock(ns);
 
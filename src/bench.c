@@ -0,0 +1,363 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmarks the library against mock-connmand and prints the results as
+ * JSON: call latency percentiles, signal to callback throughput and
+ * latency at increasing rates, connect round trips including the agent
+ * RequestInput, and memory use as the number of services grows.
+ *
+ * Usage: connman-glib-bench [--output FILE] /path/to/mock-connmand
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "mock-client.h"
+
+#define BENCH_CALLS		1000
+#define BENCH_SCALE_CALLS	50
+#define BENCH_CONNECTS		20
+#define BENCH_SERVICE		"wifi_mock_0000_managed_psk"
+
+static const guint bench_rates[] = { 100, 1000, 10000, 0 /* unpaced */ };
+static const guint bench_scales[] = { 10, 100, 1000, 5000 };
+
+static struct {
+	GMutex mutex;
+	GCond cond;
+
+	// signal phase
+	GArray *latencies;	/* gint64, mock send to callback */
+	GArray *queue_delays;	/* gint64, receive to callback */
+	guint received;
+	gint64 first_receive;
+	gint64 last_receive;
+
+	// connect phase
+	gboolean connect_done;
+	gboolean connect_status;
+} bench;
+
+static void append_memory(GString *out)
+{
+	gchar *status = NULL;
+	gchar **lines;
+	guint i;
+
+	if (g_file_get_contents("/proc/self/status", &status, NULL, NULL)) {
+		lines = g_strsplit(status, "\n", -1);
+		for (i = 0; lines[i]; i++) {
+			if (g_str_has_prefix(lines[i], "VmRSS:"))
+				g_string_append_printf(out, ", \"rss_kb\": %lu",
+						       strtoul(lines[i] + 6, NULL, 10));
+			else if (g_str_has_prefix(lines[i], "VmHWM:"))
+				g_string_append_printf(out, ", \"peak_rss_kb\": %lu",
+						       strtoul(lines[i] + 6, NULL, 10));
+		}
+		g_strfreev(lines);
+		g_free(status);
+	}
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	{
+		struct mallinfo2 mi = mallinfo2();
+
+		// mallinfo has no count of live allocations, only of free chunks
+		g_string_append_printf(out, ", \"heap_in_use_bytes\": %zu"
+				       ", \"heap_free_chunks\": %zu"
+				       ", \"heap_mmapped_chunks\": %zu",
+				       mi.uordblks, mi.ordblks, mi.hblks);
+	}
+#endif
+}
+
+static void service_property_cb(const gchar *service,
+				GVariant *property,
+				const connman_event_info_t *info,
+				gpointer user_data)
+{
+	const gchar *name = NULL;
+	GVariant *value = NULL;
+	gint64 now = g_get_monotonic_time();
+
+	g_variant_get(property, "(&sv)", &name, &value);
+	if (!g_strcmp0(name, "MockTimestamp") &&
+	    g_variant_is_of_type(value, G_VARIANT_TYPE_INT64)) {
+		gint64 sent = g_variant_get_int64(value);
+		gint64 latency = now - sent;
+		gint64 delay = info->dispatch_time - info->receive_time;
+
+		g_mutex_lock(&bench.mutex);
+		g_array_append_val(bench.latencies, latency);
+		g_array_append_val(bench.queue_delays, delay);
+		if (!bench.received++)
+			bench.first_receive = now;
+		bench.last_receive = now;
+		g_cond_signal(&bench.cond);
+		g_mutex_unlock(&bench.mutex);
+	}
+	g_variant_unref(value);
+}
+
+static void agent_cb(const gchar *service,
+		     const int id,
+		     GVariant *properties,
+		     gpointer user_data)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&builder, "{sv}", "Passphrase",
+			      g_variant_new_string("mock-passphrase"));
+	connman_agent_response(id, g_variant_new("(@a{sv})",
+						 g_variant_builder_end(&builder)));
+}
+
+static void connect_cb(const gchar *service,
+		       gboolean status,
+		       const char *error,
+		       gpointer user_data)
+{
+	g_mutex_lock(&bench.mutex);
+	bench.connect_done = TRUE;
+	bench.connect_status = status;
+	g_cond_signal(&bench.cond);
+	g_mutex_unlock(&bench.mutex);
+}
+
+static void bench_get_property(GString *out)
+{
+	GArray *samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+	guint i;
+
+	for (i = 0; i < BENCH_CALLS; i++) {
+		gint64 start = g_get_monotonic_time();
+		GVariant *value = connman_get_property(CONNMAN_PROPERTY_MANAGER,
+						       NULL, "State");
+		gint64 elapsed = g_get_monotonic_time() - start;
+
+		if (value) {
+			g_variant_unref(value);
+			g_array_append_val(samples, elapsed);
+		}
+	}
+
+	g_string_append(out, "  \"get_property\": { ");
+	mock_client_percentiles(out, samples);
+	g_string_append(out, " },\n");
+	g_array_unref(samples);
+}
+
+static void bench_signals(GString *out)
+{
+	guint i;
+
+	g_string_append(out, "  \"signals\": [\n");
+	for (i = 0; i < G_N_ELEMENTS(bench_rates); i++) {
+		guint rate = bench_rates[i];
+		guint count = rate ? rate * 2 : 20000;
+		gint64 end_time;
+		gint64 span;
+
+		g_mutex_lock(&bench.mutex);
+		g_array_set_size(bench.latencies, 0);
+		g_array_set_size(bench.queue_delays, 0);
+		bench.received = 0;
+		g_mutex_unlock(&bench.mutex);
+
+		mock_client_command("storm %u %u", count, rate);
+
+		end_time = g_get_monotonic_time() +
+			((rate ? count / rate : 0) + 10) * G_TIME_SPAN_SECOND;
+		g_mutex_lock(&bench.mutex);
+		while (bench.received < count) {
+			if (!g_cond_wait_until(&bench.cond, &bench.mutex, end_time))
+				break;
+		}
+		span = bench.last_receive - bench.first_receive;
+
+		g_string_append_printf(out,
+				       "    { \"rate\": %u, \"sent\": %u, \"received\": %u"
+				       ", \"events_per_s\": %.1f, \"latency\": { ",
+				       rate, count, bench.received,
+				       span > 0 ? (bench.received - 1) * 1e6 / span : 0.0);
+		mock_client_percentiles(out, bench.latencies);
+		g_string_append(out, " }, \"queue_delay\": { ");
+		mock_client_percentiles(out, bench.queue_delays);
+		g_string_append_printf(out, " } }%s\n",
+				       i + 1 < G_N_ELEMENTS(bench_rates) ? "," : "");
+		g_mutex_unlock(&bench.mutex);
+	}
+	g_string_append(out, "  ],\n");
+}
+
+static void bench_connect(GString *out)
+{
+	GArray *samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+	guint i, failed = 0;
+
+	for (i = 0; i < BENCH_CONNECTS; i++) {
+		gint64 start = g_get_monotonic_time();
+		gint64 end_time = start + 30 * G_TIME_SPAN_SECOND;
+		gint64 elapsed;
+
+		g_mutex_lock(&bench.mutex);
+		bench.connect_done = FALSE;
+		g_mutex_unlock(&bench.mutex);
+
+		if (!connman_service_connect(BENCH_SERVICE, connect_cb, NULL)) {
+			failed++;
+			continue;
+		}
+
+		g_mutex_lock(&bench.mutex);
+		while (!bench.connect_done) {
+			if (!g_cond_wait_until(&bench.cond, &bench.mutex, end_time))
+				break;
+		}
+		elapsed = g_get_monotonic_time() - start;
+		if (bench.connect_done && bench.connect_status)
+			g_array_append_val(samples, elapsed);
+		else
+			failed++;
+		g_mutex_unlock(&bench.mutex);
+
+		connman_service_disconnect(BENCH_SERVICE);
+	}
+
+	g_string_append(out, "  \"connect\": { ");
+	mock_client_percentiles(out, samples);
+	g_string_append_printf(out, ", \"failed\": %u },\n", failed);
+	g_array_unref(samples);
+}
+
+static guint service_count(void)
+{
+	GVariant *reply = NULL;
+	guint n = 0;
+
+	if (connman_get_services(&reply) && reply) {
+		GVariant *services = g_variant_get_child_value(reply, 0);
+
+		n = g_variant_n_children(services);
+		g_variant_unref(services);
+		g_variant_unref(reply);
+	}
+
+	return n;
+}
+
+static void bench_scaling(GString *out)
+{
+	guint present = service_count();
+	guint i, j;
+
+	g_string_append(out, "  \"scaling\": [\n");
+	for (i = 0; i < G_N_ELEMENTS(bench_scales); i++) {
+		guint scale = bench_scales[i];
+		GArray *samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+		gint64 end_time = g_get_monotonic_time() + 60 * G_TIME_SPAN_SECOND;
+
+		for (j = present; j < scale; j++)
+			mock_client_command("add-service wifi_mock_%04u_managed_psk", j);
+		while ((present = service_count()) < scale &&
+		       g_get_monotonic_time() < end_time)
+			g_usleep(50 * 1000);
+
+		for (j = 0; j < BENCH_SCALE_CALLS; j++) {
+			gint64 start = g_get_monotonic_time();
+			GVariant *reply = NULL;
+			gint64 elapsed;
+
+			if (!connman_get_services(&reply))
+				continue;
+			elapsed = g_get_monotonic_time() - start;
+			g_array_append_val(samples, elapsed);
+			g_variant_unref(reply);
+		}
+
+		g_string_append_printf(out, "    { \"services\": %u, \"get_services\": { ",
+				       present);
+		mock_client_percentiles(out, samples);
+		g_string_append(out, " }");
+		append_memory(out);
+		g_string_append_printf(out, " }%s\n",
+				       i + 1 < G_N_ELEMENTS(bench_scales) ? "," : "");
+		g_array_unref(samples);
+	}
+	g_string_append(out, "  ]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	gchar *output = NULL;
+	GOptionEntry entries[] = {
+		{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+		  "Write the JSON results to FILE", "FILE" },
+		{ NULL }
+	};
+	GOptionContext *context;
+	GError *error = NULL;
+	GString *out;
+
+	context = g_option_context_new("MOCK_CONNMAND - benchmark connman-glib");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error) || argc != 2) {
+		g_printerr("%s\n", error ? error->message : "missing mock-connmand path");
+		return 1;
+	}
+	g_option_context_free(context);
+
+	g_mutex_init(&bench.mutex);
+	g_cond_init(&bench.cond);
+	bench.latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+	bench.queue_delays = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+	if (!mock_client_start(argv[1], 10))
+		return 1;
+
+	connman_add_service_property_event_callback_full(service_property_cb, NULL);
+	connman_add_agent_event_callback(agent_cb, NULL);
+	if (!connman_init(TRUE)) {
+		g_printerr("connman_init failed\n");
+		return 1;
+	}
+
+	out = g_string_new("{\n");
+	bench_get_property(out);
+	bench_signals(out);
+	bench_connect(out);
+	bench_scaling(out);
+	g_string_append(out, "}\n");
+
+	mock_client_stop();
+
+	if (output) {
+		if (!g_file_set_contents(output, out->str, out->len, &error)) {
+			g_printerr("%s\n", error->message);
+			return 1;
+		}
+	} else {
+		fputs(out->str, stdout);
+	}
+	g_string_free(out, TRUE);
+
+	return 0;
+}
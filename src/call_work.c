@@ -167,6 +167,44 @@ struct call_work *call_work_create(struct connman_state *ns,
 	return cw;
 }
 
+/*
+ * Fail everything that is waiting on ConnMan, used when it drops off the
+ * bus so callers do not wait for the D-Bus reply timeout.
+ */
+void call_work_cancel_all(struct connman_state *ns)
+{
+	struct call_work *cw;
+	GSList *list;
+
+	g_mutex_lock(&ns->cw_mutex);
+	for (list = ns->cw_pending; list; list = g_slist_next(list)) {
+		cw = list->data;
+		call_work_agent_done_unlocked(cw, "ConnMan went away");
+		if (cw->cpw)
+			connman_cancel_call(ns, cw->cpw);
+	}
+	g_mutex_unlock(&ns->cw_mutex);
+}
+
+/*
+ * Drop the agent request held by the call work and its response timeout.
+ * If it has not been answered, it is answered with Canceled and message.
+ */
+void call_work_agent_done_unlocked(struct call_work *cw, const char *message)
+{
+	if (cw->agent_timeout) {
+		g_source_destroy(cw->agent_timeout);
+		g_source_unref(cw->agent_timeout);
+		cw->agent_timeout = NULL;
+	}
+	if (cw->invocation && message)
+		g_dbus_method_invocation_return_dbus_error(cw->invocation,
+							   "net.connman.Agent.Error.Canceled",
+							   message);
+	cw->invocation = NULL;
+	cw->agent_method = NULL;
+}
+
 void call_work_destroy_unlocked(struct call_work *cw)
 {
 	struct connman_state *ns = cw->ns;
@@ -181,11 +219,13 @@ void call_work_destroy_unlocked(struct call_work *cw)
 
 	/* remove it */
 	ns->cw_pending = g_slist_remove(ns->cw_pending, cw);
+	call_work_agent_done_unlocked(cw, "Request finished");
 
 	g_free(cw->access_type);
 	g_free(cw->type_arg);
 	g_free(cw->method);
 	g_free(cw->connman_method);
+	g_free(cw);
 }
 
 void call_work_destroy(struct call_work *cw)
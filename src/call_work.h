@@ -20,6 +20,8 @@
 
 #include <glib.h>
 
+struct connman_retry;
+
 struct call_work {
 	struct connman_state *ns;
 	int id;
@@ -30,8 +32,10 @@ struct call_work {
 	struct connman_pending_work *cpw;
 	gpointer request_cb;
 	gpointer request_user_data;
-	gchar *agent_method;
+	const gchar *agent_method;
 	GDBusMethodInvocation *invocation;
+	GSource *agent_timeout;
+	struct connman_retry *retry;
 };
 
 void call_work_lock(struct connman_state *ns);
@@ -73,6 +77,10 @@ struct call_work *call_work_create(struct connman_state *ns,
 				   const char *connman_method,
 				   GError **error);
 
+void call_work_cancel_all(struct connman_state *ns);
+
+void call_work_agent_done_unlocked(struct call_work *cw, const char *message);
+
 void call_work_destroy_unlocked(struct call_work *cw);
 
 void call_work_destroy(struct call_work *cw);
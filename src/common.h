@@ -29,6 +29,7 @@
 #define EXPORT  __attribute__ ((visibility("default")))
 
 struct call_work;
+struct connman_cache;
 
 struct connman_state {
 	GMainLoop *loop;
@@ -37,6 +38,18 @@ struct connman_state {
 	guint technology_sub;
 	guint service_sub;
 
+	/* net.connman name ownership and local state tracking */
+	guint name_watch;
+	gint connman_present;	/* atomic */
+	gboolean connman_synced;
+	struct connman_cache *cache;
+
+	/* notes receive times of ConnMan signals */
+	guint filter_id;
+
+	/* last connman_event_info_t sequence, only used from the handler thread */
+	guint64 event_sequence;
+
 	/* NOTE: single connection allowed for now */
 	/* NOTE: needs locking and a list */
 	GMutex cw_mutex;
@@ -45,8 +58,6 @@ struct connman_state {
 	struct call_work *cw;
 
 	/* agent */
-	GDBusNodeInfo *introspection_data;
-	guint agent_id;
 	guint registration_id;
 	gchar *agent_path;
 	gboolean agent_registered;
@@ -65,16 +76,49 @@ struct init_data {
 extern void connman_log(connman_log_level_t level, const char *func, const char *format, ...)
 	__attribute__ ((format (printf, 3, 4)));
 
+extern connman_log_level_t connman_log_level;
+
+// Most verbose level built in, set with the max-log-level build option
+#ifndef CONNMAN_LOG_LEVEL_MAX
+#define CONNMAN_LOG_LEVEL_MAX CONNMAN_LOG_LEVEL_DEBUG
+#endif
+
+#define CONNMAN_LOG_ENABLED(level) \
+	((level) <= CONNMAN_LOG_LEVEL_MAX && (level) <= connman_log_level)
+
+// Arguments are only evaluated if the message will be logged
+#define CONNMAN_LOG(level, format, ...) \
+	do { \
+		if (CONNMAN_LOG_ENABLED(level)) \
+			connman_log(level, __FUNCTION__, format, ##__VA_ARGS__); \
+	} while (0)
+
 #define ERROR(format, ...) \
-	connman_log(CONNMAN_LOG_LEVEL_ERROR, __FUNCTION__, format, ##__VA_ARGS__)
+	CONNMAN_LOG(CONNMAN_LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
 
 #define WARNING(format, ...) \
-	connman_log(CONNMAN_LOG_LEVEL_WARNING, __FUNCTION__, format, ##__VA_ARGS__)
+	CONNMAN_LOG(CONNMAN_LOG_LEVEL_WARNING, format, ##__VA_ARGS__)
 
 #define INFO(format, ...) \
-	connman_log(CONNMAN_LOG_LEVEL_INFO, __FUNCTION__, format, ##__VA_ARGS__)
+	CONNMAN_LOG(CONNMAN_LOG_LEVEL_INFO, format, ##__VA_ARGS__)
 
 #define DEBUG(format, ...) \
-	connman_log(CONNMAN_LOG_LEVEL_DEBUG, __FUNCTION__, format, ##__VA_ARGS__)
+	CONNMAN_LOG(CONNMAN_LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+
+// Longest GVariant text logged, longer values are elided
+#define CONNMAN_LOG_VARIANT_MAX		400
+
+extern gchar *connman_variant_print(GVariant *value, gsize max);
+
+// Only formats the value if the message will be logged
+#define DEBUG_VARIANT(prefix, value) \
+	do { \
+		if (CONNMAN_LOG_ENABLED(CONNMAN_LOG_LEVEL_DEBUG)) { \
+			gchar *__text = connman_variant_print(value, CONNMAN_LOG_VARIANT_MAX); \
+			connman_log(CONNMAN_LOG_LEVEL_DEBUG, __FUNCTION__, \
+				    "%s%s", prefix, __text); \
+			g_free(__text); \
+		} \
+	} while (0)
 
 #endif // CONNMAN_COMMON_H
@@ -15,6 +15,8 @@
  * limitations under the License.
  */
 
+#include <unistd.h>
+
 #include <glib.h>
 #include <gio/gio.h>
 
@@ -22,47 +24,207 @@
 #include "common.h"
 #include "connman-call.h"
 #include "call_work.h"
+#include "connman-agent-info.h"
+#include "connman-credentials.h"
+#include "connman-timing.h"
+#include "connman-watchdog.h"
+#include "connman-agent.h"
+#include "probes.h"
+
+// Default for connman_set_agent_timeout, below ConnMan's own 120 s
+#define AGENT_TIMEOUT_DEFAULT_MS	60000
+
+struct agent_subscriber {
+	gpointer callback;
+	gpointer user_data;
+	gboolean method;	/* a connman_agent_method_cb_t */
+};
+
+/*
+ * Subscribers, replaced rather than modified when one is added so that
+ * dispatch can work from a reference without holding the lock while
+ * user code runs.
+ */
+static GArray *agent_subscribers;
+static GMutex agent_subscribers_mutex;
+
+static guint agent_timeout_ms = AGENT_TIMEOUT_DEFAULT_MS;	/* atomic */
+
+static const gchar *const agent_method_names[] = {
+	[CONNMAN_AGENT_REQUEST_INPUT] = "RequestInput",
+	[CONNMAN_AGENT_REQUEST_BROWSER] = "RequestBrowser",
+	[CONNMAN_AGENT_REPORT_ERROR] = "ReportError",
+	[CONNMAN_AGENT_REPORT_PEER_ERROR] = "ReportPeerError",
+	[CONNMAN_AGENT_CANCEL] = "Cancel",
+	[CONNMAN_AGENT_RELEASE] = "Release",
+};
+
+static void agent_subscriber_add(gpointer callback, gpointer user_data, gboolean method)
+{
+	struct agent_subscriber sub = {
+		.callback = callback,
+		.user_data = user_data,
+		.method = method,
+	};
+	GArray *subscribers;
+
+	if (!callback)
+		return;
 
-static connman_agent_event_cb_t agent_event_cb = NULL;
-static gpointer agent_event_cb_data = NULL;
-static GMutex agent_event_cb_mutex;
+	g_mutex_lock(&agent_subscribers_mutex);
+	subscribers = g_array_new(FALSE, FALSE, sizeof(struct agent_subscriber));
+	if (agent_subscribers) {
+		g_array_append_vals(subscribers, agent_subscribers->data,
+				    agent_subscribers->len);
+		g_array_unref(agent_subscribers);
+	}
+	g_array_append_val(subscribers, sub);
+	agent_subscribers = subscribers;
+	g_mutex_unlock(&agent_subscribers_mutex);
+}
 
 EXPORT void connman_add_agent_event_callback(connman_agent_event_cb_t cb, gpointer user_data)
 {
-	g_mutex_lock(&agent_event_cb_mutex);
-	if (agent_event_cb == NULL) {
-		agent_event_cb = cb;
-		agent_event_cb_data = user_data;
-	} else {
-		ERROR("Agent event callback already set");
-	}
-	g_mutex_unlock(&agent_event_cb_mutex);
+	agent_subscriber_add(cb, user_data, FALSE);
+}
+
+EXPORT void connman_add_agent_method_callback(connman_agent_method_cb_t cb, gpointer user_data)
+{
+	agent_subscriber_add(cb, user_data, TRUE);
+}
+
+EXPORT void connman_set_agent_timeout(guint timeout_ms)
+{
+	g_atomic_int_set(&agent_timeout_ms, timeout_ms);
+}
+
+static void run_callback(connman_agent_method_t method,
+			 const gchar *object,
+			 const int id,
+			 GVariant *parameters)
+{
+	GArray *subscribers = NULL;
+	guint i;
+
+	g_mutex_lock(&agent_subscribers_mutex);
+	if (agent_subscribers)
+		subscribers = g_array_ref(agent_subscribers);
+	g_mutex_unlock(&agent_subscribers_mutex);
+	if (!subscribers)
+		return;
+
+	for (i = 0; i < subscribers->len; i++) {
+		struct agent_subscriber *sub =
+			&g_array_index(subscribers, struct agent_subscriber, i);
+		gint64 start;
+
+		if (sub->method) {
+			connman_agent_method_cb_t cb = sub->callback;
+
+			start = connman_callback_start("agent", agent_method_names[method], cb);
+			(*cb)(method, object, id, parameters, sub->user_data);
+			connman_callback_done("agent", agent_method_names[method], cb, start);
+		} else if (method == CONNMAN_AGENT_REQUEST_INPUT) {
+			connman_agent_event_cb_t cb = sub->callback;
+
+			start = connman_callback_start("agent", "request_input", cb);
+			(*cb)(object, id, parameters, sub->user_data);
+			connman_callback_done("agent", "request_input", cb, start);
+		}
+	}
+
+	g_array_unref(subscribers);
 }
 
-static void run_callback(const gchar *service, const int id, GVariant *properties)
+struct agent_timeout {
+	struct connman_state *ns;
+	int id;
+};
+
+static gboolean agent_timeout_cb(gpointer user_data)
 {
-	g_mutex_lock(&agent_event_cb_mutex);
-	if (agent_event_cb) {
-		(*agent_event_cb)(service, id, properties, agent_event_cb_data);
+	struct agent_timeout *at = user_data;
+	struct connman_state *ns = at->ns;
+	struct call_work *cw;
+	gchar *service;
+
+	call_work_lock(ns);
+	cw = call_work_lookup_by_id_unlocked(ns, at->id);
+	if (!cw || !cw->invocation) {
+		call_work_unlock(ns);
+		return G_SOURCE_REMOVE;
 	}
-	g_mutex_unlock(&agent_event_cb_mutex);
+
+	WARNING("No response to %s for %s within %u ms",
+		cw->agent_method, cw->type_arg, g_atomic_int_get(&agent_timeout_ms));
+	service = g_strdup(cw->type_arg);
+	call_work_agent_done_unlocked(cw, "No response from the agent");
+	if (!g_strcmp0(cw->method, CONNMAN_AGENT_CALL_WORK))
+		call_work_destroy_unlocked(cw);
+	call_work_unlock(ns);
+
+	// Lets the consumer take down whatever it showed for the request
+	run_callback(CONNMAN_AGENT_CANCEL, service, at->id, NULL);
+	g_free(service);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Called with the call work lock held */
+static void agent_request_start_unlocked(struct call_work *cw,
+					 connman_agent_method_t method,
+					 GDBusMethodInvocation *invocation)
+{
+	guint timeout_ms = g_atomic_int_get(&agent_timeout_ms);
+	struct agent_timeout *at;
+
+	cw->agent_method = agent_method_names[method];
+	cw->invocation = invocation;
+	if (!timeout_ms)
+		return;
+
+	at = g_new0(struct agent_timeout, 1);
+	at->ns = cw->ns;
+	at->id = cw->id;
+	cw->agent_timeout = g_timeout_source_new(timeout_ms);
+	g_source_set_callback(cw->agent_timeout, agent_timeout_cb, at, g_free);
+	g_source_attach(cw->agent_timeout, NULL);
 }
 
-/* Introspection data for the agent service */
-static const gchar introspection_xml[] =
-"<node>"
-"  <interface name='net.connman.Agent'>"
-"    <method name='RequestInput'>"
-"	   <arg type='o' name='service' direction='in'/>"
-"	   <arg type='a{sv}' name='fields' direction='in'/>"
-"	   <arg type='a{sv}' name='fields' direction='out'/>"
-"    </method>"
-"    <method name='ReportError'>"
-"	   <arg type='o' name='service' direction='in'/>"
-"	   <arg type='s' name='error' direction='in'/>"
-"    </method>"
-"  </interface>"
-"</node>";
+/*
+ * Answer all outstanding requests with Canceled and tell the consumer,
+ * for ConnMan's Cancel and Release or when it goes away.
+ */
+void connman_agent_cancel_requests(struct connman_state *ns, const char *message)
+{
+	GPtrArray *services = g_ptr_array_new_with_free_func(g_free);
+	GArray *ids = g_array_new(FALSE, FALSE, sizeof(int));
+	GSList *list, *next;
+	guint i;
+
+	call_work_lock(ns);
+	for (list = ns->cw_pending; list; list = next) {
+		struct call_work *cw = list->data;
+
+		next = g_slist_next(list);
+		if (!cw->invocation)
+			continue;
+
+		g_ptr_array_add(services, g_strdup(cw->type_arg));
+		g_array_append_val(ids, cw->id);
+		call_work_agent_done_unlocked(cw, message);
+		if (!g_strcmp0(cw->method, CONNMAN_AGENT_CALL_WORK))
+			call_work_destroy_unlocked(cw);
+	}
+	call_work_unlock(ns);
+
+	for (i = 0; i < ids->len; i++)
+		run_callback(CONNMAN_AGENT_CANCEL, g_ptr_array_index(services, i),
+			     g_array_index(ids, int, i), NULL);
+
+	g_ptr_array_unref(services);
+	g_array_unref(ids);
+}
 
 static void handle_method_call(GDBusConnection *connection,
 			       const gchar *sender_name,
@@ -83,50 +245,137 @@ static void handle_method_call(GDBusConnection *connection,
 	INFO("interface=%s", interface_name);
 	INFO("method=%s", method_name);
 
-	DEBUG("parameters = %s", g_variant_print(parameters, TRUE));
+	DEBUG_VARIANT("parameters = ", parameters);
 
 	if (!g_strcmp0(method_name, "RequestInput")) {
-		GVariant *var = NULL;
+		GVariant *var = NULL, *cached;
 		g_variant_get(parameters, "(&o@a{sv})", &path, &var);
 		service = connman_strip_path(path);
 
-		call_work_lock(ns);
-
-		/* can only occur while a connect is issued */
-		cw = call_work_lookup_unlocked(ns,
-					       "service",
-					       service,
-					       "connect_service");
+		connman_timing_agent(service, FALSE);
+		cached = connman_credentials_lookup(service, var);
+
+		if (cached) {
+			INFO("RequestInput for %s answered from the credential cache",
+			     service);
+			CONNMAN_PROBE(agent__request, 0, method_name, service);
+			connman_timing_agent(service, TRUE);
+			g_dbus_method_invocation_return_value(invocation, cached);
+			g_variant_unref(cached);
+			g_variant_unref(var);
+			return;
+		}
 
-		/* if nothing is pending return an error */
+		/*
+		 * Tracked on the connect's call work if the library issued
+		 * one, or on its own, e.g. for an autoconnect.
+		 */
+		call_work_lock(ns);
+		cw = call_work_lookup_unlocked(ns, "service", service, "connect_service");
+		if (cw && cw->invocation)
+			cw = NULL;
+		else if (!cw)
+			cw = call_work_create_unlocked(ns, "service", service,
+						       CONNMAN_AGENT_CALL_WORK,
+						       method_name, NULL);
 		if (!cw) {
 			call_work_unlock(ns);
+			g_variant_unref(var);
 			g_dbus_method_invocation_return_dbus_error(invocation,
 								   "net.connman.Agent.Error.Canceled",
-								   "No connection pending");
+								   "Request already pending");
 			return;
 		}
 
-		cw->agent_method = "RequestInput";
-		cw->invocation = invocation;
+		agent_request_start_unlocked(cw, CONNMAN_AGENT_REQUEST_INPUT, invocation);
 		int id = cw->id;
 
 		call_work_unlock(ns);
 
-		run_callback(service, id, var);
+		CONNMAN_PROBE(agent__request, id, method_name, service);
+
+		run_callback(CONNMAN_AGENT_REQUEST_INPUT, service, id, var);
 
 		g_variant_unref(var);
 
 		return;
 	}
 
-	if (!g_strcmp0(method_name, "ReportError")) {
-		const gchar *strerr = NULL;
-		g_variant_get(parameters, "(&o&s)", &path, &strerr);
+	if (!g_strcmp0(method_name, "RequestBrowser")) {
+		GVariant *url = NULL;
+		int id;
+
+		g_variant_get(parameters, "(&o@s)", &path, &url);
+		service = connman_strip_path(path);
 
-		INFO("ReportError: service_path=%s error=%s", path, strerr);
+		/*
+		 * Comes for a captive portal, usually after the connect is
+		 * done, so it is tracked on its own rather than on the
+		 * connect's call work.
+		 */
+		call_work_lock(ns);
+		cw = call_work_create_unlocked(ns, "service", service,
+					       CONNMAN_AGENT_CALL_WORK,
+					       method_name, NULL);
+		if (!cw) {
+			call_work_unlock(ns);
+			g_variant_unref(url);
+			g_dbus_method_invocation_return_dbus_error(invocation,
+								   "net.connman.Agent.Error.Canceled",
+								   "Request already pending");
+			return;
+		}
 
-		return g_dbus_method_invocation_return_value(invocation, NULL);
+		agent_request_start_unlocked(cw, CONNMAN_AGENT_REQUEST_BROWSER, invocation);
+		id = cw->id;
+		call_work_unlock(ns);
+
+		CONNMAN_PROBE(agent__request, id, method_name, service);
+
+		run_callback(CONNMAN_AGENT_REQUEST_BROWSER, service, id, url);
+
+		g_variant_unref(url);
+
+		return;
+	}
+
+	if (!g_strcmp0(method_name, "ReportError") ||
+	    !g_strcmp0(method_name, "ReportPeerError")) {
+		connman_agent_method_t method = !g_strcmp0(method_name, "ReportError") ?
+			CONNMAN_AGENT_REPORT_ERROR : CONNMAN_AGENT_REPORT_PEER_ERROR;
+		GVariant *strerr = NULL;
+
+		g_variant_get(parameters, "(&o@s)", &path, &strerr);
+
+		INFO("%s: path=%s error=%s", method_name, path,
+		     g_variant_get_string(strerr, NULL));
+		// Whatever failed, cached credentials may be the cause
+		if (method == CONNMAN_AGENT_REPORT_ERROR)
+			connman_credentials_forget(connman_strip_path(path));
+		CONNMAN_PROBE(agent__request, 0, method_name, connman_strip_path(path));
+
+		g_dbus_method_invocation_return_value(invocation, NULL);
+		run_callback(method, connman_strip_path(path), 0, strerr);
+		g_variant_unref(strerr);
+
+		return;
+	}
+
+	if (!g_strcmp0(method_name, "Cancel")) {
+		CONNMAN_PROBE(agent__request, 0, method_name, NULL);
+		g_dbus_method_invocation_return_value(invocation, NULL);
+		connman_agent_cancel_requests(ns, "Canceled by ConnMan");
+		return;
+	}
+
+	if (!g_strcmp0(method_name, "Release")) {
+		INFO("agent released by ConnMan");
+		CONNMAN_PROBE(agent__request, 0, method_name, NULL);
+		ns->agent_registered = FALSE;
+		g_dbus_method_invocation_return_value(invocation, NULL);
+		connman_agent_cancel_requests(ns, "Agent released");
+		run_callback(CONNMAN_AGENT_RELEASE, NULL, 0, NULL);
+		return;
 	}
 
 	g_dbus_method_invocation_return_dbus_error(invocation,
@@ -140,38 +389,21 @@ static const GDBusInterfaceVTable interface_vtable = {
 	.set_property = NULL,
 };
 
-static void on_bus_acquired(GDBusConnection *connection,
-			    const gchar *name,
-			    gpointer user_data)
+static void register_agent_callback(void *user_data,
+				    GVariant *result,
+				    GError **error)
 {
 	struct init_data *id = user_data;
 	struct connman_state *ns = id->ns;
-	GVariant *result;
-	GError *error = NULL;
-
-	INFO("agent bus acquired - registering %s", ns->agent_path);
-
-	ns->registration_id =
-		g_dbus_connection_register_object(connection,
-						  ns->agent_path,
-						  ns->introspection_data->interfaces[0],
-						  &interface_vtable,
-						  ns,	/* user data */
-						  NULL,	/* user_data_free_func */
-						  NULL);
-	if (!ns->registration_id) {
-		ERROR("failed to register agent to dbus");
-		goto err_unable_to_register_bus;
 
-	}
-
-	result = connman_call(ns, CONNMAN_AT_MANAGER, NULL,
-			      "RegisterAgent",
-			      g_variant_new("(o)", ns->agent_path),
-			      &error);
 	if (!result) {
-		ERROR("failed to register agent to connman");
-		goto err_unable_to_register_connman;
+		ERROR("failed to register agent to connman: %s",
+		      error && *error ? (*error)->message : "unspecified");
+		g_dbus_connection_unregister_object(ns->conn, ns->registration_id);
+		ns->registration_id = 0;
+		if (id->init_done_cb)
+			(*id->init_done_cb)(id, FALSE);
+		return;
 	}
 	g_variant_unref(result);
 
@@ -180,20 +412,13 @@ static void on_bus_acquired(GDBusConnection *connection,
 	INFO("agent registered at %s", ns->agent_path);
 	if (id->init_done_cb)
 		(*id->init_done_cb)(id, TRUE);
-
-	return;
-
-err_unable_to_register_connman:
-	 g_dbus_connection_unregister_object(ns->conn, ns->registration_id);
-	 ns->registration_id = 0;
-err_unable_to_register_bus:
-	if (id->init_done_cb)
-		(*id->init_done_cb)(id, FALSE);
 }
 
 int connman_register_agent(struct init_data *id)
 {
 	struct connman_state *ns = id->ns;
+	struct connman_pending_work *cpw;
+	GError *error = NULL;
 
 	ns->agent_path = g_strdup_printf("%s/agent%d", CONNMAN_PATH, getpid());
 	if (!ns->agent_path) {
@@ -201,39 +426,101 @@ int connman_register_agent(struct init_data *id)
 		goto out_no_agent_path;
 	}
 
-	ns->introspection_data = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
-	if (!ns->introspection_data) {
-		ERROR("can't create introspection data");
-		goto out_no_introspection_data;
+	/*
+	 * ConnMan only needs the object path of the agent, so host it on
+	 * the library's own connection rather than acquiring a well-known
+	 * name, which would have required a second bus connection.
+	 */
+	INFO("registering agent object %s", ns->agent_path);
+
+	ns->registration_id =
+		g_dbus_connection_register_object(ns->conn,
+						  ns->agent_path,
+						  (GDBusInterfaceInfo *) &connman_agent_interface,
+						  &interface_vtable,
+						  ns,	/* user data */
+						  NULL,	/* user_data_free_func */
+						  &error);
+	if (!ns->registration_id) {
+		ERROR("failed to register agent to dbus: %s",
+		      error ? error->message : "unspecified");
+		g_clear_error(&error);
+		goto out_no_registration;
 	}
 
-	ns->agent_id = g_bus_own_name(G_BUS_TYPE_SYSTEM,
-				      AGENT_SERVICE,
-				      G_BUS_NAME_OWNER_FLAGS_REPLACE |
-				      G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT,
-				      on_bus_acquired,
-				      NULL,
-				      NULL,
-				      id,
-				      NULL);
-	if (!ns->agent_id) {
-		ERROR("can't create agent bus instance");
-		goto out_no_bus_name;
+	/* init done is signaled from the RegisterAgent reply */
+	cpw = connman_call_async(ns, CONNMAN_AT_MANAGER, NULL,
+				 "RegisterAgent",
+				 g_variant_new("(o)", ns->agent_path),
+				 connman_deadline_new(DBUS_REPLY_TIMEOUT_SHORT),
+				 &error,
+				 register_agent_callback, id);
+	if (!cpw) {
+		ERROR("failed to register agent to connman: %s",
+		      error ? error->message : "unspecified");
+		g_clear_error(&error);
+		goto out_no_register_call;
 	}
 
 	return 0;
 
-out_no_bus_name:
-	g_dbus_node_info_unref(ns->introspection_data);
-out_no_introspection_data:
+out_no_register_call:
+	g_dbus_connection_unregister_object(ns->conn, ns->registration_id);
+	ns->registration_id = 0;
+out_no_registration:
 	g_free(ns->agent_path);
+	ns->agent_path = NULL;
 out_no_agent_path:
 	return -1;
 }
 
+static void reregister_agent_callback(void *user_data,
+				      GVariant *result,
+				      GError **error)
+{
+	struct connman_state *ns = user_data;
+
+	if (!result) {
+		ERROR("failed to re-register agent to connman: %s",
+		      error && *error ? (*error)->message : "unspecified");
+		return;
+	}
+	g_variant_unref(result);
+
+	ns->agent_registered = TRUE;
+
+	INFO("agent re-registered at %s", ns->agent_path);
+}
+
+/* Register the already exported agent again after a ConnMan restart */
+void connman_reregister_agent(struct connman_state *ns)
+{
+	struct connman_pending_work *cpw;
+	GError *error = NULL;
+
+	if (!ns->registration_id || ns->agent_registered)
+		return;
+
+	cpw = connman_call_async(ns, CONNMAN_AT_MANAGER, NULL,
+				 "RegisterAgent",
+				 g_variant_new("(o)", ns->agent_path),
+				 connman_deadline_new(DBUS_REPLY_TIMEOUT_SHORT),
+				 &error,
+				 reregister_agent_callback, ns);
+	if (!cpw) {
+		ERROR("failed to re-register agent to connman: %s",
+		      error ? error->message : "unspecified");
+		g_clear_error(&error);
+	}
+}
+
 void connman_unregister_agent(struct connman_state *ns)
 {
-	g_bus_unown_name(ns->agent_id);
-	g_dbus_node_info_unref(ns->introspection_data);
+	if (ns->registration_id) {
+		g_dbus_connection_unregister_object(ns->conn, ns->registration_id);
+		ns->registration_id = 0;
+	}
+	ns->agent_registered = FALSE;
 	g_free(ns->agent_path);
+	ns->agent_path = NULL;
 }
@@ -27,8 +27,15 @@
 
 #include "common.h"
 
+// Call work method for agent requests not made during a connect
+#define CONNMAN_AGENT_CALL_WORK		"agent_request"
+
 int connman_register_agent(struct init_data *id);
 
+void connman_reregister_agent(struct connman_state *ns);
+
 void connman_unregister_agent(struct connman_state *ns);
 
+void connman_agent_cancel_requests(struct connman_state *ns, const char *message);
+
 #endif /* CONNMAN_AGENT_H */
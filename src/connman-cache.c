@@ -0,0 +1,368 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+
+#include "common.h"
+#include "connman-call.h"
+#include "connman-cache.h"
+#include "connman-wait.h"
+
+struct connman_cache {
+	GMutex mutex;
+	GHashTable *manager;		/* name -> GVariant */
+	GHashTable *technologies;	/* basename -> (name -> GVariant) */
+	GHashTable *services;		/* basename -> (name -> GVariant) */
+};
+
+static GHashTable *properties_new(void)
+{
+	return g_hash_table_new_full(g_str_hash, g_str_equal,
+				     g_free, (GDestroyNotify) g_variant_unref);
+}
+
+static GHashTable *objects_new(void)
+{
+	return g_hash_table_new_full(g_str_hash, g_str_equal,
+				     g_free, (GDestroyNotify) g_hash_table_unref);
+}
+
+static GHashTable *cache_objects(struct connman_cache *cache,
+				 connman_property_type_t type)
+{
+	switch (type) {
+	case CONNMAN_PROPERTY_TECHNOLOGY:
+		return cache->technologies;
+	case CONNMAN_PROPERTY_SERVICE:
+		return cache->services;
+	default:
+		return NULL;
+	}
+}
+
+/* Returns the property table of an object, creating it if asked to */
+static GHashTable *cache_lookup(struct connman_cache *cache,
+				connman_property_type_t type,
+				const gchar *object,
+				gboolean create)
+{
+	GHashTable *objects, *properties;
+
+	if (type == CONNMAN_PROPERTY_MANAGER)
+		return cache->manager;
+
+	objects = cache_objects(cache, type);
+	if (!(objects && object))
+		return NULL;
+
+	properties = g_hash_table_lookup(objects, object);
+	if (!properties && create) {
+		properties = properties_new();
+		g_hash_table_insert(objects, g_strdup(object), properties);
+	}
+	return properties;
+}
+
+static void properties_merge(GHashTable *properties, GVariant *dict)
+{
+	GVariantIter iter;
+	const gchar *key;
+	GVariant *val;
+
+	g_variant_iter_init(&iter, dict);
+	while (g_variant_iter_next(&iter, "{&sv}", &key, &val))
+		g_hash_table_replace(properties, g_strdup(key), val);
+}
+
+struct connman_cache *connman_cache_new(void)
+{
+	struct connman_cache *cache;
+
+	cache = g_try_malloc0(sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	g_mutex_init(&cache->mutex);
+	cache->manager = properties_new();
+	cache->technologies = objects_new();
+	cache->services = objects_new();
+
+	return cache;
+}
+
+void connman_cache_free(struct connman_cache *cache)
+{
+	if (!cache)
+		return;
+
+	g_hash_table_unref(cache->services);
+	g_hash_table_unref(cache->technologies);
+	g_hash_table_unref(cache->manager);
+	g_mutex_clear(&cache->mutex);
+	g_free(cache);
+}
+
+void connman_cache_set_property(struct connman_cache *cache,
+				connman_property_type_t type,
+				const gchar *object,
+				const gchar *name,
+				GVariant *value)
+{
+	GHashTable *properties;
+
+	if (!(name && value))
+		return;
+
+	g_mutex_lock(&cache->mutex);
+	properties = cache_lookup(cache, type, object, TRUE);
+	if (properties)
+		g_hash_table_replace(properties, g_strdup(name), g_variant_ref(value));
+	g_mutex_unlock(&cache->mutex);
+
+	connman_wait_notify(cache, type, object);
+}
+
+void connman_cache_update_object(struct connman_cache *cache,
+				 connman_property_type_t type,
+				 const gchar *object,
+				 GVariant *properties)
+{
+	GHashTable *table;
+
+	g_mutex_lock(&cache->mutex);
+	table = cache_lookup(cache, type, object, TRUE);
+	if (table && properties)
+		properties_merge(table, properties);
+	g_mutex_unlock(&cache->mutex);
+
+	connman_wait_notify(cache, type, object);
+}
+
+void connman_cache_remove_object(struct connman_cache *cache,
+				 connman_property_type_t type,
+				 const gchar *object)
+{
+	GHashTable *objects;
+
+	g_mutex_lock(&cache->mutex);
+	objects = cache_objects(cache, type);
+	if (objects && object)
+		g_hash_table_remove(objects, object);
+	g_mutex_unlock(&cache->mutex);
+}
+
+GVariant *connman_cache_get_property(struct connman_cache *cache,
+				     connman_property_type_t type,
+				     const gchar *object,
+				     const gchar *name)
+{
+	GHashTable *properties;
+	GVariant *val = NULL;
+
+	g_mutex_lock(&cache->mutex);
+	properties = cache_lookup(cache, type, object, FALSE);
+	if (properties)
+		val = g_hash_table_lookup(properties, name);
+	if (val)
+		g_variant_ref(val);
+	g_mutex_unlock(&cache->mutex);
+
+	return val;
+}
+
+static struct connman_cache_change *change_new(connman_property_type_t type,
+					       connman_cache_change_type_t change,
+					       const gchar *object,
+					       GVariant *properties)
+{
+	struct connman_cache_change *c = g_malloc0(sizeof(*c));
+
+	c->type = type;
+	c->change = change;
+	c->object = g_strdup(object);
+	c->properties = properties ? g_variant_ref_sink(properties) : NULL;
+
+	return c;
+}
+
+void connman_cache_change_free(gpointer data)
+{
+	struct connman_cache_change *c = data;
+
+	if (!c)
+		return;
+
+	g_free(c->object);
+	if (c->properties)
+		g_variant_unref(c->properties);
+	g_strfreev(c->removed);
+	g_free(c);
+}
+
+/*
+ * Returns the a{sv} of properties in the new table that are absent from
+ * or differ in the old one, and in removed the names of the ones only in
+ * the old table, or NULL with *removed NULL if nothing changed.  The a{sv}
+ * is empty if properties were only removed.
+ */
+static GVariant *properties_diff(GHashTable *old, GHashTable *new, gchar ***removed)
+{
+	GVariantBuilder builder;
+	GPtrArray *gone = NULL;
+	GHashTableIter iter;
+	gpointer key, val;
+	gboolean changed = FALSE;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+	g_hash_table_iter_init(&iter, new);
+	while (g_hash_table_iter_next(&iter, &key, &val)) {
+		GVariant *old_val = old ? g_hash_table_lookup(old, key) : NULL;
+
+		if (old_val && g_variant_equal(old_val, val))
+			continue;
+
+		g_variant_builder_add(&builder, "{sv}", (const gchar *) key, (GVariant *) val);
+		changed = TRUE;
+	}
+
+	if (old) {
+		g_hash_table_iter_init(&iter, old);
+		while (g_hash_table_iter_next(&iter, &key, NULL)) {
+			if (g_hash_table_contains(new, key))
+				continue;
+			if (!gone)
+				gone = g_ptr_array_new();
+			g_ptr_array_add(gone, g_strdup(key));
+		}
+	}
+
+	*removed = NULL;
+	if (!changed && !gone) {
+		g_variant_builder_clear(&builder);
+		return NULL;
+	}
+	if (gone) {
+		g_ptr_array_add(gone, NULL);
+		*removed = (gchar **) g_ptr_array_free(gone, FALSE);
+	}
+	return g_variant_builder_end(&builder);
+}
+
+/*
+ * Replace the cached state of one object type with a fresh GetProperties,
+ * GetTechnologies or GetServices reply, returning the list of
+ * struct connman_cache_change needed to bring a consumer that saw the old
+ * state up to date.  The caller frees the list with
+ * g_slist_free_full(changes, connman_cache_change_free).
+ */
+GSList *connman_cache_replace(struct connman_cache *cache,
+			      connman_property_type_t type,
+			      GVariant *properties)
+{
+	GSList *changes = NULL, *list;
+	GHashTableIter iter;
+	gpointer key, val;
+	gchar **removed;
+
+	g_mutex_lock(&cache->mutex);
+
+	if (type == CONNMAN_PROPERTY_MANAGER) {
+		GHashTable *new = properties_new();
+		GVariant *dict = g_variant_get_child_value(properties, 0);
+		GVariant *diff;
+
+		properties_merge(new, dict);
+		g_variant_unref(dict);
+
+		diff = properties_diff(cache->manager, new, &removed);
+		if (diff) {
+			struct connman_cache_change *c =
+				change_new(type, CONNMAN_CACHE_CHANGED, NULL, diff);
+
+			c->removed = removed;
+			changes = g_slist_prepend(changes, c);
+		}
+
+		g_hash_table_unref(cache->manager);
+		cache->manager = new;
+	} else {
+		GHashTable *old = cache_objects(cache, type);
+		GHashTable *new = objects_new();
+		GVariantIter *array;
+		const gchar *path;
+		GVariant *dict;
+
+		g_variant_get(properties, "(a(oa{sv}))", &array);
+		while (g_variant_iter_next(array, "(&o@a{sv})", &path, &dict)) {
+			const gchar *basename = connman_strip_path(path);
+			GHashTable *old_props, *new_props;
+			GVariant *diff;
+
+			if (!basename) {
+				g_variant_unref(dict);
+				continue;
+			}
+
+			new_props = properties_new();
+			properties_merge(new_props, dict);
+			g_hash_table_replace(new, g_strdup(basename), new_props);
+
+			old_props = g_hash_table_lookup(old, basename);
+			if (!old_props) {
+				changes = g_slist_prepend(changes,
+							  change_new(type, CONNMAN_CACHE_ADDED,
+								     basename, dict));
+			} else {
+				diff = properties_diff(old_props, new_props, &removed);
+				if (diff) {
+					struct connman_cache_change *c =
+						change_new(type, CONNMAN_CACHE_CHANGED,
+							   basename, diff);
+
+					c->removed = removed;
+					changes = g_slist_prepend(changes, c);
+				}
+			}
+			g_variant_unref(dict);
+		}
+		g_variant_iter_free(array);
+
+		g_hash_table_iter_init(&iter, old);
+		while (g_hash_table_iter_next(&iter, &key, &val)) {
+			if (!g_hash_table_contains(new, key))
+				changes = g_slist_prepend(changes,
+							  change_new(type, CONNMAN_CACHE_REMOVED,
+								     key, NULL));
+		}
+
+		if (type == CONNMAN_PROPERTY_TECHNOLOGY)
+			cache->technologies = new;
+		else
+			cache->services = new;
+		g_hash_table_unref(old);
+	}
+
+	g_mutex_unlock(&cache->mutex);
+
+	changes = g_slist_reverse(changes);
+	for (list = changes; list; list = g_slist_next(list)) {
+		struct connman_cache_change *c = list->data;
+
+		connman_wait_notify(cache, c->type, c->object);
+	}
+
+	return changes;
+}
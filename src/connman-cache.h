@@ -0,0 +1,75 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONNMAN_CACHE_H
+#define CONNMAN_CACHE_H
+
+#include <glib.h>
+
+#include "connman-glib.h"
+
+/*
+ * Locally tracked copy of the ConnMan manager, technology and service
+ * properties, kept up to date from the D-Bus signals.  Objects are keyed
+ * by the basename of their path, as passed to the event callbacks.
+ */
+struct connman_cache;
+
+typedef enum {
+	CONNMAN_CACHE_ADDED,
+	CONNMAN_CACHE_CHANGED,
+	CONNMAN_CACHE_REMOVED
+} connman_cache_change_type_t;
+
+struct connman_cache_change {
+	connman_property_type_t type;
+	connman_cache_change_type_t change;
+	gchar *object;		/* NULL for the manager */
+	GVariant *properties;	/* a{sv}, only the changed ones; NULL on removal */
+	gchar **removed;	/* properties that went away on a change, or NULL */
+};
+
+struct connman_cache *connman_cache_new(void);
+
+void connman_cache_free(struct connman_cache *cache);
+
+void connman_cache_set_property(struct connman_cache *cache,
+				connman_property_type_t type,
+				const gchar *object,
+				const gchar *name,
+				GVariant *value);
+
+void connman_cache_update_object(struct connman_cache *cache,
+				 connman_property_type_t type,
+				 const gchar *object,
+				 GVariant *properties);
+
+void connman_cache_remove_object(struct connman_cache *cache,
+				 connman_property_type_t type,
+				 const gchar *object);
+
+GVariant *connman_cache_get_property(struct connman_cache *cache,
+				     connman_property_type_t type,
+				     const gchar *object,
+				     const gchar *name);
+
+GSList *connman_cache_replace(struct connman_cache *cache,
+			      connman_property_type_t type,
+			      GVariant *properties);
+
+void connman_cache_change_free(gpointer data);
+
+#endif /* CONNMAN_CACHE_H */
@@ -18,10 +18,71 @@
 #include <glib.h>
 
 #include "connman-call.h"
+#include "connman-metrics.h"
 #include "common.h"
+#include "connman-capture.h"
+#include "probes.h"
 
 G_DEFINE_QUARK(connman-error-quark, connman_error)
 
+#ifdef HAVE_SYS_SDT_H
+#define CONNMAN_PROBE_DEFINE_SEMAPHORE(name) \
+	__extension__ unsigned short CONNMAN_PROBE_SEMAPHORE(name) \
+	__attribute__((unused)) __attribute__((section(".probes")))
+
+CONNMAN_PROBE_DEFINE_SEMAPHORE(call__start);
+CONNMAN_PROBE_DEFINE_SEMAPHORE(call__done);
+CONNMAN_PROBE_DEFINE_SEMAPHORE(signal);
+CONNMAN_PROBE_DEFINE_SEMAPHORE(callback__start);
+CONNMAN_PROBE_DEFINE_SEMAPHORE(callback__done);
+CONNMAN_PROBE_DEFINE_SEMAPHORE(agent__request);
+CONNMAN_PROBE_DEFINE_SEMAPHORE(agent__response);
+
+gint connman_probe_last_id;
+#endif
+
+static gint g_connman_default_timeout = DBUS_REPLY_TIMEOUT;
+
+// 0 restores the built-in default, a zero D-Bus timeout would fail every call
+EXPORT void connman_set_default_timeout(guint timeout_ms)
+{
+	if (!timeout_ms)
+		timeout_ms = DBUS_REPLY_TIMEOUT;
+	g_atomic_int_set(&g_connman_default_timeout, MIN(timeout_ms, G_MAXINT));
+}
+
+gint connman_get_default_timeout(void)
+{
+	return g_atomic_int_get(&g_connman_default_timeout);
+}
+
+// Negative timeouts select the default
+gint64 connman_deadline_new(gint timeout_ms)
+{
+	if (timeout_ms < 0)
+		timeout_ms = connman_get_default_timeout();
+
+	return g_get_monotonic_time() + (gint64) timeout_ms * G_TIME_SPAN_MILLISECOND;
+}
+
+// Returns the D-Bus timeout left before the deadline, or 0 once it has passed
+gint connman_deadline_timeout(gint64 deadline, GError **error)
+{
+	gint64 remaining;
+
+	if (deadline == CONNMAN_DEADLINE_DEFAULT)
+		return connman_get_default_timeout();
+
+	remaining = (deadline - g_get_monotonic_time()) / G_TIME_SPAN_MILLISECOND;
+	if (remaining <= 0) {
+		g_set_error(error, CONNMAN_ERROR, CONNMAN_ERROR_TIMEOUT,
+			    "deadline exceeded");
+		return 0;
+	}
+
+	return (gint) MIN(remaining, G_MAXINT);
+}
+
 
 void connman_decode_call_error(struct connman_state *ns,
 			       const char *access_type,
@@ -74,11 +135,15 @@ GVariant *connman_call(struct connman_state *ns,
 		       const char *type_arg,
 		       const char *method,
 		       GVariant *params,
+		       gint64 deadline,
 		       GError **error)
 {
 	const char *path;
 	const char *interface;
 	GVariant *reply;
+	gint timeout;
+	gint64 start;
+	guint probe_id G_GNUC_UNUSED;
 
 	if (!type_arg && (!strcmp(access_type, CONNMAN_AT_TECHNOLOGY) ||
 			  !strcmp(access_type, CONNMAN_AT_SERVICE))) {
@@ -104,11 +169,32 @@ GVariant *connman_call(struct connman_state *ns,
 		return NULL;
 	}
 
+	timeout = connman_deadline_timeout(deadline, error);
+	if (!timeout) {
+		if (params)
+			g_variant_unref(g_variant_ref_sink(params));
+		ERROR("Not calling %s%s%s %s method: deadline exceeded",
+		      access_type,
+		      type_arg ? "/" : "",
+		      type_arg ? type_arg : "",
+		      method);
+		return NULL;
+	}
+
+	probe_id = CONNMAN_PROBE_NEXT_ID();
+	CONNMAN_PROBE(call__start, probe_id, interface, method, path);
+	start = connman_metrics_start();
 	reply = g_dbus_connection_call_sync(ns->conn,
 					    CONNMAN_SERVICE, path, interface, method, params,
-					    NULL, G_DBUS_CALL_FLAGS_NONE, DBUS_REPLY_TIMEOUT,
+					    NULL, G_DBUS_CALL_FLAGS_NONE, timeout,
 					    NULL, error);
+	CONNMAN_PROBE(call__done, probe_id, interface, method,
+		      error && *error ? (*error)->message : NULL);
+	connman_capture_reply(path, interface, method, reply,
+			      error ? *error : NULL);
 	connman_decode_call_error(ns, access_type, type_arg, method, error);
+	connman_metrics_record(CONNMAN_METRICS_CALL, interface, method, start,
+			       error ? *error : NULL);
 	if (!reply) {
 		if (error && *error)
 			g_dbus_error_strip_remote_error(*error);
@@ -133,11 +219,21 @@ static void connman_call_async_ready(GObject *source_object,
 	GError *error = NULL;
 
 	result = g_dbus_connection_call_finish(ns->conn, res, &error);
+	CONNMAN_PROBE(call__done, cpw->probe_id, cpw->interface, cpw->method,
+		      error ? error->message : NULL);
+	connman_capture_reply(cpw->path, cpw->interface, cpw->method, result, error);
+	connman_decode_call_error(ns, cpw->access_type, cpw->type_arg, cpw->method, &error);
+	connman_metrics_record(CONNMAN_METRICS_CALL, cpw->interface, cpw->method,
+			       cpw->start, error);
 
 	cpw->callback(cpw->user_data, result, &error);
 
 	g_clear_error(&error);
-	g_cancellable_reset(cpw->cancel);
+	g_object_unref(cpw->cancel);
+	g_free(cpw->access_type);
+	g_free(cpw->type_arg);
+	g_free(cpw->method);
+	g_free(cpw->path);
 	g_free(cpw);
 }
 
@@ -153,6 +249,7 @@ connman_call_async(struct connman_state *ns,
 		   const char *type_arg,
 		   const char *method,
 		   GVariant *params,
+		   gint64 deadline,
 		   GError **error,
 		   void (*callback)(void *user_data, GVariant *result, GError **error),
 		   void *user_data)
@@ -160,6 +257,7 @@ connman_call_async(struct connman_state *ns,
 	const char *path;
 	const char *interface;
 	struct connman_pending_work *cpw;
+	gint timeout;
 
 	if (!type_arg && (!strcmp(access_type, CONNMAN_AT_TECHNOLOGY) ||
 			  !strcmp(access_type, CONNMAN_AT_SERVICE))) {
@@ -185,6 +283,13 @@ connman_call_async(struct connman_state *ns,
 		return NULL;
 	}
 
+	timeout = connman_deadline_timeout(deadline, error);
+	if (!timeout) {
+		if (params)
+			g_variant_unref(g_variant_ref_sink(params));
+		return NULL;
+	}
+
 	cpw = g_malloc(sizeof(*cpw));
 	if (!cpw) {
 		g_set_error(error, CONNMAN_ERROR, CONNMAN_ERROR_OUT_OF_MEMORY,
@@ -201,11 +306,19 @@ connman_call_async(struct connman_state *ns,
 		return NULL;
 	}
 	cpw->callback = callback;
+	cpw->interface = interface;
+	cpw->access_type = g_strdup(access_type);
+	cpw->type_arg = g_strdup(type_arg);
+	cpw->method = g_strdup(method);
+	cpw->path = g_strdup(path);
+	cpw->start = connman_metrics_start();
+	cpw->probe_id = CONNMAN_PROBE_NEXT_ID();
+	CONNMAN_PROBE(call__start, cpw->probe_id, interface, method, path);
 
 	g_dbus_connection_call(ns->conn,
 			CONNMAN_SERVICE, path, interface, method, params,
 			NULL,	/* reply type */
-			G_DBUS_CALL_FLAGS_NONE, DBUS_REPLY_TIMEOUT,
+			G_DBUS_CALL_FLAGS_NONE, timeout,
 			cpw->cancel,	/* cancellable? */
 			connman_call_async_ready,
 			cpw);
@@ -216,6 +329,7 @@ connman_call_async(struct connman_state *ns,
 GVariant *connman_get_properties(struct connman_state *ns,
 				 const char *access_type,
 				 const char *type_arg,
+				 gint64 deadline,
 				 GError **error)
 {
 	const char *method = NULL;
@@ -236,17 +350,21 @@ GVariant *connman_get_properties(struct connman_state *ns,
 		return NULL;
 	}
 
-	reply = connman_call(ns, CONNMAN_AT_MANAGER, type_arg, method, NULL, error);
+	reply = connman_call(ns, CONNMAN_AT_MANAGER, type_arg, method, NULL,
+			     deadline, error);
 	if (!reply) {
+		if (error && *error)
+			return NULL;
 		if (type_arg)
 			g_set_error(error, CONNMAN_ERROR, CONNMAN_ERROR_ILLEGAL_ARGUMENT,
 				    "Bad %s %s", access_type, type_arg);
 		else
 			g_set_error(error, CONNMAN_ERROR, CONNMAN_ERROR_ILLEGAL_ARGUMENT,
 				    "No %s", access_type);
+		return NULL;
 	}
 
-	DEBUG("properties: %s", g_variant_print(reply, TRUE));
+	DEBUG_VARIANT("properties: ", reply);
 
 	return reply;
 }
@@ -338,10 +456,12 @@ GVariant *connman_get_property_internal(struct connman_state *ns,
 					const char *access_type,
 					const char *type_arg,
 					const char *name,
+					gint64 deadline,
 					GError **error)
 {
 	GError *get_error = NULL;
-	GVariant *reply = connman_get_properties(ns, access_type, type_arg, &get_error);
+	GVariant *reply = connman_get_properties(ns, access_type, type_arg,
+						 deadline, &get_error);
 	if (get_error || !reply) {
 		if (!get_error)
 			g_set_error(error, CONNMAN_ERROR, CONNMAN_ERROR_BAD_PROPERTY,
@@ -380,9 +500,10 @@ gboolean connman_set_property_internal(struct connman_state *ns,
 				       const char *type_arg,
 				       const char *name,
 				       GVariant *value,
+				       gint64 deadline,
 				       GError **error)
 {
-	if (!(ns && access_type && type_arg && name && value))
+	if (!(ns && access_type && name && value))
 		return FALSE;
 
 	GVariant *var = g_variant_new("(sv)", name, value);
@@ -394,6 +515,7 @@ gboolean connman_set_property_internal(struct connman_state *ns,
 				       type_arg,
 				       "SetProperty",
 				       var,
+				       deadline,
 				       error);
 	if (!reply)
 		return FALSE;
@@ -36,6 +36,7 @@ typedef enum {
 	CONNMAN_ERROR_MISSING_ARGUMENT,
 	CONNMAN_ERROR_ILLEGAL_ARGUMENT,
 	CONNMAN_ERROR_CALL_IN_PROGRESS,
+	CONNMAN_ERROR_TIMEOUT,
 } NBError;
 
 #define CONNMAN_ERROR (connman_error_quark())
@@ -81,7 +82,6 @@ extern GQuark connman_error_quark(void);
      })
 
 #define AGENT_PATH				"/net/connman/Agent"
-#define AGENT_SERVICE				"org.agent"
 
 #define DBUS_REPLY_TIMEOUT			(120 * 1000)
 #define DBUS_REPLY_TIMEOUT_SHORT		(10 * 1000)
@@ -104,22 +104,38 @@ static inline const char *connman_strip_path(const char *path)
 	return *basename ? basename : NULL;
 }
 
+/*
+ * Deadlines are absolute g_get_monotonic_time() values shared by all the
+ * calls making up one operation; CONNMAN_DEADLINE_DEFAULT gives each call
+ * the default timeout instead.
+ */
+#define CONNMAN_DEADLINE_DEFAULT		0
+
+gint connman_get_default_timeout(void);
+
+gint64 connman_deadline_new(gint timeout_ms);
+
+gint connman_deadline_timeout(gint64 deadline, GError **error);
+
 GVariant *connman_call(struct connman_state *ns,
 		       const char *access_type,
 		       const char *type_arg,
 		       const char *method,
 		       GVariant *params,
+		       gint64 deadline,
 		       GError **error);
 
 GVariant *connman_get_properties(struct connman_state *ns,
 				 const char *access_type,
 				 const char *type_arg,
+				 gint64 deadline,
 				 GError **error);
 
 GVariant *connman_get_property_internal(struct connman_state *ns,
 					const char *access_type,
 					const char *type_arg,
 					const char *name,
+					gint64 deadline,
 					GError **error);
 
 gboolean connman_set_property_internal(struct connman_state *ns,
@@ -127,12 +143,20 @@ gboolean connman_set_property_internal(struct connman_state *ns,
 				       const char *type_arg,
 				       const char *name,
 				       GVariant *value,
+				       gint64 deadline,
 				       GError **error);
 
 struct connman_pending_work {
 	struct connman_state *ns;
 	void *user_data;
 	GCancellable *cancel;
+	const char *interface;
+	gchar *access_type;
+	gchar *type_arg;
+	gchar *method;
+	gchar *path;
+	gint64 start;
+	guint probe_id;
 	void (*callback)(void *user_data, GVariant *result, GError **error);
 };
 
@@ -145,6 +169,7 @@ connman_call_async(struct connman_state *ns,
 		   const char *type_arg,
 		   const char *method,
 		   GVariant *params,
+		   gint64 deadline,
 		   GError **error,
 		   void (*callback)(void *user_data, GVariant *result, GError **error),
 		   void *user_data);
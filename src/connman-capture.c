@@ -0,0 +1,232 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "common.h"
+#include "connman-capture.h"
+
+/*
+ * Capture of the ConnMan traffic seen by the library, for replay.  The
+ * file starts with CAPTURE_MAGIC and is followed by records, each a
+ * little endian guint32 size, 4 bytes of padding, and a little endian
+ * serialized CAPTURE_RECORD_TYPE GVariant padded to 8 bytes so that
+ * records stay aligned in a mapped file:
+ *
+ *   (time in us since the capture started, kind, object path,
+ *    interface, member, body)
+ *
+ * Error replies have the error message as the body.
+ */
+
+#define CAPTURE_MAGIC		"CMGCAP\001\n"
+#define CAPTURE_MAGIC_LEN	8
+#define CAPTURE_RECORD_TYPE	"(tysssv)"
+#define CAPTURE_ALIGN		8
+
+static gint capture_active;	/* atomic */
+static GMutex capture_mutex;
+static FILE *capture_file;
+static gint64 capture_start;
+
+gboolean connman_capture_active(void)
+{
+	return g_atomic_int_get(&capture_active);
+}
+
+EXPORT gboolean connman_capture_start(const gchar *filename)
+{
+	FILE *file;
+
+	file = fopen(filename, "wb");
+	if (!file) {
+		ERROR("Cannot open capture file %s", filename);
+		return FALSE;
+	}
+	setvbuf(file, NULL, _IOFBF, 64 * 1024);
+	fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, file);
+
+	g_mutex_lock(&capture_mutex);
+	if (capture_file)
+		fclose(capture_file);
+	capture_file = file;
+	capture_start = g_get_monotonic_time();
+	g_atomic_int_set(&capture_active, TRUE);
+	g_mutex_unlock(&capture_mutex);
+
+	return TRUE;
+}
+
+EXPORT void connman_capture_stop(void)
+{
+	g_mutex_lock(&capture_mutex);
+	g_atomic_int_set(&capture_active, FALSE);
+	if (capture_file) {
+		fclose(capture_file);
+		capture_file = NULL;
+	}
+	g_mutex_unlock(&capture_mutex);
+}
+
+void connman_capture_record(connman_capture_kind_t kind,
+			    const char *object_path,
+			    const char *interface,
+			    const char *member,
+			    GVariant *body)
+{
+	static const guint8 padding[CAPTURE_ALIGN];
+	GVariant *record;
+	guint32 header[2];
+	gsize size;
+
+	if (!g_atomic_int_get(&capture_active))
+		return;
+
+	g_mutex_lock(&capture_mutex);
+	if (!capture_file) {
+		g_mutex_unlock(&capture_mutex);
+		return;
+	}
+
+	record = g_variant_ref_sink(g_variant_new(CAPTURE_RECORD_TYPE,
+						  (guint64) (g_get_monotonic_time() - capture_start),
+						  (guchar) kind,
+						  object_path ? object_path : "",
+						  interface ? interface : "",
+						  member ? member : "",
+						  body ? body : g_variant_new("()")));
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+	{
+		GVariant *swapped = g_variant_byteswap(record);
+
+		g_variant_unref(record);
+		record = swapped;
+	}
+#endif
+	size = g_variant_get_size(record);
+	header[0] = GUINT32_TO_LE(size);
+	header[1] = 0;
+
+	fwrite(header, sizeof(header), 1, capture_file);
+	fwrite(g_variant_get_data(record), 1, size, capture_file);
+	if (size % CAPTURE_ALIGN)
+		fwrite(padding, 1, CAPTURE_ALIGN - size % CAPTURE_ALIGN, capture_file);
+	g_mutex_unlock(&capture_mutex);
+
+	g_variant_unref(record);
+}
+
+void connman_capture_reply(const char *object_path,
+			   const char *interface,
+			   const char *method,
+			   GVariant *reply,
+			   const GError *error)
+{
+	if (!g_atomic_int_get(&capture_active))
+		return;
+
+	if (reply)
+		connman_capture_record(CONNMAN_CAPTURE_REPLY, object_path,
+				       interface, method, reply);
+	else
+		connman_capture_record(CONNMAN_CAPTURE_ERROR, object_path,
+				       interface, method,
+				       g_variant_new_string(error ? error->message : ""));
+}
+
+/*
+ * Feed the signals of a capture to the handlers through
+ * connman_inject_signal(), spaced as recorded divided by speed, or as
+ * fast as possible if speed is 0.  Blocks until done and returns the
+ * number of signals replayed, or -1 on error.
+ */
+EXPORT gint64 connman_capture_replay(const gchar *filename, gdouble speed)
+{
+	GError *error = NULL;
+	GMappedFile *mapped;
+	const gchar *data, *end;
+	gint64 start = g_get_monotonic_time();
+	gint64 replayed = 0;
+
+	mapped = g_mapped_file_new(filename, FALSE, &error);
+	if (!mapped) {
+		ERROR("Cannot open capture file %s: %s", filename, error->message);
+		g_error_free(error);
+		return -1;
+	}
+
+	data = g_mapped_file_get_contents(mapped);
+	end = data + g_mapped_file_get_length(mapped);
+	if (end - data < CAPTURE_MAGIC_LEN ||
+	    memcmp(data, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN)) {
+		ERROR("%s is not a capture file", filename);
+		g_mapped_file_unref(mapped);
+		return -1;
+	}
+	data += CAPTURE_MAGIC_LEN;
+
+	while (end - data >= 8) {
+		guint32 size = GUINT32_FROM_LE(*(const guint32 *) data);
+		const gchar *path, *interface, *member;
+		GVariant *record, *body;
+		guint64 time;
+		guchar kind;
+
+		data += 8;
+		if ((gsize) (end - data) < size) {
+			WARNING("Truncated capture record");
+			break;
+		}
+
+		record = g_variant_new_from_data(G_VARIANT_TYPE(CAPTURE_RECORD_TYPE),
+						 data, size, FALSE, NULL, NULL);
+		g_variant_ref_sink(record);
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+		{
+			GVariant *swapped = g_variant_byteswap(record);
+
+			g_variant_unref(record);
+			record = swapped;
+		}
+#endif
+		data += size;
+		if (size % CAPTURE_ALIGN)
+			data += MIN(CAPTURE_ALIGN - size % CAPTURE_ALIGN, (gsize) (end - data));
+
+		g_variant_get(record, "(ty&s&s&sv)", &time, &kind, &path,
+			      &interface, &member, &body);
+		if (kind == CONNMAN_CAPTURE_SIGNAL) {
+			if (speed > 0) {
+				gint64 due = start + (gint64) (time / speed);
+				gint64 now = g_get_monotonic_time();
+
+				if (due > now)
+					g_usleep(due - now);
+			}
+			if (connman_inject_signal(path, interface, member, body))
+				replayed++;
+		}
+		g_variant_unref(body);
+		g_variant_unref(record);
+	}
+
+	g_mapped_file_unref(mapped);
+
+	return replayed;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONNMAN_CAPTURE_H
+#define CONNMAN_CAPTURE_H
+
+#include <glib.h>
+
+typedef enum {
+	CONNMAN_CAPTURE_SIGNAL = 's',
+	CONNMAN_CAPTURE_REPLY = 'r',
+	CONNMAN_CAPTURE_ERROR = 'e'
+} connman_capture_kind_t;
+
+gboolean connman_capture_active(void);
+
+void connman_capture_record(connman_capture_kind_t kind,
+			    const char *object_path,
+			    const char *interface,
+			    const char *member,
+			    GVariant *body);
+
+// Records a method reply, or the error if there was none
+void connman_capture_reply(const char *object_path,
+			   const char *interface,
+			   const char *method,
+			   GVariant *reply,
+			   const GError *error);
+
+#endif /* CONNMAN_CAPTURE_H */
@@ -0,0 +1,331 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "common.h"
+#include "connman-credentials.h"
+
+/*
+ * Cache of the values given in RequestInput replies, so that reconnects
+ * can be answered without asking the consumer.  The values are kept
+ * serialized in fixed size slots of an arena that is locked in memory,
+ * left out of core dumps and wiped when a slot is released.  Only the
+ * service identifiers, which are not secret, live on the normal heap.
+ * When it is full, storing a service evicts the least recently stored or
+ * looked up one.
+ * The reply itself necessarily passes through GDBus' own buffers.
+ */
+
+#define CREDENTIALS_SLOT_SIZE	1024
+
+struct credentials_slot {
+	gboolean used;
+	guint32 size;
+	guint8 data[CREDENTIALS_SLOT_SIZE - 2 * sizeof(guint32)];
+};
+
+static GMutex credentials_mutex;
+static gint credentials_active;	/* atomic */
+static struct credentials_slot *credentials_arena;
+static gsize credentials_arena_size;
+static guint credentials_slots;
+static GHashTable *credentials_index;	/* service -> slot + 1 */
+static GQueue credentials_lru;		/* services, least recently used first */
+
+static void slot_wipe(guint slot)
+{
+	explicit_bzero(&credentials_arena[slot], sizeof(credentials_arena[slot]));
+}
+
+// Moves a service that was just used to the back of the eviction order
+static void touch_unlocked(const gchar *service)
+{
+	GList *link = g_queue_find_custom(&credentials_lru, service,
+					  (GCompareFunc) g_strcmp0);
+
+	if (link) {
+		g_queue_unlink(&credentials_lru, link);
+		g_queue_push_tail_link(&credentials_lru, link);
+	}
+}
+
+static void forget_unlocked(const gchar *service)
+{
+	gpointer value;
+	GList *link;
+
+	if (!g_hash_table_lookup_extended(credentials_index, service, NULL, &value))
+		return;
+
+	slot_wipe(GPOINTER_TO_UINT(value) - 1);
+	link = g_queue_find_custom(&credentials_lru, service, (GCompareFunc) g_strcmp0);
+	if (link) {
+		g_free(link->data);
+		g_queue_delete_link(&credentials_lru, link);
+	}
+	g_hash_table_remove(credentials_index, service);
+}
+
+static void disable_unlocked(void)
+{
+	g_atomic_int_set(&credentials_active, FALSE);
+	if (!credentials_arena)
+		return;
+
+	explicit_bzero(credentials_arena, credentials_arena_size);
+	munlock(credentials_arena, credentials_arena_size);
+	munmap(credentials_arena, credentials_arena_size);
+	credentials_arena = NULL;
+	credentials_arena_size = 0;
+	credentials_slots = 0;
+
+	g_hash_table_destroy(credentials_index);
+	credentials_index = NULL;
+	g_queue_clear_full(&credentials_lru, g_free);
+}
+
+/*
+ * Enable the cache with room for max_entries services, or disable it and
+ * wipe it if max_entries is 0.  Fails if the memory cannot be locked, e.g.
+ * because of RLIMIT_MEMLOCK.
+ */
+EXPORT gboolean connman_agent_credentials_enable(guint max_entries)
+{
+	gsize page = sysconf(_SC_PAGESIZE);
+	gsize size;
+	void *arena;
+
+	g_mutex_lock(&credentials_mutex);
+	disable_unlocked();
+	if (!max_entries) {
+		g_mutex_unlock(&credentials_mutex);
+		return TRUE;
+	}
+
+	// Only the mapping is rounded up to pages, the rest of it goes unused
+	size = (max_entries * sizeof(struct credentials_slot) + page - 1) / page * page;
+	arena = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (arena == MAP_FAILED) {
+		g_mutex_unlock(&credentials_mutex);
+		ERROR("Cannot allocate the credential cache");
+		return FALSE;
+	}
+	if (mlock(arena, size)) {
+		munmap(arena, size);
+		g_mutex_unlock(&credentials_mutex);
+		ERROR("Cannot lock the credential cache in memory");
+		return FALSE;
+	}
+#ifdef MADV_DONTDUMP
+	madvise(arena, size, MADV_DONTDUMP);
+#endif
+#ifdef MADV_WIPEONFORK
+	madvise(arena, size, MADV_WIPEONFORK);
+#endif
+
+	credentials_arena = arena;
+	credentials_arena_size = size;
+	credentials_slots = max_entries;
+	credentials_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	g_atomic_int_set(&credentials_active, TRUE);
+	g_mutex_unlock(&credentials_mutex);
+
+	return TRUE;
+}
+
+gboolean connman_credentials_enabled(void)
+{
+	return g_atomic_int_get(&credentials_active);
+}
+
+void connman_credentials_store(const gchar *service, GVariant *values)
+{
+	GVariant *normal;
+	gsize size;
+	guint slot;
+
+	if (!service || !g_atomic_int_get(&credentials_active))
+		return;
+	if (!g_variant_is_of_type(values, G_VARIANT_TYPE("a{sv}"))) {
+		ERROR("Credentials for %s are not a{sv}", service);
+		return;
+	}
+	// Would answer nothing, and a{sv} serializes empty dicts to no bytes
+	if (!g_variant_n_children(values)) {
+		connman_credentials_forget(service);
+		return;
+	}
+
+	normal = g_variant_get_normal_form(values);
+	size = g_variant_get_size(normal);
+
+	g_mutex_lock(&credentials_mutex);
+	if (!credentials_arena)
+		goto out;
+
+	forget_unlocked(service);
+	if (size > sizeof(credentials_arena[0].data)) {
+		WARNING("Credentials for %s are too large to cache", service);
+		goto out;
+	}
+
+	if (g_hash_table_size(credentials_index) >= credentials_slots) {
+		gchar *stale = g_queue_peek_head(&credentials_lru);
+
+		forget_unlocked(stale);
+	}
+
+	// Any slot not in the index is free, and free slots are zeroed
+	for (slot = 0; slot < credentials_slots; slot++)
+		if (!credentials_arena[slot].used)
+			break;
+
+	g_variant_store(normal, credentials_arena[slot].data);
+	credentials_arena[slot].size = size;
+	credentials_arena[slot].used = TRUE;
+	g_hash_table_insert(credentials_index, g_strdup(service),
+			    GUINT_TO_POINTER(slot + 1));
+	g_queue_push_tail(&credentials_lru, g_strdup(service));
+out:
+	g_mutex_unlock(&credentials_mutex);
+
+	g_variant_unref(normal);
+}
+
+EXPORT gboolean connman_agent_credentials_set(const gchar *service, GVariant *values)
+{
+	gboolean stored;
+
+	if (!service || !values) {
+		ERROR("No service or values given");
+		if (values)
+			g_variant_unref(g_variant_ref_sink(values));
+		return FALSE;
+	}
+
+	g_variant_ref_sink(values);
+	connman_credentials_store(service, values);
+	g_variant_unref(values);
+
+	g_mutex_lock(&credentials_mutex);
+	stored = credentials_index && g_hash_table_contains(credentials_index, service);
+	g_mutex_unlock(&credentials_mutex);
+
+	return stored;
+}
+
+void connman_credentials_forget(const gchar *service)
+{
+	g_mutex_lock(&credentials_mutex);
+	if (credentials_index)
+		forget_unlocked(service);
+	g_mutex_unlock(&credentials_mutex);
+}
+
+EXPORT void connman_agent_credentials_forget(const gchar *service)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	if (service) {
+		connman_credentials_forget(service);
+		return;
+	}
+
+	g_mutex_lock(&credentials_mutex);
+	if (credentials_index) {
+		g_hash_table_iter_init(&iter, credentials_index);
+		while (g_hash_table_iter_next(&iter, NULL, &value))
+			slot_wipe(GPOINTER_TO_UINT(value) - 1);
+		g_hash_table_remove_all(credentials_index);
+		g_queue_clear_full(&credentials_lru, g_free);
+	}
+	g_mutex_unlock(&credentials_mutex);
+}
+
+GVariant *connman_credentials_lookup(const gchar *service, GVariant *fields)
+{
+	GVariant *cached, *reply = NULL;
+	GVariantBuilder builder;
+	GVariantIter iter;
+	const gchar *name;
+	GVariant *field;
+	gpointer value;
+	guint slot, found = 0;
+
+	if (!service || !g_atomic_int_get(&credentials_active))
+		return NULL;
+
+	g_mutex_lock(&credentials_mutex);
+	if (!credentials_index ||
+	    !g_hash_table_lookup_extended(credentials_index, service, NULL, &value)) {
+		g_mutex_unlock(&credentials_mutex);
+		return NULL;
+	}
+	slot = GPOINTER_TO_UINT(value) - 1;
+	cached = g_variant_new_from_data(G_VARIANT_TYPE("a{sv}"),
+					 credentials_arena[slot].data,
+					 credentials_arena[slot].size,
+					 TRUE, NULL, NULL);
+	g_variant_ref_sink(cached);
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+	g_variant_iter_init(&iter, fields);
+	while (g_variant_iter_next(&iter, "{&s@v}", &name, &field)) {
+		GVariant *spec = g_variant_get_variant(field);
+		const gchar *requirement = NULL;
+		GVariant *known;
+
+		g_variant_lookup(spec, "Requirement", "&s", &requirement);
+		known = g_variant_lookup_value(cached, name, NULL);
+		if (known) {
+			if (g_strcmp0(requirement, "alternate") &&
+			    g_strcmp0(requirement, "informational")) {
+				g_variant_builder_add(&builder, "{s@v}", name,
+						      g_variant_new_variant(known));
+				found++;
+			}
+			g_variant_unref(known);
+		} else if (!g_strcmp0(requirement, "mandatory")) {
+			g_variant_unref(spec);
+			g_variant_unref(field);
+			goto out;
+		}
+		g_variant_unref(spec);
+		g_variant_unref(field);
+	}
+	if (!found)
+		goto out;
+
+	reply = g_variant_ref_sink(g_variant_new("(@a{sv})", g_variant_builder_end(&builder)));
+	// Serialize now, the values still point into the locked slot
+	g_variant_get_data(reply);
+	touch_unlocked(service);
+out:
+	if (!reply)
+		g_variant_builder_clear(&builder);
+	g_variant_unref(cached);
+	g_mutex_unlock(&credentials_mutex);
+
+	return reply;
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONNMAN_CREDENTIALS_H
+#define CONNMAN_CREDENTIALS_H
+
+#include <glib.h>
+
+gboolean connman_credentials_enabled(void);
+
+// Returns the RequestInput reply if all mandatory fields are cached
+GVariant *connman_credentials_lookup(const gchar *service, GVariant *fields);
+
+void connman_credentials_store(const gchar *service, GVariant *values);
+
+void connman_credentials_forget(const gchar *service);
+
+#endif /* CONNMAN_CREDENTIALS_H */
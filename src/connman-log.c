@@ -0,0 +1,363 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <glib.h>
+#ifdef HAVE_SD_JOURNAL
+#define SD_JOURNAL_SUPPRESS_LOCATION
+#include <systemd/sd-journal.h>
+#endif
+
+#include "connman-glib.h"
+#include "common.h"
+
+/*
+ * Log records are formatted into a per-thread single producer, single
+ * consumer ring and written out by a background thread, so logging from
+ * the D-Bus handler thread never blocks on stdio or the journal.  A full
+ * ring drops records, and the drops are reported once there is room.
+ */
+
+#define LOG_RING_SIZE		128	/* power of two */
+#define LOG_MESSAGE_MAX		480
+
+struct log_record {
+	connman_log_level_t level;
+	const char *func;	/* __FUNCTION__, static */
+	char message[LOG_MESSAGE_MAX];
+};
+
+struct log_ring {
+	guint head;		/* atomic, advanced by the writer */
+	guint tail;		/* atomic, advanced by the owning thread */
+	guint dropped;		/* atomic */
+	gint retired;		/* atomic, owning thread has exited */
+	struct log_record records[LOG_RING_SIZE];
+};
+
+connman_log_level_t connman_log_level = CONNMAN_LOG_LEVEL_DEFAULT;
+
+static const char *log_level_names[CONNMAN_LOG_LEVEL_DEBUG + 1] = {
+	"ERROR",
+	"WARNING",
+	"INFO",
+	"DEBUG"
+};
+
+static gint log_sink = CONNMAN_LOG_SINK_STDIO;	/* atomic */
+
+static GMutex log_rings_mutex;
+static GSList *log_rings;
+
+// Serializes draining between the writer thread and exit
+static GMutex log_drain_mutex;
+
+static GMutex log_writer_mutex;
+static GCond log_writer_cond;
+static gint log_writer_idle;	/* atomic */
+
+static void log_ring_retire(gpointer data)
+{
+	struct log_ring *ring = data;
+
+	g_atomic_int_set(&ring->retired, TRUE);
+}
+
+static GPrivate log_ring_key = G_PRIVATE_INIT(log_ring_retire);
+
+static void log_write(connman_log_level_t level, const char *func, const char *message)
+{
+#ifdef HAVE_SD_JOURNAL
+	static const int priorities[CONNMAN_LOG_LEVEL_DEBUG + 1] = {
+		LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG
+	};
+
+	if (g_atomic_int_get(&log_sink) == CONNMAN_LOG_SINK_JOURNAL) {
+		sd_journal_send("MESSAGE=%s", message,
+				"PRIORITY=%d", priorities[level],
+				"CODE_FUNC=%s", func,
+				NULL);
+		return;
+	}
+#endif
+	fprintf(level == CONNMAN_LOG_LEVEL_ERROR ? stderr : stdout,
+		"%s: %s: %s\n", log_level_names[level], func, message);
+}
+
+// Write out everything queued so far, returns whether anything was
+static gboolean log_drain(void)
+{
+	gboolean written = FALSE;
+	GSList *list, *next;
+
+	g_mutex_lock(&log_drain_mutex);
+
+	g_mutex_lock(&log_rings_mutex);
+	for (list = log_rings; list; list = next) {
+		struct log_ring *ring = list->data;
+		gboolean retired = g_atomic_int_get(&ring->retired);
+		guint head = g_atomic_int_get(&ring->head);
+		guint tail = g_atomic_int_get(&ring->tail);
+		guint dropped;
+
+		next = g_slist_next(list);
+
+		for (; head != tail; head++) {
+			struct log_record *r = &ring->records[head % LOG_RING_SIZE];
+
+			log_write(r->level, r->func, r->message);
+			written = TRUE;
+		}
+		g_atomic_int_set(&ring->head, head);
+
+		dropped = g_atomic_int_and(&ring->dropped, 0);
+		if (dropped) {
+			gchar message[64];
+
+			g_snprintf(message, sizeof(message),
+				   "%u log messages dropped", dropped);
+			log_write(CONNMAN_LOG_LEVEL_WARNING, G_STRFUNC, message);
+			written = TRUE;
+		}
+
+		// The tail cannot move once the owner is gone
+		if (retired) {
+			log_rings = g_slist_delete_link(log_rings, list);
+			g_free(ring);
+		}
+	}
+	g_mutex_unlock(&log_rings_mutex);
+
+	if (written) {
+		fflush(stdout);
+		fflush(stderr);
+	}
+
+	g_mutex_unlock(&log_drain_mutex);
+
+	return written;
+}
+
+static gpointer log_writer_func(gpointer data)
+{
+	for (;;) {
+		if (log_drain())
+			continue;
+
+		// Producers wake the writer with a CAS on log_writer_idle
+		// and signal under the mutex, so no wakeup is lost between
+		// the final drain and the wait.
+		g_mutex_lock(&log_writer_mutex);
+		g_atomic_int_set(&log_writer_idle, TRUE);
+		if (!log_drain()) {
+			while (g_atomic_int_get(&log_writer_idle))
+				g_cond_wait(&log_writer_cond, &log_writer_mutex);
+		} else {
+			g_atomic_int_set(&log_writer_idle, FALSE);
+		}
+		g_mutex_unlock(&log_writer_mutex);
+	}
+
+	return NULL;
+}
+
+static void log_atexit(void)
+{
+	log_drain();
+}
+
+static gpointer log_writer_start(gpointer data)
+{
+	GThread *thread;
+
+	thread = g_thread_try_new("connman-log", log_writer_func, NULL, NULL);
+	if (!thread)
+		return GINT_TO_POINTER(FALSE);
+
+	g_thread_unref(thread);
+	atexit(log_atexit);
+
+	return GINT_TO_POINTER(TRUE);
+}
+
+static struct log_ring *log_ring_get(void)
+{
+	struct log_ring *ring = g_private_get(&log_ring_key);
+
+	if (G_UNLIKELY(!ring)) {
+		ring = g_try_malloc0(sizeof(*ring));
+		if (!ring)
+			return NULL;
+		g_private_set(&log_ring_key, ring);
+
+		g_mutex_lock(&log_rings_mutex);
+		log_rings = g_slist_prepend(log_rings, ring);
+		g_mutex_unlock(&log_rings_mutex);
+	}
+
+	return ring;
+}
+
+EXPORT void connman_set_log_level(connman_log_level_t level)
+{
+	printf("%s: Setting log level to %d\n", __FUNCTION__, level);
+	connman_log_level = level;
+}
+
+EXPORT gboolean connman_set_log_sink(connman_log_sink_t sink)
+{
+#ifndef HAVE_SD_JOURNAL
+	if (sink == CONNMAN_LOG_SINK_JOURNAL)
+		return FALSE;
+#endif
+	g_atomic_int_set(&log_sink, sink);
+	return TRUE;
+}
+
+void connman_log(connman_log_level_t level, const char *func, const char *format, ...)
+{
+	static GOnce writer_once = G_ONCE_INIT;
+	struct log_record *r;
+	struct log_ring *ring;
+	va_list args;
+	guint tail;
+	int len;
+
+	if (level > connman_log_level)
+		return;
+
+	g_once(&writer_once, log_writer_start, NULL);
+	ring = writer_once.retval ? log_ring_get() : NULL;
+
+	// Without a writer, fall back to writing synchronously
+	if (!ring) {
+		gchar *message;
+
+		va_start(args, format);
+		message = g_strdup_vprintf(format, args);
+		va_end(args);
+		log_write(level, func, message);
+		fflush(level == CONNMAN_LOG_LEVEL_ERROR ? stderr : stdout);
+		g_free(message);
+		return;
+	}
+
+	tail = g_atomic_int_get(&ring->tail);
+	if (tail - g_atomic_int_get(&ring->head) >= LOG_RING_SIZE) {
+		g_atomic_int_inc(&ring->dropped);
+		return;
+	}
+
+	r = &ring->records[tail % LOG_RING_SIZE];
+	r->level = level;
+	r->func = func;
+	va_start(args, format);
+	len = vsnprintf(r->message, sizeof(r->message), format, args);
+	va_end(args);
+	if (len >= (int) sizeof(r->message))
+		memcpy(r->message + sizeof(r->message) - 4, "...", 4);
+
+	// Publishes the record to the writer
+	g_atomic_int_set(&ring->tail, tail + 1);
+
+	if (g_atomic_int_compare_and_exchange(&log_writer_idle, TRUE, FALSE)) {
+		g_mutex_lock(&log_writer_mutex);
+		g_cond_signal(&log_writer_cond);
+		g_mutex_unlock(&log_writer_mutex);
+	}
+}
+
+// Returns FALSE once max is reached
+static gboolean variant_print_capped(GString *out, GVariant *value, gsize max)
+{
+	GVariantIter iter;
+	GVariant *child;
+	const char *open, *close;
+	gboolean first = TRUE;
+
+	if (out->len >= max)
+		return FALSE;
+
+	if (!g_variant_is_container(value)) {
+		g_variant_print_string(value, out, FALSE);
+		return out->len < max;
+	}
+
+	if (g_variant_is_of_type(value, G_VARIANT_TYPE_VARIANT)) {
+		gboolean ok;
+
+		child = g_variant_get_variant(value);
+		g_string_append_c(out, '<');
+		ok = variant_print_capped(out, child, max);
+		g_string_append_c(out, '>');
+		g_variant_unref(child);
+		return ok;
+	}
+
+	if (g_variant_is_of_type(value, G_VARIANT_TYPE_DICT_ENTRY)) {
+		open = "";
+		close = "";
+	} else if (g_variant_is_of_type(value, G_VARIANT_TYPE_TUPLE)) {
+		open = "(";
+		close = ")";
+	} else if (g_variant_is_of_type(value, G_VARIANT_TYPE_DICTIONARY)) {
+		open = "{";
+		close = "}";
+	} else {
+		open = "[";
+		close = "]";
+	}
+
+	g_string_append(out, open);
+	g_variant_iter_init(&iter, value);
+	while ((child = g_variant_iter_next_value(&iter))) {
+		gboolean ok;
+
+		if (!first)
+			g_string_append(out, g_variant_is_of_type(value, G_VARIANT_TYPE_DICT_ENTRY) ?
+					": " : ", ");
+		first = FALSE;
+		ok = variant_print_capped(out, child, max);
+		g_variant_unref(child);
+		if (!ok)
+			return FALSE;
+	}
+	g_string_append(out, close);
+
+	return out->len < max;
+}
+
+/*
+ * Print a GVariant in roughly g_variant_print() format, but stop once the
+ * text reaches max characters so large replies are cheap to log.
+ */
+gchar *connman_variant_print(GVariant *value, gsize max)
+{
+	GString *out;
+
+	if (!value)
+		return g_strdup("(null)");
+
+	out = g_string_sized_new(MIN(max, 256) + 4);
+	if (!variant_print_capped(out, value, max)) {
+		g_string_truncate(out, max);
+		g_string_append(out, "...");
+	}
+
+	return g_string_free(out, FALSE);
+}
@@ -0,0 +1,514 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "connman-glib.h"
+#include "common.h"
+#include "connman-call.h"
+#include "connman-metrics.h"
+#include "connman-trace.h"
+#include "connman-watchdog.h"
+
+/*
+ * Latencies are kept in log-linear histograms of microseconds: values
+ * below METRICS_SUB_BUCKETS get a bucket each, above that every power of
+ * two is split into METRICS_SUB_BUCKETS linear buckets, which bounds the
+ * relative error to 25%.
+ */
+#define METRICS_SUB_BITS	2
+#define METRICS_SUB_BUCKETS	(1 << METRICS_SUB_BITS)
+#define METRICS_MAX_BIT		40	/* ~12 days */
+#define METRICS_BUCKETS		((METRICS_MAX_BIT - METRICS_SUB_BITS + 2) * METRICS_SUB_BUCKETS)
+
+/* Error classes, the decoded NBError values followed by these */
+enum {
+	METRICS_ERROR_DBUS = CONNMAN_ERROR_TIMEOUT + 1,
+	METRICS_ERROR_CANCELLED,
+	METRICS_ERROR_OTHER,
+	METRICS_ERRORS
+};
+
+static const char *metrics_error_names[METRICS_ERRORS] = {
+	"BAD_TECHNOLOGY",
+	"BAD_SERVICE",
+	"OUT_OF_MEMORY",
+	"NO_TECHNOLOGIES",
+	"NO_SERVICES",
+	"BAD_PROPERTY",
+	"UNIMPLEMENTED",
+	"UNKNOWN_PROPERTY",
+	"UNKNOWN_TECHNOLOGY",
+	"UNKNOWN_SERVICE",
+	"MISSING_ARGUMENT",
+	"ILLEGAL_ARGUMENT",
+	"CALL_IN_PROGRESS",
+	"TIMEOUT",
+	"DBUS",
+	"CANCELLED",
+	"OTHER"
+};
+
+static const char *metrics_kind_names[CONNMAN_METRICS_KIND_MAX] = {
+	"call",
+	"signal",
+	"callback",
+	"dispatch"
+};
+
+struct metric {
+	connman_metrics_kind_t kind;
+	gchar *object;
+	gchar *member;
+	guint64 count;
+	guint64 sum_us;
+	guint64 max_us;
+	guint64 buckets[METRICS_BUCKETS];
+	guint64 errors[METRICS_ERRORS];
+};
+
+/*
+ * Each thread records into its own shard, so the only locking on the hot
+ * path is an uncontended mutex that a snapshot takes while merging.
+ */
+struct metrics_shard {
+	GMutex mutex;
+	GHashTable *metrics;	/* key -> struct metric */
+};
+
+static gint metrics_enabled;
+static GMutex metrics_mutex;
+static GSList *metrics_shards;
+static struct metrics_shard *metrics_retired;
+
+static void metrics_shard_retire(gpointer data);
+
+static GPrivate metrics_shard_key = G_PRIVATE_INIT(metrics_shard_retire);
+
+static void metric_free(gpointer data)
+{
+	struct metric *m = data;
+
+	g_free(m->object);
+	g_free(m->member);
+	g_free(m);
+}
+
+static struct metrics_shard *metrics_shard_new(void)
+{
+	struct metrics_shard *shard = g_malloc0(sizeof(*shard));
+
+	g_mutex_init(&shard->mutex);
+	shard->metrics = g_hash_table_new_full(g_str_hash, g_str_equal,
+					       g_free, metric_free);
+	return shard;
+}
+
+static void metric_merge(struct metric *dst, const struct metric *src)
+{
+	unsigned int i;
+
+	dst->count += src->count;
+	dst->sum_us += src->sum_us;
+	dst->max_us = MAX(dst->max_us, src->max_us);
+	for (i = 0; i < METRICS_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	for (i = 0; i < METRICS_ERRORS; i++)
+		dst->errors[i] += src->errors[i];
+}
+
+static void metrics_table_merge(GHashTable *dst, GHashTable *src)
+{
+	GHashTableIter iter;
+	gpointer key, val;
+
+	g_hash_table_iter_init(&iter, src);
+	while (g_hash_table_iter_next(&iter, &key, &val)) {
+		struct metric *m = val;
+		struct metric *d = g_hash_table_lookup(dst, key);
+
+		if (!d) {
+			d = g_malloc0(sizeof(*d));
+			d->kind = m->kind;
+			d->object = g_strdup(m->object);
+			d->member = g_strdup(m->member);
+			g_hash_table_insert(dst, g_strdup(key), d);
+		}
+		metric_merge(d, m);
+	}
+}
+
+// Fold the shard of an exiting thread into the retired totals
+static void metrics_shard_retire(gpointer data)
+{
+	struct metrics_shard *shard = data;
+
+	g_mutex_lock(&metrics_mutex);
+	metrics_shards = g_slist_remove(metrics_shards, shard);
+	if (!metrics_retired)
+		metrics_retired = metrics_shard_new();
+	metrics_table_merge(metrics_retired->metrics, shard->metrics);
+	g_mutex_unlock(&metrics_mutex);
+
+	g_hash_table_unref(shard->metrics);
+	g_mutex_clear(&shard->mutex);
+	g_free(shard);
+}
+
+static struct metrics_shard *metrics_shard_get(void)
+{
+	struct metrics_shard *shard = g_private_get(&metrics_shard_key);
+
+	if (G_LIKELY(shard))
+		return shard;
+
+	shard = metrics_shard_new();
+	g_private_set(&metrics_shard_key, shard);
+
+	g_mutex_lock(&metrics_mutex);
+	metrics_shards = g_slist_prepend(metrics_shards, shard);
+	g_mutex_unlock(&metrics_mutex);
+
+	return shard;
+}
+
+static guint bucket_index(guint64 v)
+{
+	guint msb;
+
+	if (v < METRICS_SUB_BUCKETS)
+		return v;
+
+	msb = 63 - __builtin_clzll(v);
+	if (msb > METRICS_MAX_BIT)
+		return METRICS_BUCKETS - 1;
+
+	return (msb - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS +
+		((v >> (msb - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1));
+}
+
+// Largest value, inclusive, that falls into a bucket
+static guint64 bucket_upper(guint i)
+{
+	guint msb, sub;
+
+	if (i < METRICS_SUB_BUCKETS)
+		return i;
+
+	msb = i / METRICS_SUB_BUCKETS + METRICS_SUB_BITS - 1;
+	sub = i % METRICS_SUB_BUCKETS;
+
+	return ((guint64) (METRICS_SUB_BUCKETS + sub + 1) << (msb - METRICS_SUB_BITS)) - 1;
+}
+
+/* ConnMan's own D-Bus errors, counted under the matching NBError */
+static const struct {
+	const char *name;
+	guint class;
+} metrics_remote_errors[] = {
+	{ "net.connman.Error.InvalidArguments",	CONNMAN_ERROR_ILLEGAL_ARGUMENT },
+	{ "net.connman.Error.InvalidProperty",	CONNMAN_ERROR_UNKNOWN_PROPERTY },
+	{ "net.connman.Error.InvalidService",	CONNMAN_ERROR_UNKNOWN_SERVICE },
+	{ "net.connman.Error.NotFound",		CONNMAN_ERROR_UNKNOWN_SERVICE },
+	{ "net.connman.Error.NotSupported",	CONNMAN_ERROR_UNIMPLEMENTED },
+	{ "net.connman.Error.NotImplemented",	CONNMAN_ERROR_UNIMPLEMENTED },
+	{ "net.connman.Error.InProgress",	CONNMAN_ERROR_CALL_IN_PROGRESS },
+	{ "net.connman.Error.OperationTimeout",	CONNMAN_ERROR_TIMEOUT },
+};
+
+static guint error_class(const GError *error)
+{
+	guint i;
+
+	if (error->domain == CONNMAN_ERROR &&
+	    error->code >= 0 && error->code <= CONNMAN_ERROR_TIMEOUT)
+		return error->code;
+	if (g_dbus_error_is_remote_error(error)) {
+		gchar *name = g_dbus_error_get_remote_error(error);
+		guint class = METRICS_ERROR_OTHER;
+
+		for (i = 0; i < G_N_ELEMENTS(metrics_remote_errors); i++) {
+			if (!g_strcmp0(name, metrics_remote_errors[i].name)) {
+				class = metrics_remote_errors[i].class;
+				break;
+			}
+		}
+		g_free(name);
+		if (class != METRICS_ERROR_OTHER)
+			return class;
+	}
+	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT))
+		return CONNMAN_ERROR_TIMEOUT;
+	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		return METRICS_ERROR_CANCELLED;
+	if (error->domain == G_DBUS_ERROR)
+		return METRICS_ERROR_DBUS;
+	return METRICS_ERROR_OTHER;
+}
+
+EXPORT void connman_metrics_enable(gboolean enable)
+{
+	g_atomic_int_set(&metrics_enabled, enable);
+	// The heartbeat also feeds the dispatch lag metrics
+	connman_watchdog_update();
+}
+
+gboolean connman_metrics_enabled(void)
+{
+	return g_atomic_int_get(&metrics_enabled);
+}
+
+gint64 connman_metrics_start(void)
+{
+	if (!g_atomic_int_get(&metrics_enabled) && !connman_trace_enabled())
+		return 0;
+
+	return g_get_monotonic_time();
+}
+
+void connman_metrics_record(connman_metrics_kind_t kind,
+			    const char *object,
+			    const char *member,
+			    gint64 start,
+			    const GError *error)
+{
+	struct metrics_shard *shard;
+	struct metric *m;
+	gchar key[256];
+	guint64 duration;
+
+	if (!start)
+		return;
+
+	connman_trace_span(metrics_kind_names[kind], member, object, start,
+			   error != NULL);
+
+	if (!g_atomic_int_get(&metrics_enabled))
+		return;
+
+	duration = MAX(g_get_monotonic_time() - start, 0);
+
+	g_snprintf(key, sizeof(key), "%d %s %s",
+		   kind, object ? object : "", member ? member : "");
+
+	shard = metrics_shard_get();
+	g_mutex_lock(&shard->mutex);
+
+	m = g_hash_table_lookup(shard->metrics, key);
+	if (G_UNLIKELY(!m)) {
+		m = g_malloc0(sizeof(*m));
+		m->kind = kind;
+		m->object = g_strdup(object ? object : "");
+		m->member = g_strdup(member ? member : "");
+		g_hash_table_insert(shard->metrics, g_strdup(key), m);
+	}
+
+	m->count++;
+	m->sum_us += duration;
+	m->max_us = MAX(m->max_us, duration);
+	m->buckets[bucket_index(duration)]++;
+	if (error)
+		m->errors[error_class(error)]++;
+
+	g_mutex_unlock(&shard->mutex);
+}
+
+// Merge every shard into one table
+static GHashTable *metrics_collect(void)
+{
+	GHashTable *table;
+	GSList *list;
+
+	table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, metric_free);
+
+	g_mutex_lock(&metrics_mutex);
+	if (metrics_retired)
+		metrics_table_merge(table, metrics_retired->metrics);
+	for (list = metrics_shards; list; list = g_slist_next(list)) {
+		struct metrics_shard *shard = list->data;
+
+		g_mutex_lock(&shard->mutex);
+		metrics_table_merge(table, shard->metrics);
+		g_mutex_unlock(&shard->mutex);
+	}
+	g_mutex_unlock(&metrics_mutex);
+
+	return table;
+}
+
+static gint metric_compare(gconstpointer a, gconstpointer b)
+{
+	const struct metric *ma = *(struct metric * const *) a;
+	const struct metric *mb = *(struct metric * const *) b;
+	gint rc;
+
+	if (ma->kind != mb->kind)
+		return ma->kind < mb->kind ? -1 : 1;
+	rc = g_strcmp0(ma->object, mb->object);
+	return rc ? rc : g_strcmp0(ma->member, mb->member);
+}
+
+// Returns the metrics of a table sorted by kind, object and member
+static GPtrArray *metrics_sorted(GHashTable *table)
+{
+	GPtrArray *array = g_ptr_array_sized_new(g_hash_table_size(table));
+	GHashTableIter iter;
+	gpointer val;
+
+	g_hash_table_iter_init(&iter, table);
+	while (g_hash_table_iter_next(&iter, NULL, &val))
+		g_ptr_array_add(array, val);
+	g_ptr_array_sort(array, metric_compare);
+
+	return array;
+}
+
+/*
+ * Returns an a(sssttta(tt)a{st}) with one entry per metric: kind ("call",
+ * "signal", "callback" or "dispatch"), object, member, count, sum and max of the
+ * durations in microseconds, the non-empty histogram buckets as (inclusive
+ * upper bound in microseconds, count), and the error counts by class.
+ */
+EXPORT GVariant *connman_metrics_snapshot(void)
+{
+	GHashTable *table = metrics_collect();
+	GPtrArray *array = metrics_sorted(table);
+	GVariantBuilder builder;
+	unsigned int i, j;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(sssttta(tt)a{st})"));
+	for (i = 0; i < array->len; i++) {
+		struct metric *m = g_ptr_array_index(array, i);
+		GVariantBuilder buckets, errors;
+
+		g_variant_builder_init(&buckets, G_VARIANT_TYPE("a(tt)"));
+		for (j = 0; j < METRICS_BUCKETS; j++) {
+			if (m->buckets[j])
+				g_variant_builder_add(&buckets, "(tt)",
+						      bucket_upper(j), m->buckets[j]);
+		}
+
+		g_variant_builder_init(&errors, G_VARIANT_TYPE("a{st}"));
+		for (j = 0; j < METRICS_ERRORS; j++) {
+			if (m->errors[j])
+				g_variant_builder_add(&errors, "{st}",
+						      metrics_error_names[j], m->errors[j]);
+		}
+
+		g_variant_builder_add(&builder, "(sssttta(tt)a{st})",
+				      metrics_kind_names[m->kind],
+				      m->object,
+				      m->member,
+				      m->count,
+				      m->sum_us,
+				      m->max_us,
+				      &buckets,
+				      &errors);
+	}
+
+	g_ptr_array_free(array, TRUE);
+	g_hash_table_unref(table);
+
+	return g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
+static void openmetrics_histograms(GString *out, GPtrArray *array,
+				   connman_metrics_kind_t kind)
+{
+	const char *name = metrics_kind_names[kind];
+	gboolean header = FALSE;
+	unsigned int i, j;
+
+	for (i = 0; i < array->len; i++) {
+		struct metric *m = g_ptr_array_index(array, i);
+		guint64 cumulative = 0;
+
+		if (m->kind != kind)
+			continue;
+
+		if (!header) {
+			g_string_append_printf(out,
+					       "# TYPE connman_glib_%s_duration_seconds histogram\n"
+					       "# UNIT connman_glib_%s_duration_seconds seconds\n",
+					       name, name);
+			header = TRUE;
+		}
+
+		for (j = 0; j < METRICS_BUCKETS; j++) {
+			if (!m->buckets[j])
+				continue;
+			cumulative += m->buckets[j];
+			g_string_append_printf(out,
+					       "connman_glib_%s_duration_seconds_bucket"
+					       "{object=\"%s\",member=\"%s\",le=\"%.6f\"} %" G_GUINT64_FORMAT "\n",
+					       name, m->object, m->member,
+					       bucket_upper(j) / 1e6, cumulative);
+		}
+		g_string_append_printf(out,
+				       "connman_glib_%s_duration_seconds_bucket"
+				       "{object=\"%s\",member=\"%s\",le=\"+Inf\"} %" G_GUINT64_FORMAT "\n"
+				       "connman_glib_%s_duration_seconds_count"
+				       "{object=\"%s\",member=\"%s\"} %" G_GUINT64_FORMAT "\n"
+				       "connman_glib_%s_duration_seconds_sum"
+				       "{object=\"%s\",member=\"%s\"} %.6f\n",
+				       name, m->object, m->member, m->count,
+				       name, m->object, m->member, m->count,
+				       name, m->object, m->member, m->sum_us / 1e6);
+	}
+
+	header = FALSE;
+	for (i = 0; i < array->len; i++) {
+		struct metric *m = g_ptr_array_index(array, i);
+
+		if (m->kind != kind)
+			continue;
+
+		for (j = 0; j < METRICS_ERRORS; j++) {
+			if (!m->errors[j])
+				continue;
+			if (!header) {
+				g_string_append_printf(out,
+						       "# TYPE connman_glib_%s_errors counter\n",
+						       name);
+				header = TRUE;
+			}
+			g_string_append_printf(out,
+					       "connman_glib_%s_errors_total"
+					       "{object=\"%s\",member=\"%s\",error=\"%s\"} %" G_GUINT64_FORMAT "\n",
+					       name, m->object, m->member,
+					       metrics_error_names[j], m->errors[j]);
+		}
+	}
+}
+
+// Returns the metrics in OpenMetrics text format, free with g_free()
+EXPORT gchar *connman_metrics_openmetrics(void)
+{
+	GHashTable *table = metrics_collect();
+	GPtrArray *array = metrics_sorted(table);
+	GString *out = g_string_new(NULL);
+	int kind;
+
+	for (kind = 0; kind < CONNMAN_METRICS_KIND_MAX; kind++)
+		openmetrics_histograms(out, array, kind);
+	g_string_append(out, "# EOF\n");
+
+	g_ptr_array_free(array, TRUE);
+	g_hash_table_unref(table);
+
+	return g_string_free(out, FALSE);
+}
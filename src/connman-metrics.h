@@ -0,0 +1,46 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONNMAN_METRICS_H
+#define CONNMAN_METRICS_H
+
+#include <glib.h>
+
+typedef enum {
+	CONNMAN_METRICS_CALL,		/* D-Bus method round trip */
+	CONNMAN_METRICS_SIGNAL,		/* D-Bus signal handler */
+	CONNMAN_METRICS_CALLBACK,	/* user callback invocation */
+	CONNMAN_METRICS_DISPATCH,	/* handler main loop dispatch lag */
+	CONNMAN_METRICS_KIND_MAX
+} connman_metrics_kind_t;
+
+/*
+ * Returns the start timestamp of a measurement, or 0 when neither metrics
+ * nor the trace timeline are enabled, in which case
+ * connman_metrics_record() does nothing.  Recorded measurements also go
+ * to the timeline as spans.
+ */
+gint64 connman_metrics_start(void);
+
+gboolean connman_metrics_enabled(void);
+
+void connman_metrics_record(connman_metrics_kind_t kind,
+			    const char *object,
+			    const char *member,
+			    gint64 start,
+			    const GError *error);
+
+#endif /* CONNMAN_METRICS_H */
@@ -0,0 +1,490 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "common.h"
+#include "connman-call.h"
+#include "connman-policy.h"
+
+/*
+ * Optional auto-connect policy.  The engine keeps its own view of the
+ * services, updated from the same signals as the cache, with a score per
+ * service and the best candidate so far; the candidate only needs to be
+ * looked for again when the best one gets worse or goes away.  Updates
+ * schedule one evaluation on the handler loop, which connects the best
+ * candidate when nothing is connected or when it beats the current
+ * default service by the hysteresis, or moves it ahead of the default if
+ * it is already connected.
+ */
+
+#define POLICY_TIER_FAVORITE	10000
+#define POLICY_TIER_TYPE	1000
+
+struct policy_service {
+	gchar *name;
+	gchar *type;
+	gchar *state;
+	gboolean favorite;
+	guint strength;
+	gint score;		/* -1 when not a candidate */
+};
+
+static GMutex policy_mutex;
+static gint policy_enabled;	/* atomic */
+static connman_policy_t policy;
+static struct connman_state *policy_ns;
+static GHashTable *policy_services;	/* name -> struct policy_service */
+static struct policy_service *policy_best;
+static gchar *policy_default;	/* first connected service in ConnMan's order */
+static gboolean policy_busy;	/* a connect or move is in flight */
+static gint64 policy_last_action;
+static GSource *policy_eval;
+
+static gboolean state_connected(const gchar *state)
+{
+	return !g_strcmp0(state, "ready") || !g_strcmp0(state, "online");
+}
+
+static gboolean state_connecting(const gchar *state)
+{
+	return !g_strcmp0(state, "association") || !g_strcmp0(state, "configuration");
+}
+
+static void policy_service_free(gpointer data)
+{
+	struct policy_service *svc = data;
+
+	g_free(svc->name);
+	g_free(svc->type);
+	g_free(svc->state);
+	g_free(svc);
+}
+
+static gint policy_score(const struct policy_service *svc)
+{
+	gint score = svc->strength;
+	guint i;
+
+	if (policy.blacklist && g_strv_contains((const gchar * const *) policy.blacklist,
+						svc->name))
+		return -1;
+	if (svc->strength < policy.min_strength || !g_strcmp0(svc->state, "failure"))
+		return -1;
+
+	if (policy.favorites_first && svc->favorite)
+		score += POLICY_TIER_FAVORITE;
+	for (i = 0; policy.type_order && policy.type_order[i]; i++) {
+		if (!g_strcmp0(policy.type_order[i], svc->type)) {
+			score += POLICY_TIER_TYPE * (g_strv_length(policy.type_order) - i);
+			break;
+		}
+	}
+
+	return score;
+}
+
+/* Called with the policy lock held */
+static void policy_find_best_unlocked(void)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	policy_best = NULL;
+	g_hash_table_iter_init(&iter, policy_services);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct policy_service *svc = value;
+
+		if (svc->score >= 0 && (!policy_best || svc->score > policy_best->score))
+			policy_best = svc;
+	}
+}
+
+static gboolean policy_eval_cb(gpointer user_data);
+
+/* Called with the policy lock held */
+static void policy_schedule_unlocked(guint delay_ms)
+{
+	if (policy_eval)
+		return;
+
+	policy_eval = delay_ms ? g_timeout_source_new(delay_ms) : g_idle_source_new();
+	g_source_set_callback(policy_eval, policy_eval_cb, NULL, NULL);
+	g_source_attach(policy_eval, NULL);
+}
+
+/* Called with the policy lock held */
+static void policy_rescore_unlocked(struct policy_service *svc)
+{
+	gint old = svc->score;
+
+	svc->score = policy_score(svc);
+	if (svc->score >= 0 && (!policy_best || svc->score > policy_best->score))
+		policy_best = svc;
+	else if (svc == policy_best && svc->score < old)
+		policy_find_best_unlocked();
+
+	policy_schedule_unlocked(0);
+}
+
+/* Called with the policy lock held */
+static struct policy_service *policy_lookup_unlocked(const gchar *service)
+{
+	struct policy_service *svc = g_hash_table_lookup(policy_services, service);
+
+	if (!svc) {
+		svc = g_new0(struct policy_service, 1);
+		svc->name = g_strdup(service);
+		svc->strength = 100;	/* no Strength for wired services */
+		svc->score = -1;
+		g_hash_table_insert(policy_services, svc->name, svc);
+	}
+
+	return svc;
+}
+
+/* Called with the policy lock held; TRUE if something that matters changed */
+static gboolean policy_set_unlocked(struct policy_service *svc,
+				    const gchar *name,
+				    GVariant *value)
+{
+	if (!g_strcmp0(name, "Strength") && g_variant_is_of_type(value, G_VARIANT_TYPE_BYTE)) {
+		svc->strength = g_variant_get_byte(value);
+	} else if (!g_strcmp0(name, "Favorite") &&
+		   g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)) {
+		svc->favorite = g_variant_get_boolean(value);
+	} else if (!g_strcmp0(name, "State") &&
+		   g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+		g_free(svc->state);
+		svc->state = g_variant_dup_string(value, NULL);
+	} else if (!g_strcmp0(name, "Type") &&
+		   g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+		g_free(svc->type);
+		svc->type = g_variant_dup_string(value, NULL);
+	} else {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Called with the policy lock held */
+static struct policy_service *policy_update_unlocked(const gchar *service,
+						     GVariant *properties)
+{
+	struct policy_service *svc = policy_lookup_unlocked(service);
+	gboolean changed = FALSE;
+	GVariantIter iter;
+	const gchar *key;
+	GVariant *val;
+
+	g_variant_iter_init(&iter, properties);
+	while (g_variant_iter_next(&iter, "{&sv}", &key, &val)) {
+		changed |= policy_set_unlocked(svc, key, val);
+		g_variant_unref(val);
+	}
+	if (changed)
+		policy_rescore_unlocked(svc);
+
+	return svc;
+}
+
+/* Called with the policy lock held */
+static void policy_remove_unlocked(const gchar *service)
+{
+	struct policy_service *svc = g_hash_table_lookup(policy_services, service);
+
+	if (!svc)
+		return;
+
+	if (!g_strcmp0(policy_default, service))
+		g_clear_pointer(&policy_default, g_free);
+	g_hash_table_remove(policy_services, service);
+	if (svc == policy_best) {
+		policy_find_best_unlocked();
+		policy_schedule_unlocked(0);
+	}
+}
+
+gboolean connman_policy_active(void)
+{
+	return g_atomic_int_get(&policy_enabled);
+}
+
+void connman_policy_services_changed(GVariant *parameters)
+{
+	GVariant *changed, *properties;
+	GVariantIter iter;
+	const gchar *path;
+	gboolean found_default = FALSE;
+
+	if (!g_atomic_int_get(&policy_enabled))
+		return;
+
+	g_mutex_lock(&policy_mutex);
+	if (!policy_services) {
+		g_mutex_unlock(&policy_mutex);
+		return;
+	}
+
+	changed = g_variant_get_child_value(parameters, 0);
+	g_variant_iter_init(&iter, changed);
+	while (g_variant_iter_next(&iter, "(&o@a{sv})", &path, &properties)) {
+		const gchar *service = connman_strip_path(path);
+		struct policy_service *svc;
+
+		if (service) {
+			svc = policy_update_unlocked(service, properties);
+			// ConnMan lists services in order, the default first
+			if (!found_default && state_connected(svc->state)) {
+				found_default = TRUE;
+				if (g_strcmp0(policy_default, service)) {
+					g_free(policy_default);
+					policy_default = g_strdup(service);
+					policy_schedule_unlocked(0);
+				}
+			}
+		}
+		g_variant_unref(properties);
+	}
+	g_variant_unref(changed);
+	if (!found_default)
+		g_clear_pointer(&policy_default, g_free);
+
+	if (g_variant_n_children(parameters) > 1) {
+		GVariant *removed = g_variant_get_child_value(parameters, 1);
+
+		g_variant_iter_init(&iter, removed);
+		while (g_variant_iter_next(&iter, "&o", &path)) {
+			const gchar *service = connman_strip_path(path);
+
+			if (service)
+				policy_remove_unlocked(service);
+		}
+		g_variant_unref(removed);
+	}
+	g_mutex_unlock(&policy_mutex);
+}
+
+void connman_policy_service_update(const gchar *service, GVariant *properties)
+{
+	if (!g_atomic_int_get(&policy_enabled))
+		return;
+
+	g_mutex_lock(&policy_mutex);
+	if (policy_services && properties)
+		policy_update_unlocked(service, properties);
+	g_mutex_unlock(&policy_mutex);
+}
+
+void connman_policy_service_property(const gchar *service,
+				     const gchar *name,
+				     GVariant *value)
+{
+	struct policy_service *svc;
+
+	if (!g_atomic_int_get(&policy_enabled))
+		return;
+
+	g_mutex_lock(&policy_mutex);
+	svc = policy_services ? g_hash_table_lookup(policy_services, service) : NULL;
+	if (svc && policy_set_unlocked(svc, name, value))
+		policy_rescore_unlocked(svc);
+	g_mutex_unlock(&policy_mutex);
+}
+
+void connman_policy_service_remove(const gchar *service)
+{
+	if (!g_atomic_int_get(&policy_enabled))
+		return;
+
+	g_mutex_lock(&policy_mutex);
+	if (policy_services)
+		policy_remove_unlocked(service);
+	g_mutex_unlock(&policy_mutex);
+}
+
+static void policy_done(void)
+{
+	g_mutex_lock(&policy_mutex);
+	policy_busy = FALSE;
+	if (policy_services)
+		policy_schedule_unlocked(0);
+	g_mutex_unlock(&policy_mutex);
+}
+
+static void policy_connect_cb(const gchar *service,
+			      gboolean status,
+			      const char *error,
+			      gpointer user_data)
+{
+	if (!status)
+		WARNING("Policy connect to %s failed: %s", service, error);
+	policy_done();
+}
+
+static void policy_move_cb(void *user_data, GVariant *result, GError **error)
+{
+	if (result)
+		g_variant_unref(result);
+	else
+		WARNING("Policy move failed: %s",
+			error && *error ? (*error)->message : "unspecified");
+	policy_done();
+}
+
+static gboolean policy_eval_cb(gpointer user_data)
+{
+	struct policy_service *best, *current = NULL;
+	gchar *connect = NULL, *move = NULL, *target = NULL;
+	GError *error = NULL;
+	gint64 now = g_get_monotonic_time();
+	gint64 holdoff;
+
+	g_mutex_lock(&policy_mutex);
+	if (g_source_is_destroyed(g_main_current_source())) {
+		/* disabled while being dispatched */
+		g_mutex_unlock(&policy_mutex);
+		return G_SOURCE_REMOVE;
+	}
+	g_source_unref(policy_eval);
+	policy_eval = NULL;
+	if (!policy_services || policy_busy)
+		goto out;
+
+	holdoff = policy_last_action + policy.holdoff_ms * 1000LL - now;
+	if (holdoff > 0) {
+		policy_schedule_unlocked(holdoff / 1000 + 1);
+		goto out;
+	}
+
+	best = policy_best;
+	if (!best || best->score < 0 || state_connecting(best->state))
+		goto out;
+	if (policy_default)
+		current = g_hash_table_lookup(policy_services, policy_default);
+
+	if (!current) {
+		if (!state_connected(best->state))
+			connect = g_strdup(best->name);
+	} else if (best != current &&
+		   best->score > current->score + (gint) policy.hysteresis) {
+		if (state_connected(best->state)) {
+			move = g_strdup(best->name);
+			target = g_strdup(current->name);
+		} else {
+			connect = g_strdup(best->name);
+		}
+	}
+
+	if (connect || move) {
+		policy_busy = TRUE;
+		policy_last_action = now;
+	}
+out:
+	g_mutex_unlock(&policy_mutex);
+
+	if (connect) {
+		INFO("Policy connecting %s", connect);
+		if (!connman_service_connect(connect, policy_connect_cb, NULL))
+			policy_done();
+	} else if (move) {
+		INFO("Policy moving %s before %s", move, target);
+		if (!connman_call_async(policy_ns, CONNMAN_AT_SERVICE, move, "MoveBefore",
+					g_variant_new("(o)", CONNMAN_SERVICE_PATH(target)),
+					CONNMAN_DEADLINE_DEFAULT, &error,
+					policy_move_cb, NULL)) {
+			WARNING("Policy move failed: %s", error->message);
+			g_error_free(error);
+			policy_done();
+		}
+	}
+	g_free(connect);
+	g_free(move);
+	g_free(target);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Called with the policy lock held */
+static void policy_clear_unlocked(void)
+{
+	g_atomic_int_set(&policy_enabled, FALSE);
+	if (policy_eval) {
+		g_source_destroy(policy_eval);
+		g_source_unref(policy_eval);
+		policy_eval = NULL;
+	}
+	if (policy_services) {
+		g_hash_table_destroy(policy_services);
+		policy_services = NULL;
+	}
+	policy_best = NULL;
+	g_clear_pointer(&policy_default, g_free);
+	g_strfreev((gchar **) policy.type_order);
+	g_strfreev((gchar **) policy.blacklist);
+	memset(&policy, 0, sizeof(policy));
+}
+
+/*
+ * Starts the engine with a copy of the policy, seeded from GetServices,
+ * or stops it if policy is NULL.
+ */
+gboolean connman_policy_enable_internal(struct connman_state *ns,
+					const connman_policy_t *new_policy)
+{
+	GVariant *services;
+	GError *error = NULL;
+
+	g_mutex_lock(&policy_mutex);
+	policy_clear_unlocked();
+	g_mutex_unlock(&policy_mutex);
+	if (!new_policy)
+		return TRUE;
+
+	services = connman_get_properties(ns, CONNMAN_AT_SERVICE, NULL,
+					  CONNMAN_DEADLINE_DEFAULT, &error);
+	if (!services) {
+		ERROR("Cannot get the services for the policy: %s",
+		      error ? error->message : "unspecified");
+		g_clear_error(&error);
+		return FALSE;
+	}
+
+	g_mutex_lock(&policy_mutex);
+	policy = *new_policy;
+	policy.type_order = (const gchar **) g_strdupv((gchar **) new_policy->type_order);
+	policy.blacklist = (const gchar **) g_strdupv((gchar **) new_policy->blacklist);
+	policy_ns = ns;
+	policy_services = g_hash_table_new_full(g_str_hash, g_str_equal,
+						NULL, policy_service_free);
+	g_atomic_int_set(&policy_enabled, TRUE);
+	g_mutex_unlock(&policy_mutex);
+
+	connman_policy_services_changed(services);
+	g_variant_unref(services);
+
+	return TRUE;
+}
+
+EXPORT void connman_policy_disable(void)
+{
+	g_mutex_lock(&policy_mutex);
+	policy_clear_unlocked();
+	g_mutex_unlock(&policy_mutex);
+}
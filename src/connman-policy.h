@@ -0,0 +1,42 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONNMAN_POLICY_H
+#define CONNMAN_POLICY_H
+
+#include <glib.h>
+
+#include "connman-glib.h"
+
+struct connman_state;
+
+gboolean connman_policy_enable_internal(struct connman_state *ns,
+					const connman_policy_t *policy);
+
+gboolean connman_policy_active(void);
+
+// ServicesChanged, or a GetServices reply, as (a(oa{sv})...)
+void connman_policy_services_changed(GVariant *parameters);
+
+void connman_policy_service_update(const gchar *service, GVariant *properties);
+
+void connman_policy_service_property(const gchar *service,
+				     const gchar *name,
+				     GVariant *value);
+
+void connman_policy_service_remove(const gchar *service);
+
+#endif /* CONNMAN_POLICY_H */
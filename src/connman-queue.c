@@ -0,0 +1,271 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "common.h"
+#include "connman-call.h"
+#include "connman-queue.h"
+
+/*
+ * Write-behind queue for property changes made while ConnMan is not on
+ * the bus.  Property writes are idempotent, so only the last value per
+ * object and property is kept, and the queue is flushed in arrival order
+ * once ConnMan appears.  A timer on the default context drops writes as
+ * their deadlines pass, and flushed writes keep their deadline.
+ */
+
+struct queued_write {
+	gchar *key;
+	gchar *access_type;
+	gchar *type_arg;
+	gchar *name;
+	GVariant *value;
+	gint64 deadline;
+};
+
+static GMutex queue_mutex;
+static guint queue_max;			/* 0 when disabled */
+static guint queue_deadline_ms;
+static GHashTable *queue_table;		/* key -> struct queued_write */
+static GQueue queue_order = G_QUEUE_INIT;
+static GSource *queue_timer;		/* fires at the earliest deadline */
+
+static void queued_write_free(struct queued_write *qw)
+{
+	g_free(qw->key);
+	g_free(qw->access_type);
+	g_free(qw->type_arg);
+	g_free(qw->name);
+	g_variant_unref(qw->value);
+	g_free(qw);
+}
+
+static void queue_remove_unlocked(struct queued_write *qw)
+{
+	g_queue_remove(&queue_order, qw);
+	g_hash_table_remove(queue_table, qw->key);
+	queued_write_free(qw);
+}
+
+static void queue_expire_unlocked(gint64 now)
+{
+	GList *list = queue_order.head;
+
+	while (list) {
+		struct queued_write *qw = list->data;
+
+		list = g_list_next(list);
+		if (qw->deadline > now)
+			continue;
+
+		WARNING("dropping expired %s%s%s %s write",
+			qw->access_type,
+			qw->type_arg ? "/" : "",
+			qw->type_arg ? qw->type_arg : "",
+			qw->name);
+		queue_remove_unlocked(qw);
+	}
+}
+
+static gboolean queue_timer_cb(gpointer user_data);
+
+// Called with the queue lock held, after the queue changed
+static void queue_arm_unlocked(void)
+{
+	gint64 earliest = G_MAXINT64;
+	gint64 delay;
+	GList *list;
+
+	if (queue_timer) {
+		g_source_destroy(queue_timer);
+		g_source_unref(queue_timer);
+		queue_timer = NULL;
+	}
+
+	for (list = queue_order.head; list; list = g_list_next(list)) {
+		struct queued_write *qw = list->data;
+
+		earliest = MIN(earliest, qw->deadline);
+	}
+	if (earliest == G_MAXINT64)
+		return;
+
+	delay = (earliest - g_get_monotonic_time()) / G_TIME_SPAN_MILLISECOND + 1;
+	queue_timer = g_timeout_source_new(CLAMP(delay, 0, G_MAXUINT));
+	g_source_set_callback(queue_timer, queue_timer_cb, NULL, NULL);
+	g_source_attach(queue_timer, NULL);
+}
+
+static gboolean queue_timer_cb(gpointer user_data)
+{
+	g_mutex_lock(&queue_mutex);
+	// Rearmed or stopped while being dispatched
+	if (g_source_is_destroyed(g_main_current_source())) {
+		g_mutex_unlock(&queue_mutex);
+		return G_SOURCE_REMOVE;
+	}
+	queue_expire_unlocked(g_get_monotonic_time());
+	queue_arm_unlocked();
+	g_mutex_unlock(&queue_mutex);
+
+	return G_SOURCE_REMOVE;
+}
+
+EXPORT void connman_set_request_buffering(guint max_requests, guint deadline_ms)
+{
+	g_mutex_lock(&queue_mutex);
+	if (!queue_table)
+		queue_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	queue_max = max_requests;
+	queue_deadline_ms = deadline_ms;
+
+	// Disabling drops anything still waiting
+	if (!queue_max) {
+		while (queue_order.head)
+			queue_remove_unlocked(queue_order.head->data);
+		queue_arm_unlocked();
+	}
+	g_mutex_unlock(&queue_mutex);
+}
+
+gboolean connman_queue_enabled(void)
+{
+	gboolean enabled;
+
+	g_mutex_lock(&queue_mutex);
+	enabled = queue_max > 0;
+	g_mutex_unlock(&queue_mutex);
+
+	return enabled;
+}
+
+gboolean connman_queue_set_property(const char *access_type,
+				    const char *type_arg,
+				    const char *name,
+				    GVariant *value,
+				    GError **error)
+{
+	struct queued_write *qw;
+	gint64 now = g_get_monotonic_time();
+	gchar *key;
+
+	if (!(access_type && name && value))
+		return FALSE;
+
+	key = g_strdup_printf("%s/%s/%s", access_type, type_arg ? type_arg : "", name);
+
+	g_mutex_lock(&queue_mutex);
+	if (!queue_max) {
+		g_mutex_unlock(&queue_mutex);
+		g_free(key);
+		g_set_error(error, CONNMAN_ERROR, CONNMAN_ERROR_ILLEGAL_ARGUMENT,
+			    "request buffering disabled");
+		return FALSE;
+	}
+
+	queue_expire_unlocked(now);
+
+	// Last write wins, but keeps its original place in the queue
+	qw = g_hash_table_lookup(queue_table, key);
+	if (qw) {
+		g_free(key);
+		g_variant_unref(qw->value);
+	} else {
+		if (g_queue_get_length(&queue_order) >= queue_max) {
+			g_mutex_unlock(&queue_mutex);
+			g_free(key);
+			g_set_error(error, CONNMAN_ERROR, CONNMAN_ERROR_OUT_OF_MEMORY,
+				    "request queue full");
+			return FALSE;
+		}
+
+		qw = g_malloc0(sizeof(*qw));
+		qw->key = key;
+		qw->access_type = g_strdup(access_type);
+		qw->type_arg = g_strdup(type_arg);
+		qw->name = g_strdup(name);
+		g_hash_table_insert(queue_table, qw->key, qw);
+		g_queue_push_tail(&queue_order, qw);
+	}
+	qw->value = g_variant_ref_sink(value);
+	qw->deadline = now + (gint64) queue_deadline_ms * G_TIME_SPAN_MILLISECOND;
+
+	INFO("queued %s%s%s %s write until ConnMan is available",
+	     access_type,
+	     type_arg ? "/" : "",
+	     type_arg ? type_arg : "",
+	     name);
+
+	queue_arm_unlocked();
+	g_mutex_unlock(&queue_mutex);
+
+	return TRUE;
+}
+
+static void flush_callback(void *user_data, GVariant *result, GError **error)
+{
+	gchar *key = user_data;
+
+	if (!result)
+		ERROR("buffered write %s failed: %s",
+		      key, error && *error ? (*error)->message : "unspecified");
+	else
+		g_variant_unref(result);
+
+	g_free(key);
+}
+
+// Send everything that has not expired, called when ConnMan appears
+void connman_queue_flush(struct connman_state *ns)
+{
+	struct queued_write *qw;
+
+	g_mutex_lock(&queue_mutex);
+	if (!queue_table) {
+		g_mutex_unlock(&queue_mutex);
+		return;
+	}
+
+	queue_expire_unlocked(g_get_monotonic_time());
+
+	while ((qw = g_queue_pop_head(&queue_order))) {
+		struct connman_pending_work *cpw;
+		GError *error = NULL;
+		gchar *key = g_strdup(qw->key);
+
+		g_hash_table_remove(queue_table, qw->key);
+
+		DEBUG("flushing buffered write %s", key);
+		cpw = connman_call_async(ns, qw->access_type, qw->type_arg,
+					 "SetProperty",
+					 g_variant_new("(sv)", qw->name, qw->value),
+					 qw->deadline,
+					 &error,
+					 flush_callback, key);
+		if (!cpw) {
+			ERROR("buffered write %s failed: %s",
+			      key, error ? error->message : "unspecified");
+			g_clear_error(&error);
+			g_free(key);
+		}
+		queued_write_free(qw);
+	}
+	queue_arm_unlocked();
+	g_mutex_unlock(&queue_mutex);
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONNMAN_QUEUE_H
+#define CONNMAN_QUEUE_H
+
+#include <glib.h>
+
+struct connman_state;
+
+gboolean connman_queue_enabled(void);
+
+gboolean connman_queue_set_property(const char *access_type,
+				    const char *type_arg,
+				    const char *name,
+				    GVariant *value,
+				    GError **error);
+
+void connman_queue_flush(struct connman_state *ns);
+
+#endif /* CONNMAN_QUEUE_H */
@@ -0,0 +1,312 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "connman-glib.h"
+#include "common.h"
+#include "connman-call.h"
+#include "connman-retry.h"
+
+/*
+ * Connect retries.  A failed attempt is classified from the service Error
+ * property when ConnMan set one, else from the call error; transient ones
+ * start the next attempt from a timer on the default context after an
+ * exponential backoff with jitter.  The caller's callback only sees the
+ * final outcome.  Retries are tracked per service from the first attempt
+ * to the final outcome, so a disconnect or the library shutting down can
+ * cancel them; a pending backoff is then cut short and an attempt in
+ * flight is not followed by another one.
+ */
+
+#define RETRY_INITIAL_DELAY_MS	1000
+#define RETRY_MAX_DELAY_MS	30000
+
+struct connman_retry {
+	struct connman_state *ns;
+	gchar *service;
+	connman_retry_policy_t policy;
+	connman_service_connect_cb_t cb;
+	gpointer user_data;
+	guint attempt;		/* attempts started so far */
+	GSource *timer;		/* backoff or cancellation pending */
+	gboolean cancelled;
+};
+
+static GMutex retry_mutex;
+static GHashTable *retry_table;		/* service -> struct connman_retry */
+
+/* Service Error values that another attempt can get past */
+static const gchar *retry_service_errors[] = {
+	"out-of-range",
+	"connect-failed",
+	"dhcp-failed",
+	"online-check-failed",
+	NULL
+};
+
+/* net.connman.Error names worth another attempt */
+static const gchar *retry_remote_errors[] = {
+	"net.connman.Error.Failed",
+	"net.connman.Error.InProgress",
+	"net.connman.Error.OperationAborted",
+	"net.connman.Error.OperationTimeout",
+	"net.connman.Error.NoCarrier",
+	"net.connman.Error.Aborted",
+	NULL
+};
+
+// NULL if retries for the service are already under way
+struct connman_retry *connman_retry_new(struct connman_state *ns,
+					const gchar *service,
+					const connman_retry_policy_t *policy,
+					connman_service_connect_cb_t cb,
+					gpointer user_data)
+{
+	struct connman_retry *retry;
+
+	g_mutex_lock(&retry_mutex);
+	if (!retry_table)
+		retry_table = g_hash_table_new(g_str_hash, g_str_equal);
+	if (g_hash_table_contains(retry_table, service)) {
+		g_mutex_unlock(&retry_mutex);
+		return NULL;
+	}
+
+	retry = g_new0(struct connman_retry, 1);
+	retry->ns = ns;
+	retry->service = g_strdup(service);
+	retry->policy = *policy;
+	if (!retry->policy.max_attempts)
+		retry->policy.max_attempts = 1;
+	if (!retry->policy.initial_delay_ms)
+		retry->policy.initial_delay_ms = RETRY_INITIAL_DELAY_MS;
+	if (!retry->policy.max_delay_ms)
+		retry->policy.max_delay_ms = RETRY_MAX_DELAY_MS;
+	retry->policy.jitter_percent = MIN(retry->policy.jitter_percent, 100);
+	retry->cb = cb;
+	retry->user_data = user_data;
+	retry->attempt = 1;
+	g_hash_table_insert(retry_table, retry->service, retry);
+	g_mutex_unlock(&retry_mutex);
+
+	return retry;
+}
+
+void connman_retry_free(struct connman_retry *retry)
+{
+	if (!retry)
+		return;
+
+	g_mutex_lock(&retry_mutex);
+	if (retry_table && g_hash_table_lookup(retry_table, retry->service) == retry)
+		g_hash_table_remove(retry_table, retry->service);
+	g_mutex_unlock(&retry_mutex);
+
+	g_free(retry->service);
+	g_free(retry);
+}
+
+connman_retry_class_t connman_retry_classify(struct connman_retry *retry,
+					     const GError *error,
+					     const gchar *service_error)
+{
+	gchar *remote;
+	connman_retry_class_t class = CONNMAN_RETRY_FATAL;
+	gboolean cancelled;
+
+	g_mutex_lock(&retry_mutex);
+	cancelled = retry->cancelled;
+	g_mutex_unlock(&retry_mutex);
+	if (cancelled)
+		return CONNMAN_RETRY_CANCELLED;
+
+	if (service_error)
+		return g_strv_contains(retry_service_errors, service_error) ?
+			CONNMAN_RETRY_AGAIN : CONNMAN_RETRY_FATAL;
+	if (!error)
+		return CONNMAN_RETRY_FATAL;
+
+	if (error->domain == CONNMAN_ERROR)
+		return error->code == CONNMAN_ERROR_TIMEOUT ||
+		       error->code == CONNMAN_ERROR_CALL_IN_PROGRESS ?
+			CONNMAN_RETRY_AGAIN : CONNMAN_RETRY_FATAL;
+
+	// Cancelled calls are the ones failed when ConnMan left the bus
+	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
+	    g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) ||
+	    g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_NO_REPLY) ||
+	    g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_TIMEOUT) ||
+	    g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN) ||
+	    g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER))
+		return CONNMAN_RETRY_AGAIN;
+
+	remote = g_dbus_error_get_remote_error(error);
+	if (remote) {
+		if (g_strv_contains(retry_remote_errors, remote))
+			class = CONNMAN_RETRY_AGAIN;
+		else if (retry->attempt > 1 &&
+			 !strcmp(remote, "net.connman.Error.AlreadyConnected"))
+			class = CONNMAN_RETRY_DONE;
+		g_free(remote);
+	}
+
+	return class;
+}
+
+static gboolean retry_timeout_cb(gpointer user_data)
+{
+	const gchar *service = user_data;
+	struct connman_retry *retry;
+	GError *error = NULL;
+	gboolean cancelled;
+
+	// The retry may have been cancelled and freed since this was dispatched
+	g_mutex_lock(&retry_mutex);
+	retry = retry_table ? g_hash_table_lookup(retry_table, service) : NULL;
+	if (!retry || retry->timer != g_main_current_source()) {
+		g_mutex_unlock(&retry_mutex);
+		return G_SOURCE_REMOVE;
+	}
+	g_source_unref(retry->timer);
+	retry->timer = NULL;
+	cancelled = retry->cancelled;
+	g_mutex_unlock(&retry_mutex);
+
+	if (cancelled) {
+		if (retry->cb)
+			retry->cb(retry->service, FALSE, CONNMAN_RETRY_CANCELLED_MESSAGE,
+				  retry->user_data);
+		connman_retry_free(retry);
+		return G_SOURCE_REMOVE;
+	}
+
+	DEBUG("Connect attempt %u of %u to %s", retry->attempt,
+	      retry->policy.max_attempts, retry->service);
+	if (!connman_service_connect_internal(retry->ns, retry->service,
+					      retry->cb, retry->user_data,
+					      retry, CONNMAN_DEADLINE_DEFAULT, &error)) {
+		if (retry->cb)
+			retry->cb(retry->service, FALSE,
+				  error ? error->message : "unspecified",
+				  retry->user_data);
+		g_clear_error(&error);
+		connman_retry_free(retry);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+// Called with the retry lock held
+static void retry_arm_unlocked(struct connman_retry *retry, guint delay_ms)
+{
+	if (retry->timer) {
+		g_source_destroy(retry->timer);
+		g_source_unref(retry->timer);
+	}
+	retry->timer = delay_ms ? g_timeout_source_new(delay_ms) : g_idle_source_new();
+	g_source_set_callback(retry->timer, retry_timeout_cb,
+			      g_strdup(retry->service), g_free);
+	g_source_attach(retry->timer, NULL);
+}
+
+gboolean connman_retry_schedule(struct connman_retry *retry)
+{
+	guint64 delay;
+	guint jitter;
+
+	if (retry->attempt >= retry->policy.max_attempts)
+		return FALSE;
+
+	delay = (guint64) retry->policy.initial_delay_ms << MIN(retry->attempt - 1, 31);
+	delay = MIN(delay, retry->policy.max_delay_ms);
+	// Take up to jitter_percent off so clients failing together spread out
+	jitter = delay * retry->policy.jitter_percent / 100;
+	if (jitter)
+		delay -= g_random_int_range(0, jitter + 1);
+
+	g_mutex_lock(&retry_mutex);
+	if (retry->cancelled) {
+		g_mutex_unlock(&retry_mutex);
+		return FALSE;
+	}
+	retry->attempt++;
+	INFO("Retrying connect to %s in %u ms", retry->service, (guint) delay);
+	retry_arm_unlocked(retry, MAX(delay, 1));
+	g_mutex_unlock(&retry_mutex);
+
+	return TRUE;
+}
+
+/*
+ * A pending backoff reports the cancellation from the handler loop right
+ * away; an attempt in flight reports it with its reply.
+ */
+void connman_retry_cancel(const gchar *service)
+{
+	struct connman_retry *retry;
+
+	g_mutex_lock(&retry_mutex);
+	retry = retry_table && service ? g_hash_table_lookup(retry_table, service) : NULL;
+	if (retry && !retry->cancelled) {
+		INFO("Cancelling connect retries to %s", service);
+		retry->cancelled = TRUE;
+		if (retry->timer)
+			retry_arm_unlocked(retry, 0);
+	}
+	g_mutex_unlock(&retry_mutex);
+}
+
+/*
+ * Used once the handler loop has stopped: pending backoffs report the
+ * cancellation here, attempts in flight are only marked.
+ */
+void connman_retry_cancel_all(void)
+{
+	GSList *pending = NULL, *list;
+	GHashTableIter iter;
+	gpointer value;
+
+	g_mutex_lock(&retry_mutex);
+	if (retry_table) {
+		g_hash_table_iter_init(&iter, retry_table);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			struct connman_retry *retry = value;
+
+			retry->cancelled = TRUE;
+			if (!retry->timer)
+				continue;
+			g_source_destroy(retry->timer);
+			g_source_unref(retry->timer);
+			retry->timer = NULL;
+			g_hash_table_iter_remove(&iter);
+			pending = g_slist_prepend(pending, retry);
+		}
+	}
+	g_mutex_unlock(&retry_mutex);
+
+	for (list = pending; list; list = g_slist_next(list)) {
+		struct connman_retry *retry = list->data;
+
+		if (retry->cb)
+			retry->cb(retry->service, FALSE, CONNMAN_RETRY_CANCELLED_MESSAGE,
+				  retry->user_data);
+		connman_retry_free(retry);
+	}
+	g_slist_free(pending);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONNMAN_RETRY_H
+#define CONNMAN_RETRY_H
+
+#include <glib.h>
+
+#include "connman-glib.h"
+
+struct connman_state;
+struct connman_retry;
+
+typedef enum {
+	CONNMAN_RETRY_FATAL,
+	CONNMAN_RETRY_AGAIN,
+	CONNMAN_RETRY_DONE,	/* an earlier attempt got through after all */
+	CONNMAN_RETRY_CANCELLED
+} connman_retry_class_t;
+
+#define CONNMAN_RETRY_CANCELLED_MESSAGE	"Connect cancelled"
+
+struct connman_retry *connman_retry_new(struct connman_state *ns,
+					const gchar *service,
+					const connman_retry_policy_t *policy,
+					connman_service_connect_cb_t cb,
+					gpointer user_data);
+
+void connman_retry_free(struct connman_retry *retry);
+
+// Called with the failure of the latest attempt
+connman_retry_class_t connman_retry_classify(struct connman_retry *retry,
+					     const GError *error,
+					     const gchar *service_error);
+
+// Arms the backoff timer, FALSE if the attempts are used up
+gboolean connman_retry_schedule(struct connman_retry *retry);
+
+void connman_retry_cancel(const gchar *service);
+
+void connman_retry_cancel_all(void);
+
+// In api.c, starts one attempt
+gboolean connman_service_connect_internal(struct connman_state *ns,
+					  const gchar *service,
+					  connman_service_connect_cb_t cb,
+					  gpointer user_data,
+					  struct connman_retry *retry,
+					  gint64 deadline,
+					  GError **error);
+
+#endif /* CONNMAN_RETRY_H */
@@ -0,0 +1,475 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "common.h"
+#include "connman-call.h"
+#include "connman-cache.h"
+#include "connman-scan.h"
+
+/*
+ * Asynchronous technology scans.  Requests for a technology that arrive
+ * while its scan is in flight, or while it waits out the minimum
+ * interval since the last one, join that scan and complete with it.  The
+ * services added and removed while a scan runs are reported with its
+ * completion.  ConnMan may signal the final ServicesChanged just after
+ * the Scan reply, so completion waits SCAN_SETTLE_MS for it.
+ *
+ * On top of that, a background scheduler scans technologies for which
+ * there are scan interest leases: every SCHED_FAST_MS when the technology
+ * is not connected or a lease asks for active scanning, otherwise at an
+ * interval doubling from SCHED_BACKOFF_MIN_MS to SCHED_BACKOFF_MAX_MS
+ * while the connection stays up.  Nothing is scanned while the
+ * technology is not powered.
+ */
+
+#define SCAN_MIN_INTERVAL_DEFAULT_MS	5000
+#define SCAN_SETTLE_MS			200
+
+#define SCHED_FAST_MS			15000
+#define SCHED_BACKOFF_MIN_MS		30000
+#define SCHED_BACKOFF_MAX_MS		(5 * 60 * 1000)
+
+struct scan_waiter {
+	connman_technology_scan_cb_t cb;
+	gpointer user_data;
+};
+
+struct scan_state {
+	struct connman_state *ns;
+	gchar *technology;
+	gchar *prefix;		/* of the technology's service identifiers */
+	gboolean in_flight;
+	gint64 last_start;
+	GSource *deferred;
+	GSList *waiters;
+	GHashTable *added;
+	GHashTable *removed;
+	gboolean status;
+	gchar *error;
+
+	/* background scheduler */
+	guint leases;
+	guint active_leases;
+	gboolean powered;
+	gboolean connected;
+	guint backoff_ms;
+	GSource *timer;
+};
+
+struct scan_lease {
+	struct scan_state *scan;
+	connman_scan_interest_t interest;
+};
+
+static GMutex scan_mutex;
+static GHashTable *scan_states;		/* technology -> struct scan_state */
+static GHashTable *scan_leases;		/* id -> struct scan_lease */
+static guint scan_next_lease = 1;
+static gint scans_in_flight;		/* atomic */
+static guint scan_min_interval_ms = SCAN_MIN_INTERVAL_DEFAULT_MS;	/* atomic */
+
+EXPORT void connman_set_scan_min_interval(guint interval_ms)
+{
+	g_atomic_int_set(&scan_min_interval_ms, interval_ms);
+}
+
+static void scan_state_free(gpointer data)
+{
+	struct scan_state *scan = data;
+
+	g_free(scan->technology);
+	g_free(scan->prefix);
+	g_hash_table_destroy(scan->added);
+	g_hash_table_destroy(scan->removed);
+	g_free(scan);
+}
+
+static struct scan_state *scan_state_get_unlocked(struct connman_state *ns,
+						  const gchar *technology)
+{
+	struct scan_state *scan;
+
+	if (!scan_states)
+		scan_states = g_hash_table_new_full(g_str_hash, g_str_equal,
+						    NULL, scan_state_free);
+
+	scan = g_hash_table_lookup(scan_states, technology);
+	if (!scan) {
+		scan = g_new0(struct scan_state, 1);
+		scan->ns = ns;
+		scan->technology = g_strdup(technology);
+		scan->prefix = g_strdup_printf("%s_", technology);
+		scan->added = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		scan->removed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		scan->backoff_ms = SCHED_BACKOFF_MIN_MS;
+		g_hash_table_insert(scan_states, scan->technology, scan);
+	}
+
+	return scan;
+}
+
+static GVariant *service_list(GHashTable *services)
+{
+	GVariantBuilder builder;
+	GHashTableIter iter;
+	gpointer key;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("as"));
+	g_hash_table_iter_init(&iter, services);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+		g_variant_builder_add(&builder, "s", key);
+
+	return g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
+static gboolean scan_complete_cb(gpointer user_data)
+{
+	struct scan_state *scan = user_data;
+	GVariant *added, *removed;
+	GSList *waiters, *list;
+	gchar *technology, *error;
+	gboolean status;
+
+	g_mutex_lock(&scan_mutex);
+	waiters = g_slist_reverse(scan->waiters);
+	scan->waiters = NULL;
+	added = service_list(scan->added);
+	removed = service_list(scan->removed);
+	g_hash_table_remove_all(scan->added);
+	g_hash_table_remove_all(scan->removed);
+	technology = g_strdup(scan->technology);
+	status = scan->status;
+	error = scan->error;
+	scan->error = NULL;
+	scan->in_flight = FALSE;
+	(void) g_atomic_int_dec_and_test(&scans_in_flight);
+	g_mutex_unlock(&scan_mutex);
+
+	for (list = waiters; list; list = g_slist_next(list)) {
+		struct scan_waiter *waiter = list->data;
+
+		(*waiter->cb)(technology, status, error, added, removed,
+			      waiter->user_data);
+	}
+
+	g_slist_free_full(waiters, g_free);
+	g_variant_unref(added);
+	g_variant_unref(removed);
+	g_free(technology);
+	g_free(error);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void scan_reply_cb(void *user_data, GVariant *result, GError **error)
+{
+	struct scan_state *scan = user_data;
+
+	g_mutex_lock(&scan_mutex);
+	scan->status = result != NULL;
+	if (!result) {
+		scan->error = g_strdup(error && *error ? (*error)->message : "unspecified");
+		ERROR("technology %s method %s error %s",
+		      scan->technology, "Scan", scan->error);
+	}
+	g_mutex_unlock(&scan_mutex);
+
+	if (result) {
+		g_variant_unref(result);
+		g_timeout_add(SCAN_SETTLE_MS, scan_complete_cb, scan);
+	} else {
+		scan_complete_cb(scan);
+	}
+}
+
+/* Called with the scan lock held, on the handler thread */
+static void scan_start_unlocked(struct scan_state *scan)
+{
+	GError *error = NULL;
+
+	scan->in_flight = TRUE;
+	scan->last_start = g_get_monotonic_time();
+	g_atomic_int_inc(&scans_in_flight);
+
+	if (!connman_call_async(scan->ns, CONNMAN_AT_TECHNOLOGY, scan->technology,
+				"Scan", NULL, CONNMAN_DEADLINE_DEFAULT, &error,
+				scan_reply_cb, scan)) {
+		ERROR("technology %s method %s error %s",
+		      scan->technology, "Scan", error->message);
+		scan->status = FALSE;
+		scan->error = g_strdup(error->message);
+		g_error_free(error);
+		g_idle_add(scan_complete_cb, scan);
+	}
+}
+
+static gboolean scan_start_cb(gpointer user_data)
+{
+	struct scan_state *scan = user_data;
+
+	g_mutex_lock(&scan_mutex);
+	g_source_unref(scan->deferred);
+	scan->deferred = NULL;
+	scan_start_unlocked(scan);
+	g_mutex_unlock(&scan_mutex);
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * The scan itself is always started from the handler loop, so that the
+ * reply and the completion are dispatched there whatever the context of
+ * the calling thread.
+ */
+gboolean connman_scan_request(struct connman_state *ns,
+			      const gchar *technology,
+			      connman_technology_scan_cb_t cb,
+			      gpointer user_data)
+{
+	struct scan_waiter *waiter;
+	struct scan_state *scan;
+	gint64 wait;
+
+	waiter = g_new0(struct scan_waiter, 1);
+	waiter->cb = cb;
+	waiter->user_data = user_data;
+
+	g_mutex_lock(&scan_mutex);
+	scan = scan_state_get_unlocked(ns, technology);
+	scan->waiters = g_slist_prepend(scan->waiters, waiter);
+	if (scan->in_flight || scan->deferred) {
+		g_mutex_unlock(&scan_mutex);
+		return TRUE;
+	}
+
+	wait = scan->last_start ?
+		scan->last_start + g_atomic_int_get(&scan_min_interval_ms) * 1000LL -
+		g_get_monotonic_time() : 0;
+	if (wait > 0)
+		DEBUG("Deferring %s scan by %" G_GINT64_FORMAT " ms",
+		      technology, wait / 1000);
+	scan->deferred = g_timeout_source_new(wait > 0 ? wait / 1000 + 1 : 0);
+	g_source_set_callback(scan->deferred, scan_start_cb, scan, NULL);
+	g_source_attach(scan->deferred, NULL);
+	g_mutex_unlock(&scan_mutex);
+
+	return TRUE;
+}
+
+gboolean connman_scan_in_flight(void)
+{
+	return g_atomic_int_get(&scans_in_flight) > 0;
+}
+
+void connman_scan_note_service(const gchar *service, gboolean removed)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	if (!g_atomic_int_get(&scans_in_flight))
+		return;
+
+	g_mutex_lock(&scan_mutex);
+	g_hash_table_iter_init(&iter, scan_states);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct scan_state *scan = value;
+
+		if (!scan->in_flight || !g_str_has_prefix(service, scan->prefix))
+			continue;
+
+		// Something that came and went during the scan is no change
+		if (removed) {
+			if (!g_hash_table_remove(scan->added, service))
+				g_hash_table_add(scan->removed, g_strdup(service));
+		} else {
+			if (!g_hash_table_remove(scan->removed, service))
+				g_hash_table_add(scan->added, g_strdup(service));
+		}
+	}
+	g_mutex_unlock(&scan_mutex);
+}
+
+static gboolean sched_timer_cb(gpointer user_data);
+
+/* Called with the scan lock held */
+static void sched_update_unlocked(struct scan_state *scan)
+{
+	gint64 due, now = g_get_monotonic_time();
+	guint interval_ms;
+
+	if (scan->timer) {
+		g_source_destroy(scan->timer);
+		g_source_unref(scan->timer);
+		scan->timer = NULL;
+	}
+
+	if (!scan->leases || !scan->powered)
+		return;
+
+	if (scan->active_leases || !scan->connected) {
+		interval_ms = SCHED_FAST_MS;
+		scan->backoff_ms = SCHED_BACKOFF_MIN_MS;
+	} else {
+		interval_ms = scan->backoff_ms;
+	}
+
+	due = scan->last_start + interval_ms * 1000LL;
+	scan->timer = g_timeout_source_new(due > now ? (due - now) / 1000 + 1 : 0);
+	g_source_set_callback(scan->timer, sched_timer_cb, scan, NULL);
+	g_source_attach(scan->timer, NULL);
+}
+
+static void sched_scan_done_cb(const gchar *technology,
+			       gboolean status,
+			       const char *error,
+			       GVariant *added,
+			       GVariant *removed,
+			       gpointer user_data)
+{
+	struct scan_state *scan = user_data;
+
+	g_mutex_lock(&scan_mutex);
+	if (scan->connected && !scan->active_leases)
+		scan->backoff_ms = MIN(scan->backoff_ms * 2, SCHED_BACKOFF_MAX_MS);
+	sched_update_unlocked(scan);
+	g_mutex_unlock(&scan_mutex);
+}
+
+static gboolean sched_timer_cb(gpointer user_data)
+{
+	struct scan_state *scan = user_data;
+
+	g_mutex_lock(&scan_mutex);
+	// An API thread may have replaced or dropped the timer since dispatch
+	if (scan->timer != g_main_current_source()) {
+		g_mutex_unlock(&scan_mutex);
+		return G_SOURCE_REMOVE;
+	}
+	g_source_unref(scan->timer);
+	scan->timer = NULL;
+	if (!scan->leases || !scan->powered) {
+		g_mutex_unlock(&scan_mutex);
+		return G_SOURCE_REMOVE;
+	}
+	g_mutex_unlock(&scan_mutex);
+
+	DEBUG("Background scan of %s", scan->technology);
+	connman_scan_request(scan->ns, scan->technology, sched_scan_done_cb, scan);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean technology_flag(struct connman_state *ns,
+				const gchar *technology,
+				const gchar *name)
+{
+	GVariant *value;
+	gboolean flag = FALSE;
+
+	value = connman_cache_get_property(ns->cache, CONNMAN_PROPERTY_TECHNOLOGY,
+					   technology, name);
+	if (value) {
+		if (g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN))
+			flag = g_variant_get_boolean(value);
+		g_variant_unref(value);
+	}
+
+	return flag;
+}
+
+/* Called with the scan lock held; TRUE if Powered or Connected changed */
+static gboolean sched_read_state_unlocked(struct scan_state *scan)
+{
+	gboolean powered = technology_flag(scan->ns, scan->technology, "Powered");
+	gboolean connected = technology_flag(scan->ns, scan->technology, "Connected");
+	gboolean changed = powered != scan->powered || connected != scan->connected;
+
+	scan->powered = powered;
+	scan->connected = connected;
+	if (changed)
+		scan->backoff_ms = SCHED_BACKOFF_MIN_MS;
+
+	return changed;
+}
+
+void connman_scan_technology_changed(const gchar *technology)
+{
+	struct scan_state *scan;
+
+	g_mutex_lock(&scan_mutex);
+	scan = scan_states ? g_hash_table_lookup(scan_states, technology) : NULL;
+	if (scan && scan->leases && sched_read_state_unlocked(scan))
+		sched_update_unlocked(scan);
+	g_mutex_unlock(&scan_mutex);
+}
+
+guint connman_scan_lease_acquire_internal(struct connman_state *ns,
+					  const gchar *technology,
+					  connman_scan_interest_t interest)
+{
+	struct scan_lease *lease;
+	struct scan_state *scan;
+	guint id;
+
+	g_mutex_lock(&scan_mutex);
+	if (!scan_leases)
+		scan_leases = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+
+	scan = scan_state_get_unlocked(ns, technology);
+	lease = g_new0(struct scan_lease, 1);
+	lease->scan = scan;
+	lease->interest = interest;
+	do {
+		id = scan_next_lease++;
+	} while (!id || g_hash_table_contains(scan_leases, GUINT_TO_POINTER(id)));
+	g_hash_table_insert(scan_leases, GUINT_TO_POINTER(id), lease);
+
+	scan->leases++;
+	if (interest == CONNMAN_SCAN_INTEREST_ACTIVE)
+		scan->active_leases++;
+	sched_read_state_unlocked(scan);
+	sched_update_unlocked(scan);
+	g_mutex_unlock(&scan_mutex);
+
+	return id;
+}
+
+EXPORT void connman_scan_lease_release(guint id)
+{
+	struct scan_lease *lease;
+	struct scan_state *scan;
+
+	g_mutex_lock(&scan_mutex);
+	lease = scan_leases ? g_hash_table_lookup(scan_leases, GUINT_TO_POINTER(id)) : NULL;
+	if (!lease) {
+		g_mutex_unlock(&scan_mutex);
+		ERROR("Unknown scan lease %u", id);
+		return;
+	}
+
+	scan = lease->scan;
+	scan->leases--;
+	if (lease->interest == CONNMAN_SCAN_INTEREST_ACTIVE)
+		scan->active_leases--;
+	g_hash_table_remove(scan_leases, GUINT_TO_POINTER(id));
+	sched_update_unlocked(scan);
+	g_mutex_unlock(&scan_mutex);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONNMAN_SCAN_H
+#define CONNMAN_SCAN_H
+
+#include <glib.h>
+
+#include "connman-glib.h"
+
+struct connman_state;
+
+gboolean connman_scan_request(struct connman_state *ns,
+			      const gchar *technology,
+			      connman_technology_scan_cb_t cb,
+			      gpointer user_data);
+
+gboolean connman_scan_in_flight(void);
+
+guint connman_scan_lease_acquire_internal(struct connman_state *ns,
+					  const gchar *technology,
+					  connman_scan_interest_t interest);
+
+// Lets the scheduler pick up Powered or Connected changes from the cache
+void connman_scan_technology_changed(const gchar *technology);
+
+// Notes a service appearing or disappearing for the scans in flight
+void connman_scan_note_service(const gchar *service, gboolean removed);
+
+#endif /* CONNMAN_SCAN_H */
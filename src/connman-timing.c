@@ -0,0 +1,307 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "common.h"
+#include "connman-timing.h"
+
+/*
+ * Timing of connects from connman_service_connect() through the service
+ * State transitions and the agent's RequestInput.  A record completes
+ * when the service gets online or fails, or TIMING_ONLINE_WAIT_MS after
+ * it got ready without getting online, or TIMING_MAX_MS after the
+ * connect if it never got ready.
+ */
+
+#define TIMING_ONLINE_WAIT_MS	30000
+#define TIMING_MAX_MS		120000
+#define TIMING_HISTORY		32
+
+struct timing_record {
+	connman_connect_timing_t timing;
+	guint id;
+	gint64 start;
+	GSource *timer;
+};
+
+static GMutex timing_mutex;
+static GHashTable *timing_records;	/* service -> struct timing_record */
+static gint timing_count;		/* atomic */
+static guint timing_next_id;
+static GQueue timing_history = G_QUEUE_INIT;	/* a{sv}, oldest first */
+static connman_connect_timing_cb_t timing_cb;
+static gpointer timing_cb_data;
+
+EXPORT void connman_set_connect_timing_callback(connman_connect_timing_cb_t cb,
+						gpointer user_data)
+{
+	g_mutex_lock(&timing_mutex);
+	timing_cb = cb;
+	timing_cb_data = user_data;
+	g_mutex_unlock(&timing_mutex);
+}
+
+EXPORT GVariant *connman_connect_timings(void)
+{
+	GVariantBuilder builder;
+	GList *list;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("aa{sv}"));
+	g_mutex_lock(&timing_mutex);
+	for (list = timing_history.head; list; list = g_list_next(list))
+		g_variant_builder_add_value(&builder, list->data);
+	g_mutex_unlock(&timing_mutex);
+
+	return g_variant_builder_end(&builder);
+}
+
+gboolean connman_timing_active(void)
+{
+	return g_atomic_int_get(&timing_count) > 0;
+}
+
+static void timing_record_free(struct timing_record *record)
+{
+	if (record->timer) {
+		g_source_destroy(record->timer);
+		g_source_unref(record->timer);
+	}
+	g_free((gchar *) record->timing.service);
+	g_free((gchar *) record->timing.error);
+	g_free(record);
+}
+
+static void add_span(GVariantBuilder *builder, const gchar *key, gint64 from, gint64 to)
+{
+	if (from >= 0 && to >= 0)
+		g_variant_builder_add(builder, "{sv}", key, g_variant_new_int64(to - from));
+}
+
+static GVariant *timing_to_variant(const connman_connect_timing_t *t)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&builder, "{sv}", "service", g_variant_new_string(t->service));
+	g_variant_builder_add(&builder, "{sv}", "success", g_variant_new_boolean(t->success));
+	if (t->error)
+		g_variant_builder_add(&builder, "{sv}", "error", g_variant_new_string(t->error));
+	g_variant_builder_add(&builder, "{sv}", "total_us", g_variant_new_int64(t->total));
+
+	// Phases, present when both ends were seen
+	add_span(&builder, "prompt_us", t->request_input, t->agent_response);
+	add_span(&builder, "association_us", t->association, t->configuration);
+	add_span(&builder, "configuration_us", t->configuration, t->ready);
+	add_span(&builder, "online_check_us", t->ready, t->online);
+
+	return g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
+/* Called with the timing lock held; the caller finishes the record */
+static struct timing_record *timing_complete_unlocked(const gchar *service,
+						      gboolean success,
+						      const gchar *error)
+{
+	struct timing_record *record;
+
+	if (!timing_records ||
+	    !g_hash_table_steal_extended(timing_records, service, NULL, (gpointer *) &record))
+		return NULL;
+	(void) g_atomic_int_dec_and_test(&timing_count);
+
+	record->timing.success = success;
+	record->timing.error = g_strdup(error);
+	record->timing.total = g_get_monotonic_time() - record->start;
+
+	g_queue_push_tail(&timing_history, timing_to_variant(&record->timing));
+	if (g_queue_get_length(&timing_history) > TIMING_HISTORY)
+		g_variant_unref(g_queue_pop_head(&timing_history));
+
+	return record;
+}
+
+static void timing_finish(struct timing_record *record)
+{
+	connman_connect_timing_cb_t cb;
+	gpointer cb_data;
+
+	if (!record)
+		return;
+
+	g_mutex_lock(&timing_mutex);
+	cb = timing_cb;
+	cb_data = timing_cb_data;
+	g_mutex_unlock(&timing_mutex);
+
+	if (cb)
+		(*cb)(&record->timing, cb_data);
+
+	timing_record_free(record);
+}
+
+static gboolean timing_timer_cb(gpointer user_data)
+{
+	guint id = GPOINTER_TO_UINT(user_data);
+	struct timing_record *record = NULL;
+	GHashTableIter iter;
+	gpointer value;
+	gchar *service;
+
+	// The record may have been replaced since the timer was armed
+	g_mutex_lock(&timing_mutex);
+	g_hash_table_iter_init(&iter, timing_records);
+	while (!record && g_hash_table_iter_next(&iter, NULL, &value))
+		if (((struct timing_record *) value)->id == id)
+			record = value;
+	if (!record) {
+		g_mutex_unlock(&timing_mutex);
+		return G_SOURCE_REMOVE;
+	}
+
+	g_source_unref(record->timer);
+	record->timer = NULL;
+	service = g_strdup(record->timing.service);
+	record = timing_complete_unlocked(service, record->timing.ready >= 0,
+					  record->timing.ready >= 0 ? NULL : "timeout");
+	g_mutex_unlock(&timing_mutex);
+
+	timing_finish(record);
+	g_free(service);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Called with the timing lock held */
+static void timing_arm_unlocked(struct timing_record *record, guint timeout_ms)
+{
+	if (record->timer) {
+		g_source_destroy(record->timer);
+		g_source_unref(record->timer);
+	}
+	record->timer = g_timeout_source_new(timeout_ms);
+	g_source_set_callback(record->timer, timing_timer_cb,
+			      GUINT_TO_POINTER(record->id), NULL);
+	g_source_attach(record->timer, NULL);
+}
+
+void connman_timing_connect_start(const gchar *service)
+{
+	struct timing_record *record;
+
+	record = g_new0(struct timing_record, 1);
+	record->timing.service = g_strdup(service);
+	record->timing.request_input = -1;
+	record->timing.agent_response = -1;
+	record->timing.association = -1;
+	record->timing.configuration = -1;
+	record->timing.ready = -1;
+	record->timing.online = -1;
+	record->start = g_get_monotonic_time();
+
+	g_mutex_lock(&timing_mutex);
+	record->id = ++timing_next_id;
+	if (!timing_records)
+		timing_records = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+						       (GDestroyNotify) timing_record_free);
+	// A new connect to the same service supersedes the old record
+	if (g_hash_table_remove(timing_records, service))
+		(void) g_atomic_int_dec_and_test(&timing_count);
+	g_hash_table_insert(timing_records, (gchar *) record->timing.service, record);
+	g_atomic_int_inc(&timing_count);
+	timing_arm_unlocked(record, TIMING_MAX_MS);
+	g_mutex_unlock(&timing_mutex);
+}
+
+void connman_timing_connect_failed(const gchar *service, const gchar *error)
+{
+	struct timing_record *record;
+
+	if (!connman_timing_active())
+		return;
+
+	g_mutex_lock(&timing_mutex);
+	record = timing_complete_unlocked(service, FALSE, error ? error : "unspecified");
+	g_mutex_unlock(&timing_mutex);
+
+	timing_finish(record);
+}
+
+void connman_timing_agent(const gchar *service, gboolean response)
+{
+	struct timing_record *record;
+
+	if (!connman_timing_active())
+		return;
+
+	g_mutex_lock(&timing_mutex);
+	record = g_hash_table_lookup(timing_records, service);
+	if (record) {
+		gint64 *mark = response ? &record->timing.agent_response :
+			&record->timing.request_input;
+
+		*mark = g_get_monotonic_time() - record->start;
+	}
+	g_mutex_unlock(&timing_mutex);
+}
+
+void connman_timing_state(const gchar *service, const gchar *state)
+{
+	struct timing_record *record;
+	gint64 *mark = NULL;
+	gint64 now;
+
+	if (!connman_timing_active())
+		return;
+
+	now = g_get_monotonic_time();
+
+	g_mutex_lock(&timing_mutex);
+	record = g_hash_table_lookup(timing_records, service);
+	if (!record) {
+		g_mutex_unlock(&timing_mutex);
+		return;
+	}
+
+	if (!g_strcmp0(state, "association"))
+		mark = &record->timing.association;
+	else if (!g_strcmp0(state, "configuration"))
+		mark = &record->timing.configuration;
+	else if (!g_strcmp0(state, "ready"))
+		mark = &record->timing.ready;
+	else if (!g_strcmp0(state, "online"))
+		mark = &record->timing.online;
+	if (mark && *mark < 0)
+		*mark = now - record->start;
+
+	if (!g_strcmp0(state, "online")) {
+		record = timing_complete_unlocked(service, TRUE, NULL);
+	} else if (!g_strcmp0(state, "ready")) {
+		timing_arm_unlocked(record, TIMING_ONLINE_WAIT_MS);
+		record = NULL;
+	} else if (!g_strcmp0(state, "failure")) {
+		record = timing_complete_unlocked(service, FALSE, "failure");
+	} else if ((!g_strcmp0(state, "idle") || !g_strcmp0(state, "disconnect")) &&
+		   (record->timing.association >= 0 || record->timing.configuration >= 0)) {
+		record = timing_complete_unlocked(service, FALSE, "disconnected");
+	} else {
+		record = NULL;
+	}
+	g_mutex_unlock(&timing_mutex);
+
+	timing_finish(record);
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONNMAN_TIMING_H
+#define CONNMAN_TIMING_H
+
+#include <glib.h>
+
+gboolean connman_timing_active(void);
+
+void connman_timing_connect_start(const gchar *service);
+
+void connman_timing_connect_failed(const gchar *service, const gchar *error);
+
+// Notes the agent's RequestInput, or the consumer's response to it
+void connman_timing_agent(const gchar *service, gboolean response);
+
+void connman_timing_state(const gchar *service, const gchar *state);
+
+#endif /* CONNMAN_TIMING_H */
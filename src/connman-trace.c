@@ -0,0 +1,216 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "common.h"
+#include "connman-trace.h"
+
+/*
+ * Timeline of spans and instants in a bounded ring that overwrites the
+ * oldest events, exported in the Chrome trace event format understood by
+ * chrome://tracing and Perfetto.  Timestamps are monotonic microseconds.
+ */
+
+#define TRACE_DEFAULT_EVENTS	65536
+
+struct trace_event {
+	const char *category;	/* static */
+	const char *name;	/* interned */
+	const char *object;	/* interned or NULL */
+	gint64 ts;
+	gint64 dur;		/* -1 for instants */
+	gint64 tid;
+	gboolean error;
+};
+
+static gint trace_enabled;
+static GMutex trace_mutex;
+static struct trace_event *trace_events;
+static guint trace_size;
+static guint trace_head;
+static guint trace_count;
+static guint64 trace_dropped;
+
+static gint64 trace_tid(void)
+{
+	static GPrivate tid_key;
+	gpointer tid = g_private_get(&tid_key);
+
+	if (G_UNLIKELY(!tid)) {
+		tid = GSIZE_TO_POINTER(syscall(SYS_gettid));
+		g_private_set(&tid_key, tid);
+	}
+
+	return GPOINTER_TO_SIZE(tid);
+}
+
+static void trace_add(const char *category,
+		      const char *name,
+		      const char *object,
+		      gint64 ts,
+		      gint64 dur,
+		      gboolean error)
+{
+	struct trace_event *ev;
+	gint64 tid = trace_tid();
+
+	name = g_intern_string(name);
+	object = object ? g_intern_string(object) : NULL;
+
+	g_mutex_lock(&trace_mutex);
+	if (!trace_events) {
+		g_mutex_unlock(&trace_mutex);
+		return;
+	}
+	ev = &trace_events[(trace_head + trace_count) % trace_size];
+	if (trace_count < trace_size) {
+		trace_count++;
+	} else {
+		trace_head = (trace_head + 1) % trace_size;
+		trace_dropped++;
+	}
+	ev->category = category;
+	ev->name = name;
+	ev->object = object;
+	ev->ts = ts;
+	ev->dur = dur;
+	ev->tid = tid;
+	ev->error = error;
+	g_mutex_unlock(&trace_mutex);
+}
+
+gboolean connman_trace_enabled(void)
+{
+	return g_atomic_int_get(&trace_enabled);
+}
+
+void connman_trace_span(const char *category,
+			const char *name,
+			const char *object,
+			gint64 start,
+			gboolean error)
+{
+	if (!start || !g_atomic_int_get(&trace_enabled))
+		return;
+
+	trace_add(category, name ? name : "", object, start,
+		  MAX(g_get_monotonic_time() - start, 0), error);
+}
+
+void connman_trace_instant(const char *category, const char *name)
+{
+	if (!g_atomic_int_get(&trace_enabled))
+		return;
+
+	trace_add(category, name, NULL, g_get_monotonic_time(), -1, FALSE);
+}
+
+/*
+ * Start recording into a ring of max_events (0 selects a default),
+ * discarding any previous timeline.
+ */
+EXPORT gboolean connman_trace_start(guint max_events)
+{
+	if (!max_events)
+		max_events = TRACE_DEFAULT_EVENTS;
+
+	g_mutex_lock(&trace_mutex);
+	g_free(trace_events);
+	trace_events = g_try_new0(struct trace_event, max_events);
+	trace_size = trace_events ? max_events : 0;
+	trace_head = 0;
+	trace_count = 0;
+	trace_dropped = 0;
+	g_atomic_int_set(&trace_enabled, trace_events != NULL);
+	g_mutex_unlock(&trace_mutex);
+
+	if (!trace_events) {
+		ERROR("Unable to allocate %u trace events", max_events);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+// Stop recording, the timeline is kept for export
+EXPORT void connman_trace_stop(void)
+{
+	g_atomic_int_set(&trace_enabled, FALSE);
+}
+
+static void json_append_string(GString *out, const char *s)
+{
+	g_string_append_c(out, '"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			g_string_append_printf(out, "\\%c", *s);
+		else if ((guchar) *s < 0x20)
+			g_string_append_printf(out, "\\u%04x", *s);
+		else
+			g_string_append_c(out, *s);
+	}
+	g_string_append_c(out, '"');
+}
+
+EXPORT gchar *connman_trace_export_json(void)
+{
+	GString *out = g_string_new("{\"traceEvents\":[");
+	pid_t pid = getpid();
+	guint i;
+
+	g_mutex_lock(&trace_mutex);
+	for (i = 0; i < trace_count; i++) {
+		struct trace_event *ev = &trace_events[(trace_head + i) % trace_size];
+
+		g_string_append(out, i ? ",\n{\"name\":" : "\n{\"name\":");
+		json_append_string(out, ev->name);
+		g_string_append(out, ",\"cat\":");
+		json_append_string(out, ev->category);
+		if (ev->dur >= 0)
+			g_string_append_printf(out,
+					       ",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT
+					       ",\"dur\":%" G_GINT64_FORMAT,
+					       ev->ts, ev->dur);
+		else
+			g_string_append_printf(out,
+					       ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" G_GINT64_FORMAT,
+					       ev->ts);
+		g_string_append_printf(out, ",\"pid\":%d,\"tid\":%" G_GINT64_FORMAT,
+				       (int) pid, ev->tid);
+		if (ev->object || ev->error) {
+			g_string_append(out, ",\"args\":{");
+			if (ev->object) {
+				g_string_append(out, "\"object\":");
+				json_append_string(out, ev->object);
+			}
+			if (ev->error)
+				g_string_append(out, ev->object ? ",\"error\":true" : "\"error\":true");
+			g_string_append_c(out, '}');
+		}
+		g_string_append_c(out, '}');
+	}
+	g_string_append_printf(out,
+			       "\n],\"displayTimeUnit\":\"ms\","
+			       "\"otherData\":{\"dropped\":\"%" G_GUINT64_FORMAT "\"}}\n",
+			       trace_dropped);
+	g_mutex_unlock(&trace_mutex);
+
+	return g_string_free(out, FALSE);
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONNMAN_TRACE_H
+#define CONNMAN_TRACE_H
+
+#include <glib.h>
+
+gboolean connman_trace_enabled(void);
+
+/*
+ * Record a complete span from start to now; the strings must be static or
+ * from a bounded set, as they are interned.
+ */
+void connman_trace_span(const char *category,
+			const char *name,
+			const char *object,
+			gint64 start,
+			gboolean error);
+
+void connman_trace_instant(const char *category, const char *name);
+
+#endif /* CONNMAN_TRACE_H */
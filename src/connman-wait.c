@@ -0,0 +1,281 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "common.h"
+#include "connman-cache.h"
+#include "connman-wait.h"
+
+/*
+ * Waits for a cached property to take a value.  They are evaluated when
+ * added and then only when the cache reports a change to their object,
+ * so waiting costs neither polling nor D-Bus calls.
+ */
+
+struct wait_entry {
+	guint id;
+	struct connman_cache *cache;
+	connman_property_type_t type;
+	gchar *object;
+	gchar *property;
+	GVariant *value;
+	connman_wait_cb_t cb;
+	gpointer user_data;
+	GSource *timeout;
+};
+
+static GMutex wait_mutex;
+static GList *wait_entries;
+static gint wait_count;		/* atomic */
+static guint wait_next_id = 1;
+
+static gboolean wait_satisfied(struct wait_entry *entry)
+{
+	GVariant *current;
+	gboolean satisfied;
+
+	current = connman_cache_get_property(entry->cache, entry->type,
+					     entry->object, entry->property);
+	if (!current)
+		return FALSE;
+
+	satisfied = g_variant_equal(current, entry->value);
+	g_variant_unref(current);
+
+	return satisfied;
+}
+
+/* Called with the wait lock held */
+static void wait_remove_unlocked(struct wait_entry *entry)
+{
+	wait_entries = g_list_remove(wait_entries, entry);
+	(void) g_atomic_int_dec_and_test(&wait_count);
+	if (entry->timeout) {
+		g_source_destroy(entry->timeout);
+		g_source_unref(entry->timeout);
+		entry->timeout = NULL;
+	}
+}
+
+static void wait_complete(struct wait_entry *entry, gboolean satisfied)
+{
+	(*entry->cb)(satisfied, entry->user_data);
+
+	g_free(entry->object);
+	g_free(entry->property);
+	g_variant_unref(entry->value);
+	g_free(entry);
+}
+
+static gboolean wait_timeout_cb(gpointer user_data)
+{
+	guint id = GPOINTER_TO_UINT(user_data);
+	struct wait_entry *entry = NULL;
+	GList *list;
+
+	g_mutex_lock(&wait_mutex);
+	for (list = wait_entries; list; list = g_list_next(list)) {
+		if (((struct wait_entry *) list->data)->id == id) {
+			entry = list->data;
+			wait_remove_unlocked(entry);
+			break;
+		}
+	}
+	g_mutex_unlock(&wait_mutex);
+
+	if (entry)
+		wait_complete(entry, FALSE);
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Calls cb with TRUE once the property has the value, right away if it
+ * already has it, or with FALSE after timeout_ms (never if negative).
+ * Returns the id for connman_wait_cancel, 0 if it completed right away.
+ */
+guint connman_wait_add(struct connman_cache *cache,
+		       connman_property_type_t type,
+		       const gchar *object,
+		       const gchar *property,
+		       GVariant *value,
+		       gint timeout_ms,
+		       connman_wait_cb_t cb,
+		       gpointer user_data)
+{
+	struct wait_entry *entry;
+	guint id;
+
+	entry = g_new0(struct wait_entry, 1);
+	entry->cache = cache;
+	entry->type = type;
+	entry->object = g_strdup(object);
+	entry->property = g_strdup(property);
+	entry->value = g_variant_ref_sink(value);
+	entry->cb = cb;
+	entry->user_data = user_data;
+
+	/* registered before the check so that no change can be missed */
+	g_mutex_lock(&wait_mutex);
+	do {
+		id = wait_next_id++;
+	} while (!id);
+	entry->id = id;
+	wait_entries = g_list_prepend(wait_entries, entry);
+	g_atomic_int_inc(&wait_count);
+
+	if (wait_satisfied(entry)) {
+		wait_remove_unlocked(entry);
+		g_mutex_unlock(&wait_mutex);
+		wait_complete(entry, TRUE);
+		return 0;
+	}
+
+	if (timeout_ms >= 0) {
+		entry->timeout = g_timeout_source_new(timeout_ms);
+		g_source_set_callback(entry->timeout, wait_timeout_cb,
+				      GUINT_TO_POINTER(id), NULL);
+		g_source_attach(entry->timeout, NULL);
+	}
+	g_mutex_unlock(&wait_mutex);
+
+	return id;
+}
+
+EXPORT gboolean connman_wait_cancel(guint id)
+{
+	struct wait_entry *entry = NULL;
+	GList *list;
+
+	g_mutex_lock(&wait_mutex);
+	for (list = wait_entries; list; list = g_list_next(list)) {
+		if (((struct wait_entry *) list->data)->id == id) {
+			entry = list->data;
+			wait_remove_unlocked(entry);
+			break;
+		}
+	}
+	g_mutex_unlock(&wait_mutex);
+
+	if (!entry)
+		return FALSE;
+
+	g_free(entry->object);
+	g_free(entry->property);
+	g_variant_unref(entry->value);
+	g_free(entry);
+
+	return TRUE;
+}
+
+void connman_wait_notify(struct connman_cache *cache,
+			 connman_property_type_t type,
+			 const gchar *object)
+{
+	GSList *done = NULL, *l;
+	GList *list, *next;
+
+	if (!g_atomic_int_get(&wait_count))
+		return;
+
+	g_mutex_lock(&wait_mutex);
+	for (list = wait_entries; list; list = next) {
+		struct wait_entry *entry = list->data;
+
+		next = g_list_next(list);
+		if (entry->cache != cache || entry->type != type ||
+		    g_strcmp0(entry->object, object))
+			continue;
+
+		if (wait_satisfied(entry)) {
+			wait_remove_unlocked(entry);
+			done = g_slist_prepend(done, entry);
+		}
+	}
+	g_mutex_unlock(&wait_mutex);
+
+	for (l = done; l; l = g_slist_next(l))
+		wait_complete(l->data, TRUE);
+	g_slist_free(done);
+}
+
+struct wait_sync {
+	GMutex mutex;
+	GCond cond;
+	gboolean done;
+	gboolean satisfied;
+};
+
+static void wait_sync_cb(gboolean satisfied, gpointer user_data)
+{
+	struct wait_sync *sync = user_data;
+
+	g_mutex_lock(&sync->mutex);
+	sync->satisfied = satisfied;
+	sync->done = TRUE;
+	g_cond_signal(&sync->cond);
+	g_mutex_unlock(&sync->mutex);
+}
+
+gboolean connman_wait_block(struct connman_cache *cache,
+			    connman_property_type_t type,
+			    const gchar *object,
+			    const gchar *property,
+			    GVariant *value,
+			    gint timeout_ms)
+{
+	struct wait_sync sync = { 0 };
+	gint64 end = timeout_ms >= 0 ?
+		g_get_monotonic_time() + timeout_ms * G_TIME_SPAN_MILLISECOND : 0;
+	guint id;
+
+	// The handler thread delivers the changes, it must not wait on them
+	if (g_main_context_is_owner(g_main_context_default())) {
+		ERROR("Cannot wait from the handler thread");
+		g_variant_unref(g_variant_ref_sink(value));
+		return FALSE;
+	}
+
+	g_mutex_init(&sync.mutex);
+	g_cond_init(&sync.cond);
+
+	id = connman_wait_add(cache, type, object, property, value, timeout_ms,
+			      wait_sync_cb, &sync);
+
+	g_mutex_lock(&sync.mutex);
+	while (!sync.done) {
+		if (!end) {
+			g_cond_wait(&sync.cond, &sync.mutex);
+		} else if (!g_cond_wait_until(&sync.cond, &sync.mutex, end)) {
+			// The handler loop is not running the timeout
+			g_mutex_unlock(&sync.mutex);
+			if (connman_wait_cancel(id)) {
+				g_mutex_lock(&sync.mutex);
+				break;
+			}
+			g_mutex_lock(&sync.mutex);
+			end = 0;
+		}
+	}
+	g_mutex_unlock(&sync.mutex);
+
+	g_mutex_clear(&sync.mutex);
+	g_cond_clear(&sync.cond);
+
+	return sync.satisfied;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONNMAN_WAIT_H
+#define CONNMAN_WAIT_H
+
+#include <glib.h>
+
+#include "connman-glib.h"
+
+struct connman_cache;
+
+guint connman_wait_add(struct connman_cache *cache,
+		       connman_property_type_t type,
+		       const gchar *object,
+		       const gchar *property,
+		       GVariant *value,
+		       gint timeout_ms,
+		       connman_wait_cb_t cb,
+		       gpointer user_data);
+
+gboolean connman_wait_block(struct connman_cache *cache,
+			    connman_property_type_t type,
+			    const gchar *object,
+			    const gchar *property,
+			    GVariant *value,
+			    gint timeout_ms);
+
+// Re-evaluates the waits on an object after its cached state changed
+void connman_wait_notify(struct connman_cache *cache,
+			 connman_property_type_t type,
+			 const gchar *object);
+
+#endif /* CONNMAN_WAIT_H */
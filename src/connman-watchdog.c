@@ -0,0 +1,189 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "common.h"
+#include "connman-metrics.h"
+#include "connman-watchdog.h"
+#include "probes.h"
+
+/*
+ * Stall detection for the handler thread.  User callbacks run inline on
+ * it, so each invocation is timed and reported when it exceeds the
+ * threshold, and a heartbeat source measures how late the main loop
+ * dispatches, which catches stalls from any cause.  The heartbeat also
+ * runs for the dispatch lag metrics when no threshold is set.
+ */
+
+#define WATCHDOG_METRICS_INTERVAL_MS	100
+
+static GMutex watchdog_mutex;
+static gint watchdog_threshold_ms;	/* atomic, 0 when disabled */
+static connman_stall_cb_t watchdog_cb;
+static gpointer watchdog_cb_data;
+static GMainContext *watchdog_context;
+static GSource *watchdog_heartbeat;
+static gint64 watchdog_expected;	/* under watchdog_mutex */
+static guint watchdog_interval_ms;	/* under watchdog_mutex */
+
+static void watchdog_report(connman_stall_type_t type,
+			    const char *source,
+			    gpointer callback,
+			    guint64 duration_us)
+{
+	connman_stall_cb_t cb;
+	gpointer cb_data;
+
+	g_mutex_lock(&watchdog_mutex);
+	cb = watchdog_cb;
+	cb_data = watchdog_cb_data;
+	g_mutex_unlock(&watchdog_mutex);
+
+	WARNING("%s stall of %" G_GUINT64_FORMAT " us in %s",
+		type == CONNMAN_STALL_CALLBACK ? "callback" : "dispatch",
+		duration_us, source);
+
+	if (cb)
+		(*cb)(type, source, callback, duration_us, cb_data);
+}
+
+static gboolean watchdog_heartbeat_cb(gpointer user_data)
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 threshold, expected;
+
+	// Rearming from an API thread replaces the heartbeat and its timing
+	g_mutex_lock(&watchdog_mutex);
+	if (watchdog_heartbeat != g_main_current_source()) {
+		g_mutex_unlock(&watchdog_mutex);
+		return G_SOURCE_REMOVE;
+	}
+	threshold = g_atomic_int_get(&watchdog_threshold_ms);
+	expected = watchdog_expected;
+
+	// The timeout is rearmed relative to its dispatch time
+	watchdog_expected = now + (gint64) watchdog_interval_ms * G_TIME_SPAN_MILLISECOND;
+	g_mutex_unlock(&watchdog_mutex);
+
+	connman_metrics_record(CONNMAN_METRICS_DISPATCH, "handler", "heartbeat",
+			       expected, NULL);
+
+	if (threshold && now - expected > threshold * G_TIME_SPAN_MILLISECOND)
+		watchdog_report(CONNMAN_STALL_DISPATCH, "handler", NULL,
+				now - expected);
+
+	return G_SOURCE_CONTINUE;
+}
+
+// Called with watchdog_mutex held
+static void watchdog_rearm_unlocked(void)
+{
+	gint threshold = g_atomic_int_get(&watchdog_threshold_ms);
+
+	if (watchdog_heartbeat) {
+		g_source_destroy(watchdog_heartbeat);
+		g_source_unref(watchdog_heartbeat);
+		watchdog_heartbeat = NULL;
+	}
+
+	if (!((threshold || connman_metrics_enabled()) && watchdog_context))
+		return;
+
+	watchdog_interval_ms = threshold ? MAX(threshold / 2, 1) :
+		WATCHDOG_METRICS_INTERVAL_MS;
+	watchdog_expected = g_get_monotonic_time() +
+		(gint64) watchdog_interval_ms * G_TIME_SPAN_MILLISECOND;
+
+	watchdog_heartbeat = g_timeout_source_new(watchdog_interval_ms);
+	g_source_set_priority(watchdog_heartbeat, G_PRIORITY_HIGH);
+	g_source_set_callback(watchdog_heartbeat, watchdog_heartbeat_cb, NULL, NULL);
+	g_source_attach(watchdog_heartbeat, watchdog_context);
+}
+
+EXPORT void connman_set_stall_callback(connman_stall_cb_t cb,
+				       guint threshold_ms,
+				       gpointer user_data)
+{
+	g_mutex_lock(&watchdog_mutex);
+	watchdog_cb = cb;
+	watchdog_cb_data = user_data;
+	g_atomic_int_set(&watchdog_threshold_ms, MIN(threshold_ms, G_MAXINT));
+	watchdog_rearm_unlocked();
+	g_mutex_unlock(&watchdog_mutex);
+}
+
+void connman_watchdog_attach(GMainContext *context)
+{
+	g_mutex_lock(&watchdog_mutex);
+	watchdog_context = context;
+	watchdog_rearm_unlocked();
+	g_mutex_unlock(&watchdog_mutex);
+}
+
+void connman_watchdog_update(void)
+{
+	g_mutex_lock(&watchdog_mutex);
+	watchdog_rearm_unlocked();
+	g_mutex_unlock(&watchdog_mutex);
+}
+
+void connman_watchdog_detach(void)
+{
+	g_mutex_lock(&watchdog_mutex);
+	watchdog_context = NULL;
+	watchdog_rearm_unlocked();
+	g_mutex_unlock(&watchdog_mutex);
+}
+
+gint64 connman_callback_start(const char *object,
+			      const char *member,
+			      gpointer callback)
+{
+	gint64 start = connman_metrics_start();
+
+	CONNMAN_PROBE(callback__start, object, member, callback);
+
+	if (!start && g_atomic_int_get(&watchdog_threshold_ms))
+		start = g_get_monotonic_time();
+
+	return start;
+}
+
+void connman_callback_done(const char *object,
+			   const char *member,
+			   gpointer callback,
+			   gint64 start)
+{
+	gint64 threshold = g_atomic_int_get(&watchdog_threshold_ms);
+	gint64 duration;
+
+	CONNMAN_PROBE(callback__done, object, member, callback);
+
+	if (!start)
+		return;
+
+	connman_metrics_record(CONNMAN_METRICS_CALLBACK, object, member, start, NULL);
+
+	duration = g_get_monotonic_time() - start;
+	if (threshold && duration > threshold * G_TIME_SPAN_MILLISECOND) {
+		gchar source[128];
+
+		g_snprintf(source, sizeof(source), "%s:%s", object, member);
+		watchdog_report(CONNMAN_STALL_CALLBACK, source, callback, duration);
+	}
+}
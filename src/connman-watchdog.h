@@ -0,0 +1,42 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONNMAN_WATCHDOG_H
+#define CONNMAN_WATCHDOG_H
+
+#include <glib.h>
+
+void connman_watchdog_attach(GMainContext *context);
+
+void connman_watchdog_detach(void);
+
+// Starts or stops the heartbeat after the metrics were toggled
+void connman_watchdog_update(void);
+
+/*
+ * Time a user callback for both the metrics and the stall detector; the
+ * start timestamp is 0 when neither is enabled.
+ */
+gint64 connman_callback_start(const char *object,
+			      const char *member,
+			      gpointer callback);
+
+void connman_callback_done(const char *object,
+			   const char *member,
+			   gpointer callback,
+			   gint64 start);
+
+#endif /* CONNMAN_WATCHDOG_H */
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Emulates a dense radio environment: N services with randomized
+ * properties, property jitter at R Hz and periodic ServicesChanged churn.
+ * The load either comes over a private bus from mock-connmand (--mock) or
+ * is injected straight into the signal handlers with
+ * connman_inject_signal(), which leaves out the socket and GDBus worker.
+ * A JSON summary of what the callbacks saw is printed at the end.
+ *
+ * With --capture the traffic is also recorded for connman-glib-replay.
+ *
+ * Usage: connman-glib-loadgen --mock /path/to/mock-connmand [options]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "mock-client.h"
+
+#define SERVICE_PREFIX		"/net/connman/service/"
+#define TICK_MS			10
+
+static struct {
+	GMutex mutex;
+	guint manager_events;
+	guint property_events;
+	GArray *queue_delays;	/* gint64 */
+	GArray *latencies;	/* gint64, bus mode only */
+	guint64 last_sequence;
+	guint sequence_gaps;
+} stats;
+
+// Called with the stats lock held, for every kind of event
+static void note_sequence_unlocked(const connman_event_info_t *info)
+{
+	if (stats.last_sequence && info->sequence != stats.last_sequence + 1)
+		stats.sequence_gaps++;
+	stats.last_sequence = info->sequence;
+}
+
+static void manager_cb(const gchar *path,
+		       connman_manager_event_t event,
+		       GVariant *properties,
+		       const connman_event_info_t *info,
+		       gpointer user_data)
+{
+	g_mutex_lock(&stats.mutex);
+	stats.manager_events++;
+	note_sequence_unlocked(info);
+	g_mutex_unlock(&stats.mutex);
+}
+
+static void technology_property_cb(const gchar *technology,
+				   GVariant *properties,
+				   const connman_event_info_t *info,
+				   gpointer user_data)
+{
+	g_mutex_lock(&stats.mutex);
+	note_sequence_unlocked(info);
+	g_mutex_unlock(&stats.mutex);
+}
+
+static void service_property_cb(const gchar *service,
+				GVariant *property,
+				const connman_event_info_t *info,
+				gpointer user_data)
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 delay = info->dispatch_time - info->receive_time;
+	const gchar *name = NULL;
+	GVariant *value = NULL;
+
+	g_variant_get(property, "(&sv)", &name, &value);
+
+	g_mutex_lock(&stats.mutex);
+	stats.property_events++;
+	g_array_append_val(stats.queue_delays, delay);
+	if (!g_strcmp0(name, "MockTimestamp") &&
+	    g_variant_is_of_type(value, G_VARIANT_TYPE_INT64)) {
+		gint64 latency = now - g_variant_get_int64(value);
+
+		g_array_append_val(stats.latencies, latency);
+	}
+	note_sequence_unlocked(info);
+	g_mutex_unlock(&stats.mutex);
+
+	g_variant_unref(value);
+}
+
+static GVariant *random_service(const gchar *name)
+{
+	static const gchar *security[] = { "none", "psk", "ieee8021x", "wps" };
+	const gchar *methods[] = { security[g_random_int_range(0, 4)], NULL };
+	GVariantBuilder props;
+
+	g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&props, "{sv}", "Name", g_variant_new_string(name));
+	g_variant_builder_add(&props, "{sv}", "Type", g_variant_new_string("wifi"));
+	g_variant_builder_add(&props, "{sv}", "Security", g_variant_new_strv(methods, -1));
+	g_variant_builder_add(&props, "{sv}", "State", g_variant_new_string("idle"));
+	g_variant_builder_add(&props, "{sv}", "Strength",
+			      g_variant_new_byte(g_random_int_range(0, 101)));
+	g_variant_builder_add(&props, "{sv}", "Favorite",
+			      g_variant_new_boolean(g_random_boolean()));
+
+	return g_variant_new("(o@a{sv})", name, g_variant_builder_end(&props));
+}
+
+// Replace count random services, or add count if there are none
+static void inject_churn(GPtrArray *services, guint count, guint *serial)
+{
+	GVariantBuilder changed, removed;
+	guint i;
+
+	g_variant_builder_init(&changed, G_VARIANT_TYPE("a(oa{sv})"));
+	g_variant_builder_init(&removed, G_VARIANT_TYPE("ao"));
+
+	for (i = 0; i < count && services->len; i++) {
+		guint n = g_random_int_range(0, services->len);
+
+		g_variant_builder_add(&removed, "o", g_ptr_array_index(services, n));
+		g_ptr_array_remove_index_fast(services, n);
+	}
+	for (i = 0; i < count; i++) {
+		gchar *path = g_strdup_printf(SERVICE_PREFIX "wifi_load_%06u_managed_psk",
+					      (*serial)++);
+
+		g_variant_builder_add_value(&changed, random_service(path));
+		g_ptr_array_add(services, path);
+	}
+
+	connman_inject_signal("/", "net.connman.Manager", "ServicesChanged",
+			      g_variant_new("(@a(oa{sv})@ao)",
+					    g_variant_builder_end(&changed),
+					    g_variant_builder_end(&removed)));
+}
+
+static guint64 run_inject(guint services, guint rate, guint churn_ms,
+			  guint churn_count, guint duration)
+{
+	GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+	gint64 start = g_get_monotonic_time();
+	gint64 end = start + (gint64) duration * G_TIME_SPAN_SECOND;
+	gint64 next_churn = start + (gint64) churn_ms * 1000;
+	guint64 injected = 0;
+	gdouble owed = 0;
+	guint serial = 0;
+
+	inject_churn(paths, services, &serial);
+	injected++;
+
+	while (g_get_monotonic_time() < end) {
+		guint i;
+
+		g_usleep(TICK_MS * 1000);
+
+		owed += rate * TICK_MS / 1000.0;
+		for (i = 0; i < (guint) owed && paths->len; i++) {
+			const gchar *path = g_ptr_array_index(paths,
+							      g_random_int_range(0, paths->len));
+
+			connman_inject_signal(path, "net.connman.Service", "PropertyChanged",
+					      g_variant_new("(sv)", "Strength",
+							    g_variant_new_byte(g_random_int_range(0, 101))));
+			injected++;
+		}
+		owed -= i;
+
+		if (churn_ms && g_get_monotonic_time() >= next_churn) {
+			inject_churn(paths, churn_count, &serial);
+			injected++;
+			next_churn += (gint64) churn_ms * 1000;
+		}
+	}
+
+	g_ptr_array_unref(paths);
+	return injected;
+}
+
+int main(int argc, char *argv[])
+{
+	gchar *mock = NULL, *capture = NULL;
+	gboolean inject = FALSE, metrics = FALSE;
+	gint services = 1000, rate = 1000, churn_ms = 1000, churn_count = 50, duration = 10;
+	GOptionEntry entries[] = {
+		{ "mock", 'm', 0, G_OPTION_ARG_FILENAME, &mock,
+		  "mock-connmand to run, provides the bus", "PATH" },
+		{ "inject", 'i', 0, G_OPTION_ARG_NONE, &inject,
+		  "Inject the load into the handlers instead of sending it over the bus", NULL },
+		{ "services", 'n', 0, G_OPTION_ARG_INT, &services,
+		  "Number of services", "N" },
+		{ "rate", 'r', 0, G_OPTION_ARG_INT, &rate,
+		  "Property changes per second", "HZ" },
+		{ "churn-interval", 'c', 0, G_OPTION_ARG_INT, &churn_ms,
+		  "ServicesChanged churn interval, 0 disables", "MS" },
+		{ "churn-count", 'k', 0, G_OPTION_ARG_INT, &churn_count,
+		  "Services replaced on each churn", "K" },
+		{ "duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+		  "Seconds to run", "S" },
+		{ "metrics", 0, 0, G_OPTION_ARG_NONE, &metrics,
+		  "Also print the library metrics in OpenMetrics format", NULL },
+		{ "capture", 0, 0, G_OPTION_ARG_FILENAME, &capture,
+		  "Record the traffic for connman-glib-replay", "FILE" },
+		{ NULL }
+	};
+	GOptionContext *context;
+	GError *error = NULL;
+	guint64 injected = 0;
+	GString *out;
+
+	context = g_option_context_new("- connman-glib load generator");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error) || !mock) {
+		g_printerr("%s\n", error ? error->message : "--mock is required");
+		return 1;
+	}
+	g_option_context_free(context);
+
+	g_mutex_init(&stats.mutex);
+	stats.queue_delays = g_array_new(FALSE, FALSE, sizeof(gint64));
+	stats.latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+	// The mock provides the bus in both modes
+	if (!mock_client_start(mock, inject ? 0 : services))
+		return 1;
+
+	connman_metrics_enable(metrics);
+	if (capture && !connman_capture_start(capture)) {
+		g_printerr("Cannot write %s\n", capture);
+		return 1;
+	}
+	connman_add_manager_event_callback_full(manager_cb, NULL);
+	connman_add_technology_property_event_callback_full(technology_property_cb, NULL);
+	connman_add_service_property_event_callback_full(service_property_cb, NULL);
+	if (!connman_init(FALSE)) {
+		g_printerr("connman_init failed\n");
+		return 1;
+	}
+
+	if (inject) {
+		injected = run_inject(services, rate, churn_ms, churn_count, duration);
+	} else {
+		mock_client_command("storm %d %d", rate * duration, rate);
+		if (churn_ms)
+			mock_client_command("churn %d %d", churn_ms, churn_count);
+		g_usleep((gulong) duration * G_USEC_PER_SEC);
+		mock_client_command("churn 0 0");
+	}
+
+	// Let the handler thread catch up
+	g_usleep(G_USEC_PER_SEC);
+	if (capture)
+		connman_capture_stop();
+
+	g_mutex_lock(&stats.mutex);
+	out = g_string_new(NULL);
+	g_string_append_printf(out,
+			       "{\n  \"mode\": \"%s\",\n  \"services\": %d,\n  \"rate\": %d,\n"
+			       "  \"churn_interval_ms\": %d,\n  \"churn_count\": %d,\n"
+			       "  \"duration_s\": %d,\n",
+			       inject ? "inject" : "bus", services, rate,
+			       churn_ms, churn_count, duration);
+	if (inject)
+		g_string_append_printf(out, "  \"injected\": %" G_GUINT64_FORMAT ",\n", injected);
+	g_string_append_printf(out,
+			       "  \"manager_events\": %u,\n  \"property_events\": %u,\n"
+			       "  \"property_events_per_s\": %.1f,\n"
+			       "  \"sequence_gaps\": %u,\n  \"queue_delay\": { ",
+			       stats.manager_events, stats.property_events,
+			       (gdouble) stats.property_events / MAX(duration, 1),
+			       stats.sequence_gaps);
+	mock_client_percentiles(out, stats.queue_delays);
+	g_string_append(out, " },\n  \"latency\": { ");
+	mock_client_percentiles(out, stats.latencies);
+	g_string_append(out, " }\n}\n");
+	g_mutex_unlock(&stats.mutex);
+
+	fputs(out->str, stdout);
+	g_string_free(out, TRUE);
+
+	if (metrics) {
+		gchar *text = connman_metrics_openmetrics();
+
+		fputs(text, stdout);
+		g_free(text);
+	}
+
+	mock_client_stop();
+
+	return 0;
+}
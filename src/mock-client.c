@@ -0,0 +1,115 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "mock-client.h"
+
+static GPid mock_pid;
+static int mock_stdin = -1;
+
+gboolean mock_client_start(const gchar *path, guint services)
+{
+	gchar *services_arg = g_strdup_printf("%u", services);
+	gchar *mock_argv[] = { (gchar *) path, "--services", services_arg, NULL };
+	GError *error = NULL;
+	GIOChannel *mock_out;
+	gchar *line = NULL;
+	int mock_stdout;
+	gboolean started;
+
+	started = g_spawn_async_with_pipes(NULL, mock_argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD,
+					   NULL, NULL, &mock_pid,
+					   &mock_stdin, &mock_stdout, NULL, &error);
+	g_free(services_arg);
+	if (!started) {
+		g_printerr("Cannot start %s: %s\n", path, error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+
+	mock_out = g_io_channel_unix_new(mock_stdout);
+	if (g_io_channel_read_line(mock_out, &line, NULL, NULL, NULL) != G_IO_STATUS_NORMAL ||
+	    !g_str_has_prefix(line, "DBUS_ADDRESS=")) {
+		g_printerr("mock-connmand did not start\n");
+		g_free(line);
+		return FALSE;
+	}
+	g_strstrip(line);
+	connman_set_bus_address(line + strlen("DBUS_ADDRESS="));
+	g_free(line);
+
+	return TRUE;
+}
+
+void mock_client_command(const gchar *format, ...)
+{
+	gchar *line;
+	va_list args;
+	gsize len;
+
+	va_start(args, format);
+	line = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	len = strlen(line);
+	if (write(mock_stdin, line, len) != (ssize_t) len ||
+	    write(mock_stdin, "\n", 1) != 1)
+		g_printerr("Failed to send '%s' to mock-connmand\n", line);
+	g_free(line);
+}
+
+void mock_client_stop(void)
+{
+	if (mock_stdin < 0)
+		return;
+
+	mock_client_command("quit");
+	waitpid(mock_pid, NULL, 0);
+	g_spawn_close_pid(mock_pid);
+	close(mock_stdin);
+	mock_stdin = -1;
+}
+
+static gint compare_gint64(gconstpointer a, gconstpointer b)
+{
+	gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+void mock_client_percentiles(GString *out, GArray *samples)
+{
+	gint64 *v = (gint64 *) samples->data;
+	guint n = samples->len;
+
+	g_array_sort(samples, compare_gint64);
+	g_string_append_printf(out, "\"count\": %u", n);
+	if (!n)
+		return;
+	g_string_append_printf(out,
+			       ", \"p50_us\": %" G_GINT64_FORMAT
+			       ", \"p90_us\": %" G_GINT64_FORMAT
+			       ", \"p99_us\": %" G_GINT64_FORMAT
+			       ", \"max_us\": %" G_GINT64_FORMAT,
+			       v[n / 2], v[n * 9 / 10], v[n * 99 / 100], v[n - 1]);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MOCK_CLIENT_H
+#define MOCK_CLIENT_H
+
+#include <glib.h>
+
+/*
+ * Shared by the tools that drive the library against mock-connmand: it
+ * runs the mock with the given number of services and points the library
+ * at its bus, so call it before connman_init().
+ */
+gboolean mock_client_start(const gchar *path, guint services);
+
+// Sends one of the commands listed in mock-connmand.c
+void mock_client_command(const gchar *format, ...) G_GNUC_PRINTF(1, 2);
+
+// Quits mock-connmand and waits for it to exit
+void mock_client_stop(void);
+
+// Appends "count", percentiles and max of gint64 samples, which get sorted
+void mock_client_percentiles(GString *out, GArray *samples);
+
+#endif /* MOCK_CLIENT_H */
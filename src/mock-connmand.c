@@ -0,0 +1,1084 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Scriptable stand-in for connmand on a private bus, for exercising the
+ * library without Wi-Fi hardware.  Without --address it starts its own
+ * dbus-daemon and prints "DBUS_ADDRESS=<address>" once net.connman is
+ * owned; pass that to connman_set_bus_address().
+ *
+ * Commands are read from --script and then stdin, one per line:
+ *
+ *   latency <ms>			delay every method reply
+ *   add-service <name> [<security>]	add a wifi service (default psk)
+ *   remove-service <name>
+ *   set-manager <property> <value>	values in GVariant text format
+ *   set-technology <name> <property> <value>
+ *   set-service <name> <property> <value>
+ *   storm <count> [<rate>]		MockTimestamp changes (monotonic send
+ *					time in us) across the services, paced
+ *					at rate per second in the background if
+ *					given
+ *   churn <interval ms> <count>	every interval, replace count random
+ *					services in one ServicesChanged (0 stops)
+ *   services-changed			emit ServicesChanged for all services
+ *   fail-connect <name> <count> <error> [<service error>]
+ *					fail the next count Connects with the
+ *					D-Bus error name, setting the service
+ *					Error property first if given (0 count
+ *					clears)
+ *   agent-cancel			call Cancel on the registered agent
+ *   restart				drop and reacquire net.connman
+ *   sleep <ms>				pause command processing
+ *   quit
+ *
+ * Each Scan bumps the technology's MockScans property and each Connect
+ * the service's MockConnects, so callers can count them.  The passphrase
+ * the agent answers a Connect with is kept in MockPassphrase.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#define CONNMAN_SERVICE			"net.connman"
+#define CONNMAN_MANAGER_INTERFACE	CONNMAN_SERVICE ".Manager"
+#define CONNMAN_TECHNOLOGY_INTERFACE	CONNMAN_SERVICE ".Technology"
+#define CONNMAN_SERVICE_INTERFACE	CONNMAN_SERVICE ".Service"
+#define CONNMAN_AGENT_INTERFACE		CONNMAN_SERVICE ".Agent"
+#define CONNMAN_TECHNOLOGY_PREFIX	"/net/connman/technology/"
+#define CONNMAN_SERVICE_PREFIX		"/net/connman/service/"
+
+static const gchar introspection_xml[] =
+	"<node>"
+	"  <interface name='net.connman.Manager'>"
+	"    <method name='GetProperties'>"
+	"      <arg name='properties' type='a{sv}' direction='out'/>"
+	"    </method>"
+	"    <method name='SetProperty'>"
+	"      <arg name='name' type='s' direction='in'/>"
+	"      <arg name='value' type='v' direction='in'/>"
+	"    </method>"
+	"    <method name='GetTechnologies'>"
+	"      <arg name='technologies' type='a(oa{sv})' direction='out'/>"
+	"    </method>"
+	"    <method name='GetServices'>"
+	"      <arg name='services' type='a(oa{sv})' direction='out'/>"
+	"    </method>"
+	"    <method name='RegisterAgent'>"
+	"      <arg name='path' type='o' direction='in'/>"
+	"    </method>"
+	"    <method name='UnregisterAgent'>"
+	"      <arg name='path' type='o' direction='in'/>"
+	"    </method>"
+	"    <signal name='PropertyChanged'>"
+	"      <arg name='name' type='s'/>"
+	"      <arg name='value' type='v'/>"
+	"    </signal>"
+	"    <signal name='TechnologyAdded'>"
+	"      <arg name='path' type='o'/>"
+	"      <arg name='properties' type='a{sv}'/>"
+	"    </signal>"
+	"    <signal name='TechnologyRemoved'>"
+	"      <arg name='path' type='o'/>"
+	"    </signal>"
+	"    <signal name='ServicesChanged'>"
+	"      <arg name='changed' type='a(oa{sv})'/>"
+	"      <arg name='removed' type='ao'/>"
+	"    </signal>"
+	"  </interface>"
+	"  <interface name='net.connman.Technology'>"
+	"    <method name='GetProperties'>"
+	"      <arg name='properties' type='a{sv}' direction='out'/>"
+	"    </method>"
+	"    <method name='SetProperty'>"
+	"      <arg name='name' type='s' direction='in'/>"
+	"      <arg name='value' type='v' direction='in'/>"
+	"    </method>"
+	"    <method name='Scan'/>"
+	"    <signal name='PropertyChanged'>"
+	"      <arg name='name' type='s'/>"
+	"      <arg name='value' type='v'/>"
+	"    </signal>"
+	"  </interface>"
+	"  <interface name='net.connman.Service'>"
+	"    <method name='GetProperties'>"
+	"      <arg name='properties' type='a{sv}' direction='out'/>"
+	"    </method>"
+	"    <method name='SetProperty'>"
+	"      <arg name='name' type='s' direction='in'/>"
+	"      <arg name='value' type='v' direction='in'/>"
+	"    </method>"
+	"    <method name='ClearProperty'>"
+	"      <arg name='name' type='s' direction='in'/>"
+	"    </method>"
+	"    <method name='Connect'/>"
+	"    <method name='Disconnect'/>"
+	"    <method name='Remove'/>"
+	"    <method name='MoveBefore'>"
+	"      <arg name='service' type='o' direction='in'/>"
+	"    </method>"
+	"    <method name='MoveAfter'>"
+	"      <arg name='service' type='o' direction='in'/>"
+	"    </method>"
+	"    <signal name='PropertyChanged'>"
+	"      <arg name='name' type='s'/>"
+	"      <arg name='value' type='v'/>"
+	"    </signal>"
+	"  </interface>"
+	"</node>";
+
+struct mock_object {
+	gchar *name;
+	gchar *path;
+	GHashTable *properties;	/* name -> GVariant */
+	guint registration_id;
+};
+
+struct mock_state {
+	GMainLoop *loop;
+	GDBusConnection *conn;
+	GDBusNodeInfo *node;
+	guint owner_id;
+	gboolean announced;
+	guint latency_ms;
+
+	GHashTable *manager_properties;
+	GHashTable *technologies;	/* name -> struct mock_object */
+	GQueue services;		/* struct mock_object, in ConnMan order */
+
+	gchar *agent_sender;
+	gchar *agent_path;
+
+	GHashTable *connect_failures;	/* service -> struct connect_failure */
+
+	GQueue commands;
+	guint sleep_id;
+	guint storm_position;
+	guint storm_id;
+	guint storm_remaining;
+	guint storm_per_tick;
+	guint churn_id;
+	guint churn_count;
+	guint churn_serial;
+};
+
+static struct mock_state mock;
+
+struct connect_failure {
+	guint count;
+	gchar *error;
+	gchar *service_error;	/* may be NULL */
+};
+
+struct delayed_reply {
+	GDBusMethodInvocation *invocation;
+	GVariant *value;
+};
+
+static void process_commands(void);
+
+static void connect_failure_free(gpointer data)
+{
+	struct connect_failure *failure = data;
+
+	g_free(failure->error);
+	g_free(failure->service_error);
+	g_free(failure);
+}
+
+static GHashTable *properties_new(void)
+{
+	return g_hash_table_new_full(g_str_hash, g_str_equal,
+				     g_free, (GDestroyNotify) g_variant_unref);
+}
+
+static void properties_set(GHashTable *properties, const gchar *name, GVariant *value)
+{
+	g_hash_table_replace(properties, g_strdup(name), g_variant_ref_sink(value));
+}
+
+static GVariant *properties_dict(GHashTable *properties)
+{
+	GVariantBuilder builder;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+	g_hash_table_iter_init(&iter, properties);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		g_variant_builder_add(&builder, "{sv}", key, value);
+
+	return g_variant_builder_end(&builder);
+}
+
+static gboolean delayed_reply_cb(gpointer user_data)
+{
+	struct delayed_reply *d = user_data;
+
+	g_dbus_method_invocation_return_value(d->invocation, d->value);
+	if (d->value)
+		g_variant_unref(d->value);
+	g_free(d);
+
+	return G_SOURCE_REMOVE;
+}
+
+// Reply after the configured latency, value may be NULL
+static void mock_reply(GDBusMethodInvocation *invocation, GVariant *value)
+{
+	struct delayed_reply *d;
+
+	if (!mock.latency_ms) {
+		g_dbus_method_invocation_return_value(invocation, value);
+		return;
+	}
+
+	d = g_new0(struct delayed_reply, 1);
+	d->invocation = invocation;
+	d->value = value ? g_variant_ref_sink(value) : NULL;
+	g_timeout_add(mock.latency_ms, delayed_reply_cb, d);
+}
+
+static void emit_signal(const gchar *path,
+			const gchar *interface,
+			const gchar *signal,
+			GVariant *parameters)
+{
+	GError *error = NULL;
+
+	if (!g_dbus_connection_emit_signal(mock.conn, NULL, path, interface,
+					   signal, parameters, &error)) {
+		g_printerr("Failed to emit %s: %s\n", signal, error->message);
+		g_error_free(error);
+	}
+}
+
+static void emit_property_changed(const gchar *path,
+				  const gchar *interface,
+				  const gchar *name,
+				  GVariant *value)
+{
+	emit_signal(path, interface, "PropertyChanged",
+		    g_variant_new("(sv)", name, value));
+}
+
+static void object_set_property(struct mock_object *obj,
+				const gchar *interface,
+				const gchar *name,
+				GVariant *value)
+{
+	properties_set(obj->properties, name, value);
+	emit_property_changed(obj->path, interface, name, value);
+}
+
+// Counts calls in a uint32 property that callers can read back
+static void object_bump_counter(struct mock_object *obj,
+				const gchar *interface,
+				const gchar *name)
+{
+	GVariant *count = g_hash_table_lookup(obj->properties, name);
+
+	object_set_property(obj, interface, name,
+			    g_variant_new_uint32(count ? g_variant_get_uint32(count) + 1 : 1));
+}
+
+static GVariant *objects_array(GList *objects)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(oa{sv})"));
+	for (; objects; objects = objects->next) {
+		struct mock_object *obj = objects->data;
+
+		g_variant_builder_add(&builder, "(o@a{sv})", obj->path,
+				      properties_dict(obj->properties));
+	}
+
+	return g_variant_builder_end(&builder);
+}
+
+// removed is a list of object paths
+static void emit_services_changed(GList *changed, GList *removed)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("ao"));
+	for (; removed; removed = removed->next)
+		g_variant_builder_add(&builder, "o", removed->data);
+
+	emit_signal("/", CONNMAN_MANAGER_INTERFACE, "ServicesChanged",
+		    g_variant_new("(@a(oa{sv})@ao)", objects_array(changed),
+				  g_variant_builder_end(&builder)));
+}
+
+static void mock_object_free(gpointer data)
+{
+	struct mock_object *obj = data;
+
+	if (obj->registration_id)
+		g_dbus_connection_unregister_object(mock.conn, obj->registration_id);
+	g_hash_table_unref(obj->properties);
+	g_free(obj->path);
+	g_free(obj->name);
+	g_free(obj);
+}
+
+static struct mock_object *service_lookup(const gchar *name, GList **link)
+{
+	GList *l;
+
+	for (l = mock.services.head; l; l = l->next) {
+		struct mock_object *obj = l->data;
+
+		if (!g_strcmp0(obj->name, name)) {
+			if (link)
+				*link = l;
+			return obj;
+		}
+	}
+
+	return NULL;
+}
+
+static void handle_manager_call(GDBusMethodInvocation *invocation,
+				const gchar *method,
+				GVariant *parameters)
+{
+	if (!g_strcmp0(method, "GetProperties")) {
+		mock_reply(invocation,
+			   g_variant_new("(@a{sv})", properties_dict(mock.manager_properties)));
+	} else if (!g_strcmp0(method, "SetProperty")) {
+		const gchar *name;
+		GVariant *value;
+
+		g_variant_get(parameters, "(&sv)", &name, &value);
+		properties_set(mock.manager_properties, name, value);
+		emit_property_changed("/", CONNMAN_MANAGER_INTERFACE, name, value);
+		g_variant_unref(value);
+		mock_reply(invocation, NULL);
+	} else if (!g_strcmp0(method, "GetTechnologies")) {
+		GList *technologies = g_hash_table_get_values(mock.technologies);
+
+		mock_reply(invocation, g_variant_new("(@a(oa{sv}))",
+						     objects_array(technologies)));
+		g_list_free(technologies);
+	} else if (!g_strcmp0(method, "GetServices")) {
+		mock_reply(invocation, g_variant_new("(@a(oa{sv}))",
+						     objects_array(mock.services.head)));
+	} else if (!g_strcmp0(method, "RegisterAgent")) {
+		const gchar *path;
+
+		g_variant_get(parameters, "(&o)", &path);
+		g_free(mock.agent_sender);
+		g_free(mock.agent_path);
+		mock.agent_sender = g_strdup(g_dbus_method_invocation_get_sender(invocation));
+		mock.agent_path = g_strdup(path);
+		mock_reply(invocation, NULL);
+	} else if (!g_strcmp0(method, "UnregisterAgent")) {
+		g_clear_pointer(&mock.agent_sender, g_free);
+		g_clear_pointer(&mock.agent_path, g_free);
+		mock_reply(invocation, NULL);
+	} else {
+		g_dbus_method_invocation_return_dbus_error(invocation,
+							   "net.connman.Error.NotImplemented",
+							   "Not implemented");
+	}
+}
+
+static void handle_technology_call(struct mock_object *tech,
+				   GDBusMethodInvocation *invocation,
+				   const gchar *method,
+				   GVariant *parameters)
+{
+	if (!g_strcmp0(method, "GetProperties")) {
+		mock_reply(invocation,
+			   g_variant_new("(@a{sv})", properties_dict(tech->properties)));
+	} else if (!g_strcmp0(method, "SetProperty")) {
+		const gchar *name;
+		GVariant *value;
+
+		g_variant_get(parameters, "(&sv)", &name, &value);
+		object_set_property(tech, CONNMAN_TECHNOLOGY_INTERFACE, name, value);
+		g_variant_unref(value);
+		mock_reply(invocation, NULL);
+	} else if (!g_strcmp0(method, "Scan")) {
+		object_bump_counter(tech, CONNMAN_TECHNOLOGY_INTERFACE, "MockScans");
+		// A real scan refreshes every service
+		emit_services_changed(mock.services.head, NULL);
+		mock_reply(invocation, NULL);
+	} else {
+		g_dbus_method_invocation_return_dbus_error(invocation,
+							   "net.connman.Error.NotImplemented",
+							   "Not implemented");
+	}
+}
+
+struct connect_data {
+	gchar *service;
+	GDBusMethodInvocation *invocation;
+};
+
+static void service_set_state(struct mock_object *svc, const gchar *state)
+{
+	object_set_property(svc, CONNMAN_SERVICE_INTERFACE, "State",
+			    g_variant_new_string(state));
+}
+
+static void connect_finish(struct connect_data *cd, const gchar *error)
+{
+	struct mock_object *svc = service_lookup(cd->service, NULL);
+
+	if (!svc) {
+		g_dbus_method_invocation_return_dbus_error(cd->invocation,
+							   "net.connman.Error.Aborted",
+							   "Service removed");
+	} else if (error) {
+		service_set_state(svc, "failure");
+		g_dbus_method_invocation_return_dbus_error(cd->invocation,
+							   "net.connman.Error.Failed",
+							   error);
+	} else {
+		service_set_state(svc, "association");
+		service_set_state(svc, "configuration");
+		service_set_state(svc, "ready");
+		mock_reply(cd->invocation, NULL);
+	}
+
+	g_free(cd->service);
+	g_free(cd);
+}
+
+static void request_input_cb(GObject *source_object,
+			     GAsyncResult *res,
+			     gpointer user_data)
+{
+	struct connect_data *cd = user_data;
+	const gchar *passphrase = NULL;
+	struct mock_object *svc;
+	GError *error = NULL;
+	GVariant *reply, *fields;
+
+	reply = g_dbus_connection_call_finish(mock.conn, res, &error);
+	if (!reply) {
+		connect_finish(cd, error->message);
+		g_error_free(error);
+		return;
+	}
+
+	// Recorded so callers can check what the agent answered with
+	svc = service_lookup(cd->service, NULL);
+	fields = g_variant_get_child_value(reply, 0);
+	if (svc && g_variant_lookup(fields, "Passphrase", "&s", &passphrase))
+		object_set_property(svc, CONNMAN_SERVICE_INTERFACE, "MockPassphrase",
+				    g_variant_new_string(passphrase));
+	g_variant_unref(fields);
+	g_variant_unref(reply);
+	connect_finish(cd, NULL);
+}
+
+static void service_connect(struct mock_object *svc, GDBusMethodInvocation *invocation)
+{
+	struct connect_data *cd = g_new0(struct connect_data, 1);
+	GVariant *security = g_hash_table_lookup(svc->properties, "Security");
+	const gchar **methods = security ? g_variant_get_strv(security, NULL) : NULL;
+	gboolean secured = methods && methods[0] && g_strcmp0(methods[0], "none");
+	GVariantBuilder fields, passphrase;
+	struct connect_failure *failure;
+
+	g_free(methods);
+
+	object_bump_counter(svc, CONNMAN_SERVICE_INTERFACE, "MockConnects");
+	failure = g_hash_table_lookup(mock.connect_failures, svc->name);
+	if (failure) {
+		if (failure->service_error)
+			object_set_property(svc, CONNMAN_SERVICE_INTERFACE, "Error",
+					    g_variant_new_string(failure->service_error));
+		service_set_state(svc, "failure");
+		g_dbus_method_invocation_return_dbus_error(invocation, failure->error,
+							   "Mock connect failure");
+		if (!--failure->count)
+			g_hash_table_remove(mock.connect_failures, svc->name);
+		g_free(cd);
+		return;
+	}
+
+	cd->service = g_strdup(svc->name);
+	cd->invocation = invocation;
+
+	if (!(secured && mock.agent_path)) {
+		connect_finish(cd, NULL);
+		return;
+	}
+
+	g_variant_builder_init(&passphrase, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&passphrase, "{sv}", "Type", g_variant_new_string("psk"));
+	g_variant_builder_add(&passphrase, "{sv}", "Requirement",
+			      g_variant_new_string("mandatory"));
+	g_variant_builder_init(&fields, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&fields, "{sv}", "Passphrase",
+			      g_variant_builder_end(&passphrase));
+
+	g_dbus_connection_call(mock.conn, mock.agent_sender, mock.agent_path,
+			       CONNMAN_AGENT_INTERFACE, "RequestInput",
+			       g_variant_new("(o@a{sv})", svc->path,
+					     g_variant_builder_end(&fields)),
+			       G_VARIANT_TYPE("(a{sv})"),
+			       G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+			       request_input_cb, cd);
+}
+
+static void service_remove(const gchar *name)
+{
+	GList *link = NULL;
+	struct mock_object *svc = service_lookup(name, &link);
+	gchar *path;
+
+	if (!svc)
+		return;
+
+	path = g_strdup(svc->path);
+	g_queue_delete_link(&mock.services, link);
+	mock_object_free(svc);
+	emit_services_changed(NULL, &(GList) { .data = path });
+	g_free(path);
+}
+
+static void handle_service_call(struct mock_object *svc,
+				GDBusMethodInvocation *invocation,
+				const gchar *method,
+				GVariant *parameters)
+{
+	if (!g_strcmp0(method, "GetProperties")) {
+		mock_reply(invocation,
+			   g_variant_new("(@a{sv})", properties_dict(svc->properties)));
+	} else if (!g_strcmp0(method, "SetProperty")) {
+		const gchar *name;
+		GVariant *value;
+
+		g_variant_get(parameters, "(&sv)", &name, &value);
+		object_set_property(svc, CONNMAN_SERVICE_INTERFACE, name, value);
+		g_variant_unref(value);
+		mock_reply(invocation, NULL);
+	} else if (!g_strcmp0(method, "ClearProperty")) {
+		const gchar *name;
+
+		// Like ConnMan, drop the property but announce it as empty
+		g_variant_get(parameters, "(&s)", &name);
+		if (!g_strcmp0(name, "Error") &&
+		    g_hash_table_remove(svc->properties, name))
+			emit_property_changed(svc->path, CONNMAN_SERVICE_INTERFACE,
+					      name, g_variant_new_string(""));
+		mock_reply(invocation, NULL);
+	} else if (!g_strcmp0(method, "Connect")) {
+		service_connect(svc, invocation);
+	} else if (!g_strcmp0(method, "Disconnect")) {
+		service_set_state(svc, "idle");
+		mock_reply(invocation, NULL);
+	} else if (!g_strcmp0(method, "Remove")) {
+		service_remove(svc->name);
+		mock_reply(invocation, NULL);
+	} else if (!g_strcmp0(method, "MoveBefore") || !g_strcmp0(method, "MoveAfter")) {
+		const gchar *path;
+		GList *link = NULL, *target = NULL;
+
+		g_variant_get(parameters, "(&o)", &path);
+		service_lookup(svc->name, &link);
+		if (!g_str_has_prefix(path, CONNMAN_SERVICE_PREFIX) ||
+		    !service_lookup(path + strlen(CONNMAN_SERVICE_PREFIX), &target) ||
+		    link == target) {
+			g_dbus_method_invocation_return_dbus_error(invocation,
+								   "net.connman.Error.InvalidService",
+								   "Invalid service");
+			return;
+		}
+		g_queue_unlink(&mock.services, link);
+		if (!g_strcmp0(method, "MoveBefore"))
+			g_queue_insert_before_link(&mock.services, target, link);
+		else
+			g_queue_insert_after_link(&mock.services, target, link);
+		emit_services_changed(mock.services.head, NULL);
+		mock_reply(invocation, NULL);
+	} else {
+		g_dbus_method_invocation_return_dbus_error(invocation,
+							   "net.connman.Error.NotImplemented",
+							   "Not implemented");
+	}
+}
+
+static void handle_method_call(GDBusConnection *connection,
+			       const gchar *sender_name,
+			       const gchar *object_path,
+			       const gchar *interface_name,
+			       const gchar *method_name,
+			       GVariant *parameters,
+			       GDBusMethodInvocation *invocation,
+			       gpointer user_data)
+{
+	if (!g_strcmp0(interface_name, CONNMAN_MANAGER_INTERFACE))
+		handle_manager_call(invocation, method_name, parameters);
+	else if (!g_strcmp0(interface_name, CONNMAN_TECHNOLOGY_INTERFACE))
+		handle_technology_call(user_data, invocation, method_name, parameters);
+	else
+		handle_service_call(user_data, invocation, method_name, parameters);
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+	.method_call  = handle_method_call,
+};
+
+static struct mock_object *mock_object_new(const gchar *prefix,
+					   const gchar *name,
+					   const gchar *interface)
+{
+	struct mock_object *obj = g_new0(struct mock_object, 1);
+	GError *error = NULL;
+
+	obj->name = g_strdup(name);
+	obj->path = g_strconcat(prefix, name, NULL);
+	obj->properties = properties_new();
+	obj->registration_id =
+		g_dbus_connection_register_object(mock.conn, obj->path,
+						  g_dbus_node_info_lookup_interface(mock.node,
+										    interface),
+						  &interface_vtable, obj, NULL, &error);
+	if (!obj->registration_id) {
+		g_printerr("Failed to register %s: %s\n", obj->path, error->message);
+		g_error_free(error);
+	}
+
+	return obj;
+}
+
+static struct mock_object *technology_add(const gchar *name, gboolean powered)
+{
+	struct mock_object *tech = mock_object_new(CONNMAN_TECHNOLOGY_PREFIX, name,
+						   CONNMAN_TECHNOLOGY_INTERFACE);
+
+	properties_set(tech->properties, "Name", g_variant_new_string(name));
+	properties_set(tech->properties, "Type", g_variant_new_string(name));
+	properties_set(tech->properties, "Powered", g_variant_new_boolean(powered));
+	properties_set(tech->properties, "Connected", g_variant_new_boolean(FALSE));
+	properties_set(tech->properties, "Tethering", g_variant_new_boolean(FALSE));
+	g_hash_table_replace(mock.technologies, g_strdup(name), tech);
+
+	return tech;
+}
+
+static struct mock_object *service_add(const gchar *name, const gchar *security)
+{
+	const gchar *methods[] = { security, NULL };
+	struct mock_object *svc;
+
+	if (service_lookup(name, NULL))
+		return NULL;
+
+	svc = mock_object_new(CONNMAN_SERVICE_PREFIX, name, CONNMAN_SERVICE_INTERFACE);
+	properties_set(svc->properties, "Name", g_variant_new_string(name));
+	properties_set(svc->properties, "Type", g_variant_new_string("wifi"));
+	properties_set(svc->properties, "Security", g_variant_new_strv(methods, -1));
+	properties_set(svc->properties, "State", g_variant_new_string("idle"));
+	properties_set(svc->properties, "Strength",
+		       g_variant_new_byte(g_random_int_range(20, 100)));
+	properties_set(svc->properties, "Favorite", g_variant_new_boolean(FALSE));
+	properties_set(svc->properties, "AutoConnect", g_variant_new_boolean(FALSE));
+	g_queue_push_tail(&mock.services, svc);
+
+	return svc;
+}
+
+static void storm_emit(guint count)
+{
+	guint i;
+
+	for (i = 0; i < count && mock.services.length; i++) {
+		struct mock_object *svc =
+			g_queue_peek_nth(&mock.services,
+					 mock.storm_position++ % mock.services.length);
+
+		object_set_property(svc, CONNMAN_SERVICE_INTERFACE, "MockTimestamp",
+				    g_variant_new_int64(g_get_monotonic_time()));
+	}
+}
+
+static gboolean storm_tick_cb(gpointer user_data)
+{
+	guint count = MIN(mock.storm_per_tick, mock.storm_remaining);
+
+	storm_emit(count);
+	mock.storm_remaining -= count;
+	if (mock.storm_remaining)
+		return G_SOURCE_CONTINUE;
+
+	mock.storm_id = 0;
+
+	return G_SOURCE_REMOVE;
+}
+
+// A paced storm replaces any still running
+static void storm(guint count, guint rate)
+{
+	guint interval_ms;
+
+	if (mock.storm_id) {
+		g_source_remove(mock.storm_id);
+		mock.storm_id = 0;
+	}
+
+	if (!rate) {
+		storm_emit(count);
+		return;
+	}
+
+	// Ticks of at least 10 ms, so high rates emit in small batches
+	if (rate >= 100) {
+		interval_ms = 10;
+		mock.storm_per_tick = rate / 100;
+	} else {
+		interval_ms = 1000 / rate;
+		mock.storm_per_tick = 1;
+	}
+	mock.storm_remaining = count;
+	mock.storm_id = g_timeout_add(interval_ms, storm_tick_cb, NULL);
+}
+
+static gboolean churn_cb(gpointer user_data)
+{
+	GList *added = NULL, *removed = NULL;
+	guint i;
+
+	for (i = 0; i < mock.churn_count && mock.services.length; i++) {
+		guint n = g_random_int_range(0, mock.services.length);
+		struct mock_object *svc = g_queue_pop_nth(&mock.services, n);
+
+		removed = g_list_prepend(removed, g_strdup(svc->path));
+		mock_object_free(svc);
+	}
+	for (i = 0; i < mock.churn_count; i++) {
+		gchar *name = g_strdup_printf("wifi_churn_%06u_managed_psk",
+					      mock.churn_serial++);
+		struct mock_object *svc = service_add(name, "psk");
+
+		if (svc)
+			added = g_list_prepend(added, svc);
+		g_free(name);
+	}
+
+	emit_services_changed(added, removed);
+	g_list_free(added);
+	g_list_free_full(removed, g_free);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void churn(guint interval_ms, guint count)
+{
+	if (mock.churn_id) {
+		g_source_remove(mock.churn_id);
+		mock.churn_id = 0;
+	}
+
+	mock.churn_count = count;
+	if (interval_ms && count)
+		mock.churn_id = g_timeout_add(interval_ms, churn_cb, NULL);
+}
+
+static GVariant *parse_value(const gchar *text)
+{
+	GError *error = NULL;
+	GVariant *value = g_variant_parse(NULL, text, NULL, NULL, &error);
+
+	if (!value) {
+		g_printerr("Bad value '%s': %s\n", text, error->message);
+		g_error_free(error);
+	}
+
+	return value;
+}
+
+static void name_acquired(GDBusConnection *connection,
+			  const gchar *name,
+			  gpointer user_data)
+{
+	if (!mock.announced) {
+		printf("DBUS_ADDRESS=%s\n", (const gchar *) user_data);
+		fflush(stdout);
+		mock.announced = TRUE;
+	}
+	process_commands();
+}
+
+static void name_lost(GDBusConnection *connection,
+		      const gchar *name,
+		      gpointer user_data)
+{
+	g_printerr("Lost %s\n", name);
+}
+
+static void own_name(const gchar *address)
+{
+	mock.owner_id = g_bus_own_name_on_connection(mock.conn, CONNMAN_SERVICE,
+						     G_BUS_NAME_OWNER_FLAGS_NONE,
+						     name_acquired, name_lost,
+						     g_strdup(address), g_free);
+}
+
+static gboolean sleep_done_cb(gpointer user_data)
+{
+	mock.sleep_id = 0;
+	process_commands();
+
+	return G_SOURCE_REMOVE;
+}
+
+// Returns FALSE to stop processing until a sleep finishes
+static gboolean run_command(const gchar *line)
+{
+	gchar **argv = NULL;
+	gboolean rc = TRUE;
+	GVariant *value;
+	gint argc;
+
+	if (!g_shell_parse_argv(line, &argc, &argv, NULL))
+		return TRUE;
+
+	if (!g_strcmp0(argv[0], "latency") && argc == 2) {
+		mock.latency_ms = strtoul(argv[1], NULL, 10);
+	} else if (!g_strcmp0(argv[0], "add-service") && argc >= 2) {
+		struct mock_object *svc = service_add(argv[1], argc > 2 ? argv[2] : "psk");
+
+		if (svc) {
+			GList changed = { .data = svc };
+
+			emit_services_changed(&changed, NULL);
+		}
+	} else if (!g_strcmp0(argv[0], "remove-service") && argc == 2) {
+		service_remove(argv[1]);
+	} else if (!g_strcmp0(argv[0], "set-manager") && argc == 3) {
+		if ((value = parse_value(argv[2]))) {
+			properties_set(mock.manager_properties, argv[1], value);
+			emit_property_changed("/", CONNMAN_MANAGER_INTERFACE, argv[1], value);
+			g_variant_unref(value);
+		}
+	} else if (!g_strcmp0(argv[0], "set-technology") && argc == 4) {
+		struct mock_object *tech = g_hash_table_lookup(mock.technologies, argv[1]);
+
+		if (tech && (value = parse_value(argv[3]))) {
+			object_set_property(tech, CONNMAN_TECHNOLOGY_INTERFACE, argv[2], value);
+			g_variant_unref(value);
+		}
+	} else if (!g_strcmp0(argv[0], "set-service") && argc == 4) {
+		struct mock_object *svc = service_lookup(argv[1], NULL);
+
+		if (svc && (value = parse_value(argv[3]))) {
+			object_set_property(svc, CONNMAN_SERVICE_INTERFACE, argv[2], value);
+			g_variant_unref(value);
+		}
+	} else if (!g_strcmp0(argv[0], "storm") && (argc == 2 || argc == 3)) {
+		storm(strtoul(argv[1], NULL, 10),
+		      argc == 3 ? strtoul(argv[2], NULL, 10) : 0);
+	} else if (!g_strcmp0(argv[0], "churn") && argc == 3) {
+		churn(strtoul(argv[1], NULL, 10), strtoul(argv[2], NULL, 10));
+	} else if (!g_strcmp0(argv[0], "services-changed")) {
+		emit_services_changed(mock.services.head, NULL);
+	} else if (!g_strcmp0(argv[0], "fail-connect") && (argc == 4 || argc == 5)) {
+		struct connect_failure *failure = g_new0(struct connect_failure, 1);
+
+		failure->count = strtoul(argv[2], NULL, 10);
+		failure->error = g_strdup(argv[3]);
+		failure->service_error = g_strdup(argc == 5 ? argv[4] : NULL);
+		if (failure->count) {
+			g_hash_table_replace(mock.connect_failures, g_strdup(argv[1]), failure);
+		} else {
+			g_hash_table_remove(mock.connect_failures, argv[1]);
+			connect_failure_free(failure);
+		}
+	} else if (!g_strcmp0(argv[0], "agent-cancel")) {
+		if (mock.agent_path)
+			g_dbus_connection_call(mock.conn, mock.agent_sender, mock.agent_path,
+					       CONNMAN_AGENT_INTERFACE, "Cancel", NULL, NULL,
+					       G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+	} else if (!g_strcmp0(argv[0], "restart")) {
+		g_bus_unown_name(mock.owner_id);
+		g_clear_pointer(&mock.agent_sender, g_free);
+		g_clear_pointer(&mock.agent_path, g_free);
+		own_name(NULL);
+		rc = FALSE;	/* resumes once the name is reacquired */
+	} else if (!g_strcmp0(argv[0], "sleep") && argc == 2) {
+		mock.sleep_id = g_timeout_add(strtoul(argv[1], NULL, 10), sleep_done_cb, NULL);
+		rc = FALSE;
+	} else if (!g_strcmp0(argv[0], "quit")) {
+		g_main_loop_quit(mock.loop);
+		rc = FALSE;
+	} else {
+		g_printerr("Unknown command: %s\n", line);
+	}
+
+	g_strfreev(argv);
+	return rc;
+}
+
+static void process_commands(void)
+{
+	gchar *line;
+
+	if (mock.sleep_id)
+		return;
+
+	while ((line = g_queue_pop_head(&mock.commands))) {
+		gboolean rc = run_command(line);
+
+		g_free(line);
+		if (!rc)
+			break;
+	}
+}
+
+static gboolean stdin_cb(GIOChannel *channel, GIOCondition condition, gpointer user_data)
+{
+	gchar *line = NULL;
+
+	if (g_io_channel_read_line(channel, &line, NULL, NULL, NULL) != G_IO_STATUS_NORMAL)
+		return G_SOURCE_REMOVE;
+
+	g_strstrip(line);
+	if (!line[0] || line[0] == '#') {
+		g_free(line);
+		return G_SOURCE_CONTINUE;
+	}
+
+	g_queue_push_tail(&mock.commands, line);
+	if (mock.announced)
+		process_commands();
+
+	return G_SOURCE_CONTINUE;
+}
+
+int main(int argc, char *argv[])
+{
+	gchar *address = NULL, *script = NULL;
+	gint services = 10, latency = 0;
+	GOptionEntry entries[] = {
+		{ "address", 'a', 0, G_OPTION_ARG_STRING, &address,
+		  "Bus address to connect to instead of starting a private bus", "ADDRESS" },
+		{ "services", 's', 0, G_OPTION_ARG_INT, &services,
+		  "Number of wifi services to start with", "N" },
+		{ "latency", 'l', 0, G_OPTION_ARG_INT, &latency,
+		  "Method reply latency", "MS" },
+		{ "script", 'f', 0, G_OPTION_ARG_FILENAME, &script,
+		  "Commands to run once net.connman is owned", "FILE" },
+		{ NULL }
+	};
+	GOptionContext *context;
+	GTestDBus *bus = NULL;
+	GIOChannel *in;
+	GError *error = NULL;
+	gint i;
+
+	context = g_option_context_new("- mock ConnMan daemon");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	mock.latency_ms = MAX(latency, 0);
+
+	if (!address) {
+		bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+		g_test_dbus_up(bus);
+		address = g_strdup(g_test_dbus_get_bus_address(bus));
+	}
+
+	mock.conn = g_dbus_connection_new_for_address_sync(address,
+							   G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+							   G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+							   NULL, NULL, &error);
+	if (!mock.conn) {
+		g_printerr("Cannot connect to %s: %s\n", address, error->message);
+		return 1;
+	}
+
+	mock.node = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+	mock.loop = g_main_loop_new(NULL, FALSE);
+
+	mock.manager_properties = properties_new();
+	properties_set(mock.manager_properties, "State", g_variant_new_string("idle"));
+	properties_set(mock.manager_properties, "OfflineMode", g_variant_new_boolean(FALSE));
+	g_dbus_connection_register_object(mock.conn, "/",
+					  g_dbus_node_info_lookup_interface(mock.node,
+									    CONNMAN_MANAGER_INTERFACE),
+					  &interface_vtable, NULL, NULL, NULL);
+
+	mock.technologies = g_hash_table_new_full(g_str_hash, g_str_equal,
+						  g_free, mock_object_free);
+	mock.connect_failures = g_hash_table_new_full(g_str_hash, g_str_equal,
+						      g_free, connect_failure_free);
+	technology_add("wifi", TRUE);
+	technology_add("ethernet", TRUE);
+	technology_add("bluetooth", FALSE);
+
+	for (i = 0; i < services; i++) {
+		gchar *name = g_strdup_printf("wifi_mock_%04d_managed_psk", i);
+
+		service_add(name, "psk");
+		g_free(name);
+	}
+
+	if (script) {
+		gchar *contents = NULL;
+		gchar **lines;
+
+		if (!g_file_get_contents(script, &contents, NULL, &error)) {
+			g_printerr("%s\n", error->message);
+			return 1;
+		}
+		lines = g_strsplit(contents, "\n", -1);
+		for (i = 0; lines[i]; i++) {
+			g_strstrip(lines[i]);
+			if (lines[i][0] && lines[i][0] != '#')
+				g_queue_push_tail(&mock.commands, g_strdup(lines[i]));
+		}
+		g_strfreev(lines);
+		g_free(contents);
+	}
+
+	in = g_io_channel_unix_new(0);
+	g_io_add_watch(in, G_IO_IN | G_IO_HUP, stdin_cb, NULL);
+
+	own_name(address);
+	g_main_loop_run(mock.loop);
+
+	g_bus_unown_name(mock.owner_id);
+	g_queue_clear_full(&mock.commands, g_free);
+	g_queue_clear_full(&mock.services, mock_object_free);
+	g_hash_table_unref(mock.technologies);
+	g_hash_table_unref(mock.connect_failures);
+	g_hash_table_unref(mock.manager_properties);
+	g_dbus_node_info_unref(mock.node);
+	g_object_unref(mock.conn);
+	if (bus) {
+		g_test_dbus_down(bus);
+		g_object_unref(bus);
+	}
+	g_free(address);
+
+	return 0;
+}
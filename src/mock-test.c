@@ -0,0 +1,649 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Tests the library against mock-connmand.  The cases share one mock and
+ * one library instance and run in the order they are added, each using
+ * its own services where it changes their state.
+ *
+ * Usage: connman-glib-mock-test [GTest options] /path/to/mock-connmand
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "mock-client.h"
+
+#define TEST_TIMEOUT_MS		10000
+#define TEST_SECURED_SERVICE(n)	"wifi_mock_000" #n "_managed_psk"
+#define TEST_TIMING_SERVICE	"wifi_timing"
+
+static struct {
+	GMutex mutex;
+	GCond cond;
+
+	// agent
+	gboolean agent_answer;
+	guint agent_requests;
+	guint agent_cancels;
+	guint legacy_requests;	/* second subscriber */
+
+	// scans
+	guint scans_done;
+	gboolean scan_status;
+
+	// connects, connect_done counts callbacks since connect_reset()
+	guint connect_done;
+	guint connect_ok;
+	gboolean connect_status;
+	gchar *connect_error;
+
+	// timing of TEST_TIMING_SERVICE, without the strings
+	connman_connect_timing_t timing;
+	guint timings;
+} test;
+
+// Waits with the mutex held until *value reaches count
+static gboolean wait_count_locked(const guint *value, guint count)
+{
+	gint64 end_time = g_get_monotonic_time() +
+		TEST_TIMEOUT_MS * G_TIME_SPAN_MILLISECOND;
+
+	while (*value < count) {
+		if (!g_cond_wait_until(&test.cond, &test.mutex, end_time))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean wait_count(const guint *value, guint count)
+{
+	gboolean rc;
+
+	g_mutex_lock(&test.mutex);
+	rc = wait_count_locked(value, count);
+	g_mutex_unlock(&test.mutex);
+
+	return rc;
+}
+
+// Reads one of mock-connmand's call counters, 0 before the first call
+static guint mock_counter(connman_property_type_t type,
+			  const gchar *object,
+			  const gchar *name)
+{
+	GVariant *value = connman_get_property(type, object, name);
+	guint count = 0;
+
+	if (value) {
+		count = g_variant_get_uint32(value);
+		g_variant_unref(value);
+	}
+
+	return count;
+}
+
+static void agent_cb(connman_agent_method_t method,
+		     const gchar *object,
+		     const int id,
+		     GVariant *parameters,
+		     gpointer user_data)
+{
+	GVariantBuilder builder;
+	gboolean answer;
+
+	g_mutex_lock(&test.mutex);
+	if (method == CONNMAN_AGENT_REQUEST_INPUT)
+		test.agent_requests++;
+	else if (method == CONNMAN_AGENT_CANCEL)
+		test.agent_cancels++;
+	answer = test.agent_answer;
+	g_cond_broadcast(&test.cond);
+	g_mutex_unlock(&test.mutex);
+
+	if (method != CONNMAN_AGENT_REQUEST_INPUT || !answer)
+		return;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&builder, "{sv}", "Passphrase",
+			      g_variant_new_string("mock-passphrase"));
+	connman_agent_response(id, g_variant_new("(@a{sv})",
+						 g_variant_builder_end(&builder)));
+}
+
+static void agent_reset(gboolean answer)
+{
+	g_mutex_lock(&test.mutex);
+	test.agent_answer = answer;
+	test.agent_requests = 0;
+	test.agent_cancels = 0;
+	g_mutex_unlock(&test.mutex);
+}
+
+static void scan_cb(const gchar *technology,
+		    gboolean status,
+		    const char *error,
+		    GVariant *added,
+		    GVariant *removed,
+		    gpointer user_data)
+{
+	g_mutex_lock(&test.mutex);
+	test.scans_done++;
+	test.scan_status = test.scan_status && status;
+	g_cond_broadcast(&test.cond);
+	g_mutex_unlock(&test.mutex);
+}
+
+static void connect_cb(const gchar *service,
+		       gboolean status,
+		       const char *error,
+		       gpointer user_data)
+{
+	g_mutex_lock(&test.mutex);
+	test.connect_done++;
+	if (status)
+		test.connect_ok++;
+	test.connect_status = status;
+	g_free(test.connect_error);
+	test.connect_error = g_strdup(error);
+	g_cond_broadcast(&test.cond);
+	g_mutex_unlock(&test.mutex);
+}
+
+static void connect_reset(void)
+{
+	g_mutex_lock(&test.mutex);
+	test.connect_done = 0;
+	test.connect_ok = 0;
+	test.connect_status = FALSE;
+	g_clear_pointer(&test.connect_error, g_free);
+	g_mutex_unlock(&test.mutex);
+}
+
+// Waits for connect_cb, returns the status it got
+static gboolean connect_wait(void)
+{
+	gboolean status;
+
+	g_mutex_lock(&test.mutex);
+	g_assert_true(wait_count_locked(&test.connect_done, 1));
+	status = test.connect_status;
+	g_mutex_unlock(&test.mutex);
+
+	return status;
+}
+
+// Adds a service, once present any earlier commands have been run
+static void add_service(const gchar *service, const gchar *security)
+{
+	mock_client_command("add-service %s %s", service, security);
+	g_assert_true(connman_wait_for(CONNMAN_PROPERTY_SERVICE, service, "State",
+				       g_variant_new_string("idle"), TEST_TIMEOUT_MS));
+}
+
+static void assert_passphrase(const gchar *service, const gchar *passphrase)
+{
+	GVariant *value;
+
+	g_assert_true(connman_wait_for(CONNMAN_PROPERTY_SERVICE, service, "MockPassphrase",
+				       g_variant_new_string(passphrase), TEST_TIMEOUT_MS));
+	value = connman_get_property(CONNMAN_PROPERTY_SERVICE, service, "MockPassphrase");
+	g_assert_cmpstr(g_variant_get_string(value, NULL), ==, passphrase);
+	g_variant_unref(value);
+}
+
+static void assert_connects(const gchar *service, guint count)
+{
+	g_assert_true(connman_wait_for(CONNMAN_PROPERTY_SERVICE, service, "MockConnects",
+				       g_variant_new_uint32(count), TEST_TIMEOUT_MS));
+	g_assert_cmpuint(mock_counter(CONNMAN_PROPERTY_SERVICE, service, "MockConnects"),
+			 ==, count);
+}
+
+static void test_connect(void)
+{
+	agent_reset(TRUE);
+	connect_reset();
+
+	g_assert_true(connman_service_connect(TEST_SECURED_SERVICE(3), connect_cb, NULL));
+	g_assert_true(connect_wait());
+	g_assert_cmpuint(test.agent_requests, ==, 1);
+	g_assert_true(connman_wait_for(CONNMAN_PROPERTY_SERVICE, TEST_SECURED_SERVICE(3),
+				       "State", g_variant_new_string("ready"),
+				       TEST_TIMEOUT_MS));
+	connman_service_disconnect(TEST_SECURED_SERVICE(3));
+}
+
+static void test_wait_for(void)
+{
+	gint64 start;
+
+	mock_client_command("set-manager State \"'online'\"");
+	g_assert_true(connman_wait_for(CONNMAN_PROPERTY_MANAGER, NULL, "State",
+				       g_variant_new_string("online"), TEST_TIMEOUT_MS));
+
+	start = g_get_monotonic_time();
+	g_assert_false(connman_wait_for(CONNMAN_PROPERTY_MANAGER, NULL, "State",
+					g_variant_new_string("never"), 200));
+	g_assert_cmpint(g_get_monotonic_time() - start, >=, 200 * G_TIME_SPAN_MILLISECOND);
+}
+
+// Runs before any other scan, so the first background one is due at once
+static void test_scan_leases(void)
+{
+	guint before = mock_counter(CONNMAN_PROPERTY_TECHNOLOGY, "wifi", "MockScans");
+	guint lease;
+
+	// Nothing is scanned while the technology is off
+	mock_client_command("set-technology wifi Powered false");
+	g_assert_true(connman_wait_for(CONNMAN_PROPERTY_TECHNOLOGY, "wifi", "Powered",
+				       g_variant_new_boolean(FALSE), TEST_TIMEOUT_MS));
+	lease = connman_scan_lease_acquire("wifi", CONNMAN_SCAN_INTEREST_ACTIVE);
+	g_assert_cmpuint(lease, !=, 0);
+	g_usleep(500 * 1000);
+	g_assert_cmpuint(mock_counter(CONNMAN_PROPERTY_TECHNOLOGY, "wifi", "MockScans"),
+			 ==, before);
+
+	mock_client_command("set-technology wifi Powered true");
+	g_assert_true(connman_wait_for(CONNMAN_PROPERTY_TECHNOLOGY, "wifi", "MockScans",
+				       g_variant_new_uint32(before + 1), TEST_TIMEOUT_MS));
+
+	// Without a lease the next active scan, due 15 s later, never comes
+	connman_scan_lease_release(lease);
+	if (g_test_slow()) {
+		g_usleep(16 * G_USEC_PER_SEC);
+		g_assert_cmpuint(mock_counter(CONNMAN_PROPERTY_TECHNOLOGY, "wifi", "MockScans"),
+				 ==, before + 1);
+	}
+}
+
+static void test_scan_coalescing(void)
+{
+	guint before = mock_counter(CONNMAN_PROPERTY_TECHNOLOGY, "wifi", "MockScans");
+	guint i;
+
+	g_mutex_lock(&test.mutex);
+	test.scans_done = 0;
+	test.scan_status = TRUE;
+	g_mutex_unlock(&test.mutex);
+
+	// The second and third join the first
+	for (i = 0; i < 3; i++)
+		g_assert_true(connman_technology_scan_async("wifi", scan_cb, NULL));
+	g_assert_true(wait_count(&test.scans_done, 3));
+	g_assert_true(test.scan_status);
+
+	g_assert_true(connman_wait_for(CONNMAN_PROPERTY_TECHNOLOGY, "wifi", "MockScans",
+				       g_variant_new_uint32(before + 1), TEST_TIMEOUT_MS));
+	g_assert_cmpuint(mock_counter(CONNMAN_PROPERTY_TECHNOLOGY, "wifi", "MockScans"),
+			 ==, before + 1);
+}
+
+static void test_agent_timeout(void)
+{
+	agent_reset(FALSE);
+	connect_reset();
+	connman_set_agent_timeout(300);
+
+	g_assert_true(connman_service_connect(TEST_SECURED_SERVICE(1), connect_cb, NULL));
+	g_assert_false(connect_wait());
+	g_assert_true(wait_count(&test.agent_cancels, 1));
+	g_assert_cmpuint(test.agent_requests, ==, 1);
+
+	connman_set_agent_timeout(60000);	/* the default */
+	agent_reset(TRUE);
+}
+
+static void test_agent_cancel(void)
+{
+	agent_reset(FALSE);
+	connect_reset();
+
+	g_assert_true(connman_service_connect(TEST_SECURED_SERVICE(2), connect_cb, NULL));
+	g_assert_true(wait_count(&test.agent_requests, 1));
+	mock_client_command("agent-cancel");
+	g_assert_false(connect_wait());
+	g_assert_true(wait_count(&test.agent_cancels, 1));
+
+	agent_reset(TRUE);
+}
+
+static void legacy_agent_cb(const gchar *service,
+			    const int id,
+			    GVariant *properties,
+			    gpointer user_data)
+{
+	g_mutex_lock(&test.mutex);
+	test.legacy_requests++;
+	g_cond_broadcast(&test.cond);
+	g_mutex_unlock(&test.mutex);
+}
+
+static void test_agent_parallel(void)
+{
+	const gchar *services[] = { "wifi_parallel_a", "wifi_parallel_b" };
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(services); i++)
+		add_service(services[i], "psk");
+	agent_reset(TRUE);
+	connect_reset();
+	g_mutex_lock(&test.mutex);
+	test.legacy_requests = 0;
+	g_mutex_unlock(&test.mutex);
+
+	// agent_cb answers, the second subscriber only sees the requests
+	connman_add_agent_event_callback(legacy_agent_cb, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(services); i++)
+		g_assert_true(connman_service_connect(services[i], connect_cb, NULL));
+	g_assert_true(wait_count(&test.connect_done, G_N_ELEMENTS(services)));
+	g_assert_cmpuint(test.connect_ok, ==, G_N_ELEMENTS(services));
+	g_assert_cmpuint(test.agent_requests, ==, G_N_ELEMENTS(services));
+	g_assert_cmpuint(test.legacy_requests, ==, G_N_ELEMENTS(services));
+
+	for (i = 0; i < G_N_ELEMENTS(services); i++) {
+		assert_passphrase(services[i], "mock-passphrase");
+		connman_service_disconnect(services[i]);
+	}
+}
+
+// Connects with the agent not answering, so only the cache can succeed
+static gboolean connect_cached(const gchar *service)
+{
+	gboolean status;
+
+	agent_reset(FALSE);
+	connect_reset();
+	connman_set_agent_timeout(300);
+	g_assert_true(connman_service_connect(service, connect_cb, NULL));
+	status = connect_wait();
+	connman_set_agent_timeout(60000);	/* the default */
+	connman_service_disconnect(service);
+
+	g_mutex_lock(&test.mutex);
+	test.agent_answer = TRUE;
+	g_mutex_unlock(&test.mutex);
+
+	return status;
+}
+
+static GVariant *passphrase_new(const gchar *passphrase)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+	if (passphrase)
+		g_variant_builder_add(&builder, "{sv}", "Passphrase",
+				      g_variant_new_string(passphrase));
+
+	return g_variant_builder_end(&builder);
+}
+
+static void test_credentials(void)
+{
+	gchar *service, *passphrase;
+	guint i;
+
+	if (!connman_agent_credentials_enable(4)) {
+		g_test_skip("Cannot lock the credential cache in memory");
+		return;
+	}
+
+	g_assert_false(connman_agent_credentials_set(TEST_SECURED_SERVICE(4), NULL));
+	for (i = 4; i <= 7; i++) {
+		service = g_strdup_printf("wifi_mock_%04u_managed_psk", i);
+		passphrase = g_strdup_printf("cached-%u", i);
+		g_assert_true(connman_agent_credentials_set(service, passphrase_new(passphrase)));
+		g_free(passphrase);
+		g_free(service);
+	}
+
+	// A hit makes 4 the most recently used, so the fifth service evicts 5
+	g_assert_true(connect_cached(TEST_SECURED_SERVICE(4)));
+	g_assert_cmpuint(test.agent_requests, ==, 0);
+	assert_passphrase(TEST_SECURED_SERVICE(4), "cached-4");
+	g_assert_true(connman_agent_credentials_set(TEST_SECURED_SERVICE(8),
+						    passphrase_new("cached-8")));
+
+	g_assert_true(connect_cached(TEST_SECURED_SERVICE(8)));
+	g_assert_cmpuint(test.agent_requests, ==, 0);
+	assert_passphrase(TEST_SECURED_SERVICE(8), "cached-8");
+
+	g_assert_true(connect_cached(TEST_SECURED_SERVICE(4)));
+	g_assert_cmpuint(test.agent_requests, ==, 0);
+
+	g_assert_false(connect_cached(TEST_SECURED_SERVICE(5)));
+	g_assert_cmpuint(test.agent_requests, ==, 1);
+
+	// An empty answer is not cached, and must not alias another entry
+	connman_agent_credentials_forget(NULL);
+	g_assert_false(connman_agent_credentials_set(TEST_SECURED_SERVICE(9),
+						     passphrase_new(NULL)));
+	g_assert_true(connman_agent_credentials_set(TEST_SECURED_SERVICE(0),
+						    passphrase_new("cached-0")));
+	g_assert_false(connect_cached(TEST_SECURED_SERVICE(9)));
+	g_assert_cmpuint(test.agent_requests, ==, 1);
+	g_assert_true(connect_cached(TEST_SECURED_SERVICE(0)));
+	assert_passphrase(TEST_SECURED_SERVICE(0), "cached-0");
+
+	connman_agent_credentials_enable(0);
+}
+
+static void test_retry_transient(void)
+{
+	const connman_retry_policy_t policy = { 3, 50, 100, 0 };
+	const gchar *service = "wifi_retry_transient";
+
+	mock_client_command("fail-connect %s 2 net.connman.Error.Failed connect-failed", service);
+	add_service(service, "none");
+	connect_reset();
+
+	g_assert_true(connman_service_connect_with_retry(service, &policy, connect_cb, NULL));
+	g_assert_true(connect_wait());
+	assert_connects(service, 3);
+	connman_service_disconnect(service);
+}
+
+static void test_retry_fatal(void)
+{
+	const connman_retry_policy_t policy = { 3, 50, 100, 0 };
+	const gchar *service = "wifi_retry_fatal";
+
+	mock_client_command("fail-connect %s 1 net.connman.Error.Failed invalid-key", service);
+	add_service(service, "none");
+	connect_reset();
+
+	g_assert_true(connman_service_connect_with_retry(service, &policy, connect_cb, NULL));
+	g_assert_false(connect_wait());
+	g_assert_cmpstr(test.connect_error, ==, "invalid-key");
+	assert_connects(service, 1);
+}
+
+static void test_retry_exhausted(void)
+{
+	const connman_retry_policy_t policy = { 3, 50, 100, 0 };
+	const gchar *service = "wifi_retry_exhausted";
+
+	mock_client_command("fail-connect %s 5 net.connman.Error.Failed connect-failed", service);
+	add_service(service, "none");
+	connect_reset();
+
+	g_assert_true(connman_service_connect_with_retry(service, &policy, connect_cb, NULL));
+	g_assert_false(connect_wait());
+	g_assert_cmpstr(test.connect_error, ==, "connect-failed");
+	assert_connects(service, 3);
+	mock_client_command("fail-connect %s 0 -", service);
+}
+
+static void test_retry_cancel(void)
+{
+	const connman_retry_policy_t policy = { 5, 5000, 5000, 0 };
+	const gchar *service = "wifi_retry_cancel";
+
+	mock_client_command("fail-connect %s 5 net.connman.Error.Failed connect-failed", service);
+	add_service(service, "none");
+	connect_reset();
+
+	g_assert_true(connman_service_connect_with_retry(service, &policy, connect_cb, NULL));
+	assert_connects(service, 1);
+	connman_service_disconnect(service);
+	g_assert_false(connect_wait());
+	g_assert_cmpstr(test.connect_error, ==, "Connect cancelled");
+	g_assert_cmpuint(mock_counter(CONNMAN_PROPERTY_SERVICE, service, "MockConnects"),
+			 ==, 1);
+	mock_client_command("fail-connect %s 0 -", service);
+}
+
+static void timing_cb(const connman_connect_timing_t *timing, gpointer user_data)
+{
+	if (g_strcmp0(timing->service, TEST_TIMING_SERVICE))
+		return;
+
+	g_mutex_lock(&test.mutex);
+	test.timing = *timing;
+	test.timing.service = NULL;
+	test.timing.error = NULL;
+	test.timings++;
+	g_cond_broadcast(&test.cond);
+	g_mutex_unlock(&test.mutex);
+}
+
+static void test_connect_timing(void)
+{
+	const connman_connect_timing_t *t = &test.timing;
+	gboolean found = FALSE;
+	GVariant *timings, *record;
+	GVariantIter iter;
+	const gchar *name;
+	gint64 span;
+
+	add_service(TEST_TIMING_SERVICE, "psk");
+	agent_reset(TRUE);
+	connect_reset();
+	connman_set_connect_timing_callback(timing_cb, NULL);
+
+	g_assert_true(connman_service_connect(TEST_TIMING_SERVICE, connect_cb, NULL));
+	g_assert_true(connect_wait());
+	// The mock stops at ready, getting online completes the record
+	mock_client_command("set-service %s State \"'online'\"", TEST_TIMING_SERVICE);
+	g_assert_true(wait_count(&test.timings, 1));
+	connman_set_connect_timing_callback(NULL, NULL);
+
+	g_mutex_lock(&test.mutex);
+	g_assert_true(t->success);
+	g_assert_cmpint(t->request_input, >=, 0);
+	g_assert_cmpint(t->agent_response, >=, t->request_input);
+	g_assert_cmpint(t->association, >=, t->agent_response);
+	g_assert_cmpint(t->configuration, >=, t->association);
+	g_assert_cmpint(t->ready, >=, t->configuration);
+	g_assert_cmpint(t->online, >=, t->ready);
+	g_assert_cmpint(t->total, >=, t->online);
+	g_mutex_unlock(&test.mutex);
+
+	timings = g_variant_ref_sink(connman_connect_timings());
+	g_variant_iter_init(&iter, timings);
+	while ((record = g_variant_iter_next_value(&iter))) {
+		if (g_variant_lookup(record, "service", "&s", &name) &&
+		    !g_strcmp0(name, TEST_TIMING_SERVICE)) {
+			g_assert_true(g_variant_lookup(record, "prompt_us", "x", &span));
+			g_assert_true(g_variant_lookup(record, "online_check_us", "x", &span));
+			found = TRUE;
+		}
+		g_variant_unref(record);
+	}
+	g_variant_unref(timings);
+	g_assert_true(found);
+
+	connman_service_disconnect(TEST_TIMING_SERVICE);
+}
+
+static void test_policy(void)
+{
+	const gchar *blacklist[] = { "wifi_policy_blocked", NULL };
+	const gchar *services[] = { "wifi_policy_blocked", "wifi_policy_best" };
+	connman_policy_t policy = {
+		.min_strength = 100,	/* above the mock's random strengths */
+		.blacklist = blacklist,
+	};
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(services); i++) {
+		add_service(services[i], "none");
+		mock_client_command("set-service %s Strength \"byte 100\"", services[i]);
+		g_assert_true(connman_wait_for(CONNMAN_PROPERTY_SERVICE, services[i], "Strength",
+					       g_variant_new_byte(100), TEST_TIMEOUT_MS));
+	}
+
+	// Only the service that is not blacklisted qualifies
+	g_assert_true(connman_policy_enable(&policy));
+	assert_connects("wifi_policy_best", 1);
+	g_assert_true(connman_wait_for(CONNMAN_PROPERTY_SERVICE, "wifi_policy_best", "State",
+				       g_variant_new_string("ready"), TEST_TIMEOUT_MS));
+	connman_policy_disable();
+	g_assert_cmpuint(mock_counter(CONNMAN_PROPERTY_SERVICE, "wifi_policy_blocked",
+				      "MockConnects"), ==, 0);
+
+	connman_service_disconnect("wifi_policy_best");
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+
+	g_test_init(&argc, &argv, NULL);
+	if (argc != 2) {
+		g_printerr("Usage: %s [GTest options] MOCK_CONNMAND\n", argv[0]);
+		return 1;
+	}
+
+	g_mutex_init(&test.mutex);
+	g_cond_init(&test.cond);
+	test.agent_answer = TRUE;
+
+	if (!mock_client_start(argv[1], 10))
+		return 1;
+
+	connman_add_agent_method_callback(agent_cb, NULL);
+	if (!connman_init(TRUE)) {
+		g_printerr("connman_init failed\n");
+		return 1;
+	}
+
+	g_test_add_func("/mock/connect", test_connect);
+	g_test_add_func("/mock/wait-for", test_wait_for);
+	g_test_add_func("/mock/scan/leases", test_scan_leases);
+	g_test_add_func("/mock/scan/coalescing", test_scan_coalescing);
+	g_test_add_func("/mock/agent/timeout", test_agent_timeout);
+	g_test_add_func("/mock/agent/cancel", test_agent_cancel);
+	g_test_add_func("/mock/agent/parallel", test_agent_parallel);
+	g_test_add_func("/mock/agent/credentials", test_credentials);
+	g_test_add_func("/mock/retry/transient", test_retry_transient);
+	g_test_add_func("/mock/retry/fatal", test_retry_fatal);
+	g_test_add_func("/mock/retry/exhausted", test_retry_exhausted);
+	g_test_add_func("/mock/retry/cancel", test_retry_cancel);
+	g_test_add_func("/mock/connect/timing", test_connect_timing);
+	g_test_add_func("/mock/policy", test_policy);
+	rc = g_test_run();
+
+	mock_client_stop();
+
+	return rc;
+}
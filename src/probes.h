@@ -0,0 +1,74 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#include <glib.h>
+
+/*
+ * USDT probes under the "connman_glib" provider.  They compile to a nop,
+ * an ELF note and a semaphore when sys/sdt.h is available (the "tracing"
+ * build option), and to nothing otherwise.  A probe only evaluates its
+ * arguments while a tracer has it enabled, and call ids are only taken
+ * while call__start is:
+ *
+ *   call__start(id, interface, method, path)
+ *   call__done(id, interface, method, error message or NULL)
+ *   signal(interface, member, path)
+ *   callback__start(object, member, callback)
+ *   callback__done(object, member, callback)
+ *   agent__request(id, method, service)
+ *   agent__response(id)
+ */
+
+#ifdef HAVE_SYS_SDT_H
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define CONNMAN_PROBE_SEMAPHORE(name) connman_glib_##name##_semaphore
+
+/* Set by the tracer while a probe is attached, defined in connman-call.c */
+extern unsigned short CONNMAN_PROBE_SEMAPHORE(call__start);
+extern unsigned short CONNMAN_PROBE_SEMAPHORE(call__done);
+extern unsigned short CONNMAN_PROBE_SEMAPHORE(signal);
+extern unsigned short CONNMAN_PROBE_SEMAPHORE(callback__start);
+extern unsigned short CONNMAN_PROBE_SEMAPHORE(callback__done);
+extern unsigned short CONNMAN_PROBE_SEMAPHORE(agent__request);
+extern unsigned short CONNMAN_PROBE_SEMAPHORE(agent__response);
+
+extern gint connman_probe_last_id;
+
+#define CONNMAN_PROBE_NEXT_ID() \
+	(G_UNLIKELY(CONNMAN_PROBE_SEMAPHORE(call__start)) ? \
+	 (guint) g_atomic_int_add(&connman_probe_last_id, 1) + 1 : 0)
+
+#define CONNMAN_PROBE(name, ...) \
+	do { \
+		if (G_UNLIKELY(CONNMAN_PROBE_SEMAPHORE(name))) \
+			STAP_PROBEV(connman_glib, name, __VA_ARGS__); \
+	} while (0)
+
+#else
+
+#define CONNMAN_PROBE_NEXT_ID()		0
+
+#define CONNMAN_PROBE(name, ...)	do { } while (0)
+
+#endif
+
+#endif /* PROBES_H */
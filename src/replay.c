@@ -0,0 +1,154 @@
+/*
+ * Copyright 2022 Konsulko Group
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Replays a capture written with connman_capture_start() into the
+ * library at the recorded pace, or faster with --speed, so the same
+ * traffic can be profiled run after run.  mock-connmand only provides
+ * the bus and an empty service list; the captured signals go straight to
+ * the handlers with connman_inject_signal().  A JSON summary is printed
+ * at the end.
+ *
+ * Usage: connman-glib-replay --mock /path/to/mock-connmand [--speed X] CAPTURE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+
+#include "connman-glib.h"
+#include "mock-client.h"
+
+static struct {
+	GMutex mutex;
+	guint manager_events;
+	guint technology_events;
+	guint service_events;
+} stats;
+
+static void manager_cb(const gchar *path,
+		       connman_manager_event_t event,
+		       GVariant *properties,
+		       gpointer user_data)
+{
+	g_mutex_lock(&stats.mutex);
+	stats.manager_events++;
+	g_mutex_unlock(&stats.mutex);
+}
+
+static void technology_property_cb(const gchar *technology,
+				   GVariant *property,
+				   gpointer user_data)
+{
+	g_mutex_lock(&stats.mutex);
+	stats.technology_events++;
+	g_mutex_unlock(&stats.mutex);
+}
+
+static void service_property_cb(const gchar *service,
+				GVariant *property,
+				gpointer user_data)
+{
+	g_mutex_lock(&stats.mutex);
+	stats.service_events++;
+	g_mutex_unlock(&stats.mutex);
+}
+
+static gdouble timeval_s(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	gchar *mock = NULL;
+	gdouble speed = 1.0;
+	gboolean metrics = FALSE;
+	GOptionEntry entries[] = {
+		{ "mock", 'm', 0, G_OPTION_ARG_FILENAME, &mock,
+		  "mock-connmand to run, provides the bus", "PATH" },
+		{ "speed", 's', 0, G_OPTION_ARG_DOUBLE, &speed,
+		  "Replay speed factor, 0 replays as fast as possible", "X" },
+		{ "metrics", 0, 0, G_OPTION_ARG_NONE, &metrics,
+		  "Also print the library metrics in OpenMetrics format", NULL },
+		{ NULL }
+	};
+	GOptionContext *context;
+	GError *error = NULL;
+	struct rusage usage;
+	gint64 start, elapsed, replayed;
+
+	context = g_option_context_new("CAPTURE - replay a connman-glib capture");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error) ||
+	    !mock || argc != 2 || speed < 0) {
+		g_printerr("%s\n", error ? error->message :
+			   "--mock and a capture file are required");
+		return 1;
+	}
+	g_option_context_free(context);
+
+	g_mutex_init(&stats.mutex);
+
+	if (!mock_client_start(mock, 0))
+		return 1;
+
+	connman_metrics_enable(metrics);
+	connman_add_manager_event_callback(manager_cb, NULL);
+	connman_add_technology_property_event_callback(technology_property_cb, NULL);
+	connman_add_service_property_event_callback(service_property_cb, NULL);
+	if (!connman_init(FALSE)) {
+		g_printerr("connman_init failed\n");
+		return 1;
+	}
+
+	start = g_get_monotonic_time();
+	replayed = connman_capture_replay(argv[1], speed);
+	elapsed = g_get_monotonic_time() - start;
+	if (replayed < 0)
+		return 1;
+
+	// Let the handler thread catch up
+	g_usleep(G_USEC_PER_SEC);
+	getrusage(RUSAGE_SELF, &usage);
+
+	g_mutex_lock(&stats.mutex);
+	printf("{\n  \"capture\": \"%s\",\n  \"speed\": %.2f,\n"
+	       "  \"signals\": %" G_GINT64_FORMAT ",\n  \"elapsed_s\": %.3f,\n"
+	       "  \"manager_events\": %u,\n  \"technology_events\": %u,\n"
+	       "  \"service_events\": %u,\n"
+	       "  \"cpu_user_s\": %.3f,\n  \"cpu_system_s\": %.3f,\n"
+	       "  \"max_rss_kb\": %ld\n}\n",
+	       argv[1], speed, replayed, elapsed / 1e6,
+	       stats.manager_events, stats.technology_events, stats.service_events,
+	       timeval_s(&usage.ru_utime), timeval_s(&usage.ru_stime),
+	       usage.ru_maxrss);
+	g_mutex_unlock(&stats.mutex);
+
+	if (metrics) {
+		gchar *text = connman_metrics_openmetrics();
+
+		fputs(text, stdout);
+		g_free(text);
+	}
+
+	mock_client_stop();
+
+	return 0;
+}
@@ -56,6 +56,34 @@ void service_property_event_cb(const gchar *service,
 	printf("%s - exit\n\n", __FUNCTION__);
 }
 
+static GMutex scan_mutex;
+static GCond scan_cond;
+static gboolean scan_done;
+static gboolean scan_status;
+
+void scan_cb(const gchar *technology,
+	     gboolean status,
+	     const char *error,
+	     GVariant *added,
+	     GVariant *removed,
+	     gpointer user_data)
+{
+	gchar *added_str = g_variant_print(added, TRUE);
+	gchar *removed_str = g_variant_print(removed, TRUE);
+
+	printf("%s scan %s%s\n", technology, status ? "done" : "failed: ",
+	       status ? "" : error);
+	printf("added: %s\n", added_str);
+	printf("removed: %s\n", removed_str);
+	g_free(added_str);
+	g_free(removed_str);
+
+	g_mutex_lock(&scan_mutex);
+	scan_status = status;
+	scan_done = TRUE;
+	g_cond_signal(&scan_cond);
+	g_mutex_unlock(&scan_mutex);
+}
 
 int main(int argc, char *argv[])
 {
@@ -102,16 +130,23 @@ int main(int argc, char *argv[])
 	}
 
 	rc = connman_technology_enable("wifi");
-	sleep(5);
+	rc = connman_wait_for(CONNMAN_PROPERTY_TECHNOLOGY, "wifi", "Powered",
+			      g_variant_new_boolean(TRUE), 5000);
+	printf("wifi powered = %d\n", rc);
 
-	rc = connman_technology_scan_services("wifi");
+	rc = connman_technology_scan_async("wifi", scan_cb, NULL);
+	if(rc) {
+		g_mutex_lock(&scan_mutex);
+		while (!scan_done)
+			g_cond_wait(&scan_cond, &scan_mutex);
+		rc = scan_status;
+		g_mutex_unlock(&scan_mutex);
+	}
 	if(!rc) {
 		printf("wifi scan failed!\n");
 		exit(1);
 	}
 
-	sleep(20);
-
 	reply = NULL;
 	rc = connman_get_services(&reply);
 	if(rc) {